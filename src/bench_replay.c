@@ -0,0 +1,212 @@
+// Replays a journal recorded with `a.out -j <journal>` against a headless
+// renderer and reports how long each event took to be handled and drawn.
+//
+// usage: bench_replay <journal> [file...]
+
+// for memfd_create
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+    #include <sys/mman.h>
+#endif
+
+#include "editor.h"
+#include "exec.h"
+#include "grep.h"
+#include "journal.h"
+#include "termkey.h"
+#include "utf.h"
+
+static double now(void) {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int double_cmp(const void *a, const void *b) {
+    double va = *(const double*)a;
+    double vb = *(const double*)b;
+    return (va > vb) - (va < vb);
+}
+
+static double percentile(const Vec *sorted, double p) {
+    if(!sorted->len) return 0;
+    size_t idx = (size_t)(p * (sorted->len - 1));
+    return *VEC_GET(double, sorted, idx);
+}
+
+// Returns the number of bytes written to `fd` since the last call and
+// empties it so the file does not grow for the whole session
+static size_t drain_output(int fd) {
+    off_t len = lseek(fd, 0, SEEK_CUR);
+    if(len < 0) return 0;
+    if(ftruncate(fd, 0)) return len;
+    lseek(fd, 0, SEEK_SET);
+    return len;
+}
+
+// Runs a turn of the background work the event loop of main.c does before
+// reading keys: the output of the shell commands, the search and
+// highlighting of the rest of the buffer and the files of a `:grep`
+static void idle_poll(void) {
+    exec_jobs_poll();
+    editor_search_poll();
+    editor_syntax_poll();
+    grep_poll();
+}
+
+// The renderer syncs the terminal after moving the cursor, use a memory
+// backed file when possible so that does not turn into disk writes
+static int screen_open(void) {
+#ifdef __linux__
+    int fd = memfd_create("bench_replay_screen", 0);
+    if(fd >= 0) return fd;
+#endif
+    FILE *f = tmpfile();
+    if(!f) return -1;
+    return dup(fileno(f));
+}
+
+static int open_file(const char *path) {
+    struct Buffer *buff = calloc(1, sizeof(struct Buffer));
+    if(!buffer_init_from_path(buff, path, FM_RW)) {}
+    // try to open the file as readonly
+    else if(errno == EACCES && !buffer_init_from_path(buff, path, FM_RO)) {}
+    else {
+        free(buff);
+        return -1;
+    }
+
+    struct View view = view_new(buff);
+    struct Window win = window_new();
+    window_view_push(&win, view);
+    struct Tab tab = tab_new(win, path);
+    tabs_push(tab);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <journal> [file...]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *journal = journal_reader_open(argv[1]);
+    if(!journal) {
+        perror("unable to open journal");
+        return 1;
+    }
+
+    load_locale();
+
+    for(int i = 2; i < argc; i++) {
+        if(open_file(argv[i])) {
+            perror("unable to open file");
+            return 1;
+        }
+    }
+
+    // the screen is rendered into a file to count the bytes emitted
+    int screen_fd = screen_open();
+    // keys are fed to `readkey` through a file, reads return 0 once it's empty
+    FILE *input = tmpfile();
+    if(screen_fd < 0 || !input) {
+        perror("unable to create temporary files");
+        return 1;
+    }
+    int input_fd = fileno(input);
+    int stdout_fd = dup(STDOUT_FILENO);
+    if(stdout_fd < 0 || dup2(screen_fd, STDOUT_FILENO) < 0) {
+        perror("unable to redirect stdout");
+        return 1;
+    }
+
+    WS.ws_col = 80;
+    WS.ws_row = 24;
+
+    editor_init();
+
+    double start = now();
+    editor_render(&WS);
+    size_t first_frame_bytes = drain_output(STDOUT_FILENO);
+    double first_frame = now() - start;
+
+    Vec latencies = VEC_NEW(double, 0);
+    size_t total_bytes = 0;
+    size_t input_bytes = 0;
+    size_t key_count = 0;
+    struct JournalRecord rec = {0};
+    int ret = 0;
+
+    double replay_start = now();
+    while(RUNNING && (ret = journal_read(journal, &rec)) > 0) {
+        double event_start = 0;
+        switch(rec.ty) {
+            case JR_INPUT: {
+                if(ftruncate(input_fd, 0)
+                        || pwrite(input_fd, rec.payload.buf, rec.payload.len, 0) != (ssize_t)rec.payload.len
+                        || lseek(input_fd, 0, SEEK_SET)) {
+                    perror("unable to feed the input");
+                    return 1;
+                }
+                input_bytes += rec.payload.len;
+
+                // a key waits for the slice of background work before it
+                event_start = now();
+                idle_poll();
+                struct KeyEvent e = {0};
+                while(RUNNING && readkey(input_fd, &e) > 0) {
+                    key_count += 1;
+                    editor_handle_key(&e);
+                    memset(&e, 0, sizeof(struct KeyEvent));
+                }
+            } break;
+            case JR_RESIZE: {
+                struct JournalResize *resize = rec.payload.buf;
+                event_start = now();
+                idle_poll();
+                WS.ws_row = resize->rows;
+                WS.ws_col = resize->cols;
+            } break;
+        }
+        editor_render(&WS);
+        double latency = now() - event_start;
+        vec_push(&latencies, &latency);
+        total_bytes += drain_output(STDOUT_FILENO);
+    }
+    double total = now() - replay_start;
+
+    if(ret < 0) {
+        perror("unable to read journal");
+    }
+
+    dup2(stdout_fd, STDOUT_FILENO);
+    close(stdout_fd);
+
+    qsort(latencies.buf, latencies.len, latencies.type_size, double_cmp);
+
+    printf("first frame:    %.3f ms (%zu bytes)\n", first_frame * 1e3, first_frame_bytes);
+    printf("events:         %zu (%zu keys, %zu input bytes)\n", latencies.len, key_count, input_bytes);
+    printf("total:          %.3f ms\n", total * 1e3);
+    if(latencies.len) {
+        printf("latency mean:   %.3f ms\n", total * 1e3 / latencies.len);
+        printf("latency p50:    %.3f ms\n", percentile(&latencies, 0.50) * 1e3);
+        printf("latency p99:    %.3f ms\n", percentile(&latencies, 0.99) * 1e3);
+        printf("latency max:    %.3f ms\n", percentile(&latencies, 1.0) * 1e3);
+        printf("bytes emitted:  %zu (%zu per event)\n", total_bytes, total_bytes / latencies.len);
+    }
+
+    vec_cleanup(&rec.payload);
+    vec_cleanup(&latencies);
+    fclose(journal);
+    fclose(input);
+    close(screen_fd);
+    editor_teardown();
+    return ret < 0;
+}
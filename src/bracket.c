@@ -0,0 +1,480 @@
+#include "bracket.h"
+#include "buffer.h"
+#include "line.h"
+#include "utf.h"
+#include "xalloc.h"
+
+#include <sys/types.h>
+
+#define BRACKET_KINDS 3
+// nodes allocated at once, one per line of a buffer
+#define BRACKET_CHUNK 4096
+
+static const char BRACKET_OPEN[BRACKET_KINDS] = {'(', '[', '{'};
+static const char BRACKET_CLOSE[BRACKET_KINDS] = {')', ']', '}'};
+
+// Depth change of a bracket kind over some lines
+struct BracketSum {
+    int32_t sum;
+    // lowest depth reached from the start, at most 0, the highest reached
+    // going back from the end is `sum - min`
+    int32_t min;
+};
+
+struct BracketNode {
+    struct BracketNode *left;
+    struct BracketNode *right;
+    uint32_t prio;
+    // lines in the subtree
+    size_t size;
+    // of the line of the node
+    struct BracketSum line[BRACKET_KINDS];
+    // of the lines of the subtree
+    struct BracketSum total[BRACKET_KINDS];
+};
+
+static uint32_t BRACKET_SEED = 2463534242u;
+
+static uint32_t bracket_random(void) {
+    // xorshift32
+    BRACKET_SEED ^= BRACKET_SEED << 13;
+    BRACKET_SEED ^= BRACKET_SEED >> 17;
+    BRACKET_SEED ^= BRACKET_SEED << 5;
+    return BRACKET_SEED;
+}
+
+// kind of the brackets plus one, negative for the closing ones
+static const int8_t BRACKET_TABLE[256] = {
+    ['('] = 1, [')'] = -1,
+    ['['] = 2, [']'] = -2,
+    ['{'] = 3, ['}'] = -3,
+};
+
+// Returns the kind of the bracket, -1 if `c` is not one, `open` is set if
+// it opens
+static int bracket_kind(char c, _Bool *open) {
+    int8_t kind = BRACKET_TABLE[(uint8_t)c];
+    if(!kind) return -1;
+    *open = kind > 0;
+    return (kind > 0 ? kind : -kind) - 1;
+}
+
+static struct BracketSum bracket_sum_cat(struct BracketSum a, struct BracketSum b) {
+    int32_t min = a.sum + b.min;
+    return (struct BracketSum) {
+        .sum = a.sum + b.sum,
+        .min = a.min < min ? a.min : min,
+    };
+}
+
+static size_t bracket_size(const struct BracketNode *n) {
+    return n ? n->size : 0;
+}
+
+static void bracket_pull(struct BracketNode *n) {
+    n->size = 1 + bracket_size(n->left) + bracket_size(n->right);
+    for(size_t k = 0; k < BRACKET_KINDS; k++) {
+        struct BracketSum sum = n->line[k];
+        if(n->left) sum = bracket_sum_cat(n->left->total[k], sum);
+        if(n->right) sum = bracket_sum_cat(sum, n->right->total[k]);
+        n->total[k] = sum;
+    }
+}
+
+static struct BracketNode *bracket_node_alloc(struct BracketIndex *index) {
+    struct BracketNode *n = index->free;
+    if(n) {
+        index->free = n->left;
+    } else {
+        if(!index->chunks.len || index->chunk_used == BRACKET_CHUNK) {
+            if(!index->chunks.type_size) index->chunks = VEC_NEW(struct BracketNode*, 0);
+            struct BracketNode *chunk = xmalloc(BRACKET_CHUNK * sizeof(struct BracketNode));
+            vec_push(&index->chunks, &chunk);
+            index->chunk_used = 0;
+        }
+        n = *VEC_GET(struct BracketNode*, &index->chunks, index->chunks.len - 1) + index->chunk_used++;
+    }
+    *n = (struct BracketNode) {0};
+    return n;
+}
+
+static struct BracketNode *bracket_node_new(struct BracketIndex *index, const struct Line *l) {
+    struct BracketNode *n = bracket_node_alloc(index);
+    n->prio = bracket_random();
+    const char *s = str_as_cstr(&l->text);
+    size_t len = str_cstr_len(&l->text);
+    for(size_t i = 0; i < len; i++) {
+        int8_t kind = BRACKET_TABLE[(uint8_t)s[i]];
+        if(!kind) continue;
+        struct BracketSum *sum = &n->line[(kind > 0 ? kind : -kind) - 1];
+        sum->sum += kind > 0 ? 1 : -1;
+        if(sum->sum < sum->min) sum->min = sum->sum;
+    }
+    bracket_pull(n);
+    return n;
+}
+
+// Gives the nodes of the subtree back to the index
+static void bracket_node_free(struct BracketIndex *index, struct BracketNode *n) {
+    if(!n) return;
+    bracket_node_free(index, n->left);
+    bracket_node_free(index, n->right);
+    n->left = index->free;
+    index->free = n;
+}
+
+// Returns a treap of the lines [start, start+count), built in O(count)
+static struct BracketNode *bracket_build(struct Buffer *buff, size_t start, size_t count) {
+    // right spine of the tree built so far
+    Vec spine = VEC_NEW(struct BracketNode*, 0);
+    for(size_t i = start; i < start + count; i++) {
+        struct BracketNode *n = bracket_node_new(&buff->brackets, VEC_GET(struct Line, &buff->lines, i));
+        struct BracketNode *last = 0;
+        while(spine.len) {
+            struct BracketNode *top = *VEC_GET(struct BracketNode*, &spine, spine.len - 1);
+            if(top->prio >= n->prio) break;
+            vec_pop(&spine, 0);
+            bracket_pull(top);
+            last = top;
+        }
+        n->left = last;
+        if(spine.len) (*VEC_GET(struct BracketNode*, &spine, spine.len - 1))->right = n;
+        vec_push(&spine, &n);
+    }
+    struct BracketNode *root = 0;
+    while(spine.len) {
+        vec_pop(&spine, &root);
+        bracket_pull(root);
+    }
+    vec_cleanup(&spine);
+    return root;
+}
+
+// Splits the treap in its first `count` lines and the rest
+static void bracket_split(struct BracketNode *n, size_t count, struct BracketNode **a, struct BracketNode **b) {
+    if(!n) {
+        *a = 0;
+        *b = 0;
+        return;
+    }
+    size_t left = bracket_size(n->left);
+    if(count <= left) {
+        bracket_split(n->left, count, a, &n->left);
+        *b = n;
+    } else {
+        bracket_split(n->right, count - left - 1, &n->right, b);
+        *a = n;
+    }
+    bracket_pull(n);
+}
+
+static struct BracketNode *bracket_merge(struct BracketNode *a, struct BracketNode *b) {
+    if(!a) return b;
+    if(!b) return a;
+    if(a->prio > b->prio) {
+        a->right = bracket_merge(a->right, b);
+        bracket_pull(a);
+        return a;
+    }
+    b->left = bracket_merge(a, b->left);
+    bracket_pull(b);
+    return b;
+}
+
+// Returns the index of the first line at or after `from` in the subtree on
+// which `depth` brackets of kind `k` get closed, -1 if there is none, the
+// lines before it are taken off `depth`
+static ssize_t bracket_find_close_line(const struct BracketNode *n, size_t from, size_t k, int32_t *depth) {
+    if(!n) return -1;
+    // none of the subtree, skipped whole
+    if(!from && *depth + n->total[k].min > 0) {
+        *depth += n->total[k].sum;
+        return -1;
+    }
+    size_t left = bracket_size(n->left);
+    if(from < left) {
+        ssize_t found = bracket_find_close_line(n->left, from, k, depth);
+        if(found >= 0) return found;
+    }
+    if(from <= left) {
+        if(*depth + n->line[k].min <= 0) return left;
+        *depth += n->line[k].sum;
+    }
+    size_t right_from = from > left ? from - left - 1 : 0;
+    ssize_t found = bracket_find_close_line(n->right, right_from, k, depth);
+    return found < 0 ? -1 : found + (ssize_t)left + 1;
+}
+
+// Returns the index of the last line before `to` in the subtree on which
+// `depth` brackets of kind `k` get opened, -1 if there is none, the lines
+// after it are taken off `depth`
+static ssize_t bracket_find_open_line(const struct BracketNode *n, size_t to, size_t k, int32_t *depth) {
+    if(!n || !to) return -1;
+    if(to >= n->size && *depth - (n->total[k].sum - n->total[k].min) > 0) {
+        *depth -= n->total[k].sum;
+        return -1;
+    }
+    size_t left = bracket_size(n->left);
+    if(to > left + 1) {
+        ssize_t found = bracket_find_open_line(n->right, to - left - 1, k, depth);
+        if(found >= 0) return found + (ssize_t)left + 1;
+    }
+    if(to > left) {
+        if(*depth - (n->line[k].sum - n->line[k].min) <= 0) return left;
+        *depth -= n->line[k].sum;
+    }
+    return bracket_find_open_line(n->left, to < left ? to : left, k, depth);
+}
+
+// Scans the characters of the line from `col` for the bracket of kind `k`
+// closing `depth` brackets
+// Returns its column, -1 if there is none, `depth` is then what is left open
+static ssize_t bracket_scan_forward(const struct Line *l, size_t col, size_t k, int32_t *depth) {
+    const char *s = str_as_cstr(&l->text);
+    size_t len = str_cstr_len(&l->text);
+    if(col >= str_len(&l->text)) return -1;
+    for(size_t i = str_get_char_byte_idx(&l->text, col); i < len; i++) {
+        if(utf8_is_follow(s[i])) continue;
+        if(s[i] == BRACKET_OPEN[k]) *depth += 1;
+        else if(s[i] == BRACKET_CLOSE[k] && !--*depth) return col;
+        col++;
+    }
+    return -1;
+}
+
+// Scans the characters of the line before `col` backward for the bracket of
+// kind `k` opening `depth` brackets
+// Returns its column, -1 if there is none, `depth` is then what is left open
+static ssize_t bracket_scan_backward(const struct Line *l, size_t col, size_t k, int32_t *depth) {
+    const char *s = str_as_cstr(&l->text);
+    size_t chars = str_len(&l->text);
+    // the end of the line has no character, not even on an empty one
+    size_t end = str_cstr_len(&l->text);
+    if(col >= chars) col = chars;
+    else end = str_get_char_byte_idx(&l->text, col);
+    for(size_t i = end; i > 0; i--) {
+        if(utf8_is_follow(s[i - 1])) continue;
+        col--;
+        if(s[i - 1] == BRACKET_CLOSE[k]) *depth += 1;
+        else if(s[i - 1] == BRACKET_OPEN[k] && !--*depth) return col;
+    }
+    return -1;
+}
+
+// Returns the index of the buffer, built if it is not
+static struct BracketIndex *bracket_index(struct Buffer *buff) {
+    struct BracketIndex *index = &buff->brackets;
+    // lines added without an update (ie: the first line of an empty buffer)
+    if(index->built && bracket_size(index->root) != buff->lines.len) bracket_free(index);
+    if(!index->built) {
+        index->root = bracket_build(buff, 0, buff->lines.len);
+        index->built = 1;
+    }
+    return index;
+}
+
+// Finds the bracket of kind `k` closing `depth` brackets opened before the
+// character (line, col)
+static int bracket_find_close(struct Buffer *buff, size_t k, size_t line, size_t col, int32_t depth, struct BracketPos *out) {
+    ssize_t found = bracket_scan_forward(buffer_line_get(buff, line), col, k, &depth);
+    if(found < 0) {
+        ssize_t found_line = bracket_find_close_line(bracket_index(buff)->root, line + 1, k, &depth);
+        if(found_line < 0) return -1;
+        line = found_line;
+        found = bracket_scan_forward(buffer_line_get(buff, line), 0, k, &depth);
+        if(found < 0) return -1;
+    }
+    out->line = line;
+    out->col = found;
+    return 0;
+}
+
+// Finds the bracket of kind `k` opening `depth` brackets closed at or after
+// the character (line, col)
+static int bracket_find_open(struct Buffer *buff, size_t k, size_t line, size_t col, int32_t depth, struct BracketPos *out) {
+    ssize_t found = bracket_scan_backward(buffer_line_get(buff, line), col, k, &depth);
+    if(found < 0) {
+        ssize_t found_line = bracket_find_open_line(bracket_index(buff)->root, line, k, &depth);
+        if(found_line < 0) return -1;
+        line = found_line;
+        found = bracket_scan_backward(buffer_line_get(buff, line), SIZE_MAX, k, &depth);
+        if(found < 0) return -1;
+    }
+    out->line = line;
+    out->col = found;
+    return 0;
+}
+
+// Returns the kind of the bracket at (line, col), -1 if there is none
+static int bracket_at(struct Buffer *buff, size_t line, size_t col, _Bool *open) {
+    if(line >= buff->lines.len) return -1;
+    const struct Line *l = buffer_line_get(buff, line);
+    if(col >= str_len(&l->text)) return -1;
+    return bracket_kind(str_as_cstr(&l->text)[str_get_char_byte_idx(&l->text, col)], open);
+}
+
+int bracket_match(struct Buffer *buff, size_t line, size_t col, struct BracketPos *match) {
+    _Bool open = 0;
+    int k = bracket_at(buff, line, col, &open);
+    if(k < 0) return -1;
+    if(open) return bracket_find_close(buff, k, line, col + 1, 1, match);
+    return bracket_find_open(buff, k, line, col, 1, match);
+}
+
+int bracket_enclosing(
+        struct Buffer *buff,
+        size_t line,
+        size_t col,
+        struct BracketPos *open,
+        struct BracketPos *close) {
+    if(line >= buff->lines.len) return -1;
+    _Bool is_open = 0;
+    struct BracketPos at = {.line = line, .col = col};
+    if(bracket_at(buff, line, col, &is_open) >= 0) {
+        struct BracketPos match;
+        if(bracket_match(buff, line, col, &match)) return -1;
+        *open = is_open ? at : match;
+        *close = is_open ? match : at;
+        return 0;
+    }
+
+    // the innermost of the kinds
+    int found = -1;
+    for(size_t k = 0; k < BRACKET_KINDS; k++) {
+        struct BracketPos pos;
+        if(bracket_find_open(buff, k, line, col, 1, &pos)) continue;
+        if(found >= 0 && (pos.line < open->line || (pos.line == open->line && pos.col < open->col))) continue;
+        struct BracketPos match;
+        if(bracket_find_close(buff, k, line, col, 1, &match)) continue;
+        *open = pos;
+        *close = match;
+        found = k;
+    }
+    return found < 0 ? -1 : 0;
+}
+
+void bracket_update(struct Buffer *buff, size_t start, size_t removed, size_t added) {
+    struct BracketIndex *index = &buff->brackets;
+    if(!index->built) return;
+    if(bracket_size(index->root) + added - removed != buff->lines.len) {
+        // out of sync, rebuilt on the next lookup
+        bracket_free(index);
+        return;
+    }
+    struct BracketNode *before = 0;
+    struct BracketNode *rest = 0;
+    struct BracketNode *replaced = 0;
+    struct BracketNode *after = 0;
+    bracket_split(index->root, start, &before, &rest);
+    bracket_split(rest, removed, &replaced, &after);
+    bracket_node_free(index, replaced);
+    struct BracketNode *lines = bracket_build(buff, start, added);
+    index->root = bracket_merge(bracket_merge(before, lines), after);
+}
+
+void bracket_free(struct BracketIndex *index) {
+    for(size_t i = 0; i < index->chunks.len; i++) {
+        xfree(*VEC_GET(struct BracketNode*, &index->chunks, i));
+    }
+    vec_cleanup(&index->chunks);
+    *index = (struct BracketIndex) {0};
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+
+static int bracket_test_match(struct Buffer *buff, size_t line, size_t col, size_t match_line, size_t match_col) {
+    struct BracketPos match;
+    if(bracket_match(buff, line, col, &match)) return 0;
+    return match.line == match_line && match.col == match_col;
+}
+
+TESTS_START
+
+TEST_DEF(test_bracket_match)
+    const char *lines[] = {
+        "int f(int a[2]) {",
+        "    if(a) { g(\xc3\xa9); }",
+        "    return (a[0]",
+        "        + a[1]);",
+        "}",
+        ")",
+    };
+    struct Buffer buff = buffer_test_new(lines, 6, 0);
+
+    TEST_ASSERT(bracket_test_match(&buff, 0, 5, 0, 14));
+    TEST_ASSERT(bracket_test_match(&buff, 0, 14, 0, 5));
+    TEST_ASSERT(bracket_test_match(&buff, 0, 16, 4, 0));
+    TEST_ASSERT(bracket_test_match(&buff, 4, 0, 0, 16));
+    // columns are in characters
+    TEST_ASSERT(bracket_test_match(&buff, 1, 13, 1, 15));
+    TEST_ASSERT(bracket_test_match(&buff, 2, 11, 3, 14));
+    TEST_ASSERT(bracket_test_match(&buff, 3, 14, 2, 11));
+    struct BracketPos match;
+    TEST_ASSERT(bracket_match(&buff, 5, 0, &match) == -1);
+    TEST_ASSERT(bracket_match(&buff, 0, 0, &match) == -1);
+
+    struct BracketPos open;
+    struct BracketPos close;
+    TEST_ASSERT(!bracket_enclosing(&buff, 3, 12, &open, &close));
+    TEST_ASSERT(open.line == 3 && open.col == 11 && close.line == 3 && close.col == 13);
+    TEST_ASSERT(!bracket_enclosing(&buff, 3, 4, &open, &close));
+    TEST_ASSERT(open.line == 2 && open.col == 11 && close.line == 3 && close.col == 14);
+    TEST_ASSERT(bracket_enclosing(&buff, 5, 0, &open, &close) == -1);
+
+    // an edit only rebuilds the lines it replaced
+    struct Line l = line_from_cstr("    while(1) {");
+    buffer_line_insert(&buff, 2, l);
+    l = line_from_cstr("    }");
+    buffer_line_insert(&buff, 5, l);
+    bracket_update(&buff, 2, 0, 1);
+    bracket_update(&buff, 5, 0, 1);
+    TEST_ASSERT(bracket_test_match(&buff, 2, 13, 5, 4));
+    TEST_ASSERT(bracket_test_match(&buff, 0, 16, 6, 0));
+    buffer_lines_remove(&buff, 5, 1);
+    bracket_update(&buff, 5, 1, 0);
+    TEST_ASSERT(bracket_test_match(&buff, 0, 16, 2, 13) == 0);
+    TEST_ASSERT(bracket_test_match(&buff, 2, 13, 5, 0));
+
+    bracket_free(&buff.brackets);
+    vec_cleanup(&buff.lines);
+TEST_ENDDEF
+
+TEST_DEF(test_bracket_deep)
+    // the lines are found by going down the treap, not by scanning them
+    struct Buffer buff = buffer_new();
+    for(size_t i = 0; i < 20000; i++) {
+        struct Line l = line_from_cstr(i < 10000 ? "{ (" : ") }");
+        vec_push(&buff.lines, &l);
+    }
+    TEST_ASSERT(bracket_test_match(&buff, 0, 0, 19999, 2));
+    TEST_ASSERT(bracket_test_match(&buff, 9999, 2, 10000, 0));
+    TEST_ASSERT(bracket_test_match(&buff, 12345, 2, 7654, 0));
+    bracket_free(&buff.brackets);
+    vec_cleanup(&buff.lines);
+TEST_ENDDEF
+
+TEST_DEF(test_bracket_empty)
+    // the lines of an empty file have no text at all
+    struct Buffer buff = buffer_new();
+    struct BracketPos open;
+    struct BracketPos close;
+    TEST_ASSERT(bracket_enclosing(&buff, 0, 0, &open, &close) == -1);
+    bracket_free(&buff.brackets);
+    vec_cleanup(&buff.lines);
+
+    const char *lines[] = {"{", "", "}"};
+    buff = buffer_test_new(lines, 3, 0);
+    struct Line empty = line_new();
+    line_free(buffer_line_get(&buff, 1));
+    *buffer_line_get(&buff, 1) = empty;
+    TEST_ASSERT(!bracket_enclosing(&buff, 1, 0, &open, &close));
+    TEST_ASSERT(open.line == 0 && open.col == 0 && close.line == 2 && close.col == 0);
+    bracket_free(&buff.brackets);
+    vec_cleanup(&buff.lines);
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef BRACKET_H
+#define BRACKET_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "str.h"
+
+struct Buffer;
+
+// Index of the brackets (), [] and {} of a buffer, each kind nests on its
+// own. Every line keeps how much it changes the depth of each kind, and how
+// far down and up the depth goes from its start and from its end. The lines
+// are the nodes of a treap holding the same for their subtree, so the line
+// a bracket is matched on is found in O(log n) and an edit only rebuilds the
+// nodes of the lines it changed.
+
+struct BracketNode;
+
+struct BracketIndex {
+    struct BracketNode *root;
+    // `Vec` of arrays of `BRACKET_CHUNK` nodes the nodes come from
+    Vec chunks;
+    // nodes given back, linked by `left`
+    struct BracketNode *free;
+    // nodes handed out of the last chunk
+    size_t chunk_used;
+    // the index is built on the first lookup
+    _Bool built;
+};
+
+struct BracketPos {
+    size_t line;
+    // in characters
+    size_t col;
+};
+
+// Finds the bracket matching the one at (line, col)
+// Returns:
+//  0 on success and sets `match`
+//  -1 if there is no bracket there or it is not matched
+int bracket_match(struct Buffer *buff, size_t line, size_t col, struct BracketPos *match);
+
+// Finds the pair of brackets around (line, col), the bracket at (line, col)
+// and its match if there is one, otherwise the innermost pair enclosing it
+// Returns:
+//  0 on success and sets `open` and `close`
+//  -1 if there is none
+int bracket_enclosing(
+        struct Buffer *buff,
+        size_t line,
+        size_t col,
+        struct BracketPos *open,
+        struct BracketPos *close);
+
+// Updates the index after the lines [start, start+removed) got replaced by
+// the lines [start, start+added)
+void bracket_update(struct Buffer *buff, size_t start, size_t removed, size_t added);
+
+void bracket_free(struct BracketIndex *index);
+
+#endif
@@ -1,6 +1,7 @@
 #include "buffer.h"
 #include "str.h"
 #include "line.h"
+#include "syntax.h"
 #include <stdint.h>
 #include <errno.h>
 #include "xalloc.h"
@@ -79,6 +80,7 @@ int buffer_init_from_path(
     buff->in.ty = INPUT_FILE;
     buff->in.u.file.fm = fm;
     buff->in.u.file.path = str_from_cstr(path);
+    buff->syntax = syntax_for_path(path);
 
     buff->rc = 1;
     buff->fm = fm;
@@ -113,12 +115,23 @@ void buffer_line_remove(struct Buffer *buff, size_t idx) {
     vec_remove(&buff->lines, idx);
 }
 
+void buffer_lines_remove(struct Buffer *buff, size_t idx, size_t count) {
+    buff->dirty = 1;
+    vec_remove_range(&buff->lines, idx, count);
+}
+
 int buffer_line_insert(struct Buffer *buff, size_t idx, struct Line line) {
     buff->dirty = 1;
     buff->lines.type_size = sizeof(struct Line);
     return vec_insert(&buff->lines, idx, &line);
 }
 
+int buffer_lines_insert(struct Buffer *buff, size_t idx, struct Line *lines, size_t count) {
+    buff->dirty = 1;
+    buff->lines.type_size = sizeof(struct Line);
+    return vec_insert_range(&buff->lines, idx, lines, count);
+}
+
 // Returns -1 on error and sets errno
 int buffer_dump(
         struct Buffer *buff,
@@ -153,37 +166,96 @@ int buffer_dump(
 // DO NOT CALL DIRECTLY, call `re_state_rc_dec`
 static void re_state_free(struct ReState *re_state) {
     if(re_state) {
-        if(re_state->regex) {
-            regfree(re_state->regex);
-            xfree(re_state->regex);
-            re_state->regex = 0;
-        }
+        pattern_rc_dec(re_state->pattern);
+        re_state->pattern = 0;
         vec_cleanup(&re_state->matches);
-        if(re_state->error_str) {
-            xfree(re_state->error_str);
-            re_state->error_str = 0;
-        }
+        vec_cleanup(&re_state->above);
     }
 }
 
 void re_state_clear_matches(struct ReState *re_state) {
     vec_clear(&re_state->matches);
+    vec_clear(&re_state->above);
+    re_state->above_lines = 0;
+    re_state->shift_from = 0;
+    re_state->shift_delta = 0;
 }
 
-void re_state_reset(struct ReState *re_state) {
-    if(re_state->regex) {
-        regfree(re_state->regex);
-        memset(re_state->regex, 0, sizeof(regex_t));
-        re_state_clear_matches(re_state);
-    } else {
-        re_state->regex = xcalloc(1, sizeof(regex_t));
-        re_state->matches = VEC_NEW(struct ReMatch, 0);
-        re_state_clear_matches(re_state);
+int re_state_active(const struct ReState *re_state) {
+    return re_state->pattern && !re_state->pattern->error;
+}
+
+struct ReMatch re_state_match(const struct ReState *re_state, size_t idx) {
+    struct ReMatch match = *VEC_GET(struct ReMatch, &re_state->matches, idx);
+    if(idx >= re_state->shift_from) match.line += re_state->shift_delta;
+    return match;
+}
+
+size_t re_state_find(const struct ReState *re_state, size_t line, size_t col) {
+    size_t lo = 0;
+    size_t hi = re_state->matches.len;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        struct ReMatch match = re_state_match(re_state, mid);
+        if(match.line < line || (match.line == line && match.col < col)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+size_t re_state_lower_bound(const struct ReState *re_state, size_t line) {
+    return re_state_find(re_state, line, 0);
+}
+
+void re_state_shift(struct ReState *re_state, size_t from, ssize_t delta) {
+    struct ReMatch *matches = re_state->matches.buf;
+    if(!re_state->shift_delta) {
+        re_state->shift_from = from;
+    } else if(from > re_state->shift_from) {
+        // only one span can be pending, apply the older one up to `from`
+        for(size_t i = re_state->shift_from; i < from; i++) {
+            matches[i].line += re_state->shift_delta;
+        }
+        re_state->shift_from = from;
     }
-    if(re_state->error_str) {
-        xfree(re_state->error_str);
-        re_state->error_str = 0;
+    // the matches between `from` and the pending span
+    for(size_t i = from; i < re_state->shift_from; i++) {
+        matches[i].line += delta;
     }
+    re_state->shift_delta += delta;
+    // nothing is pending past the end, the matches added there are up to date
+    if(re_state->shift_from >= re_state->matches.len) re_state->shift_delta = 0;
+}
+
+void re_state_replace(
+        struct ReState *re_state,
+        size_t lo,
+        size_t hi,
+        const struct ReMatch *matches,
+        size_t count) {
+
+    // the replaced matches must not be part of the pending span
+    re_state_shift(re_state, hi, 0);
+    // the common case of an edit within a line keeps the number of matches,
+    // avoid moving the tail
+    if(count == hi - lo) {
+        if(count) memcpy(vec_get(&re_state->matches, lo), matches, count * sizeof(struct ReMatch));
+        return;
+    }
+    vec_remove_range(&re_state->matches, lo, hi - lo);
+    vec_insert_range(&re_state->matches, lo, matches, count);
+    re_state->shift_from = re_state->shift_from - (hi - lo) + count;
+}
+
+void re_state_reset(struct ReState *re_state) {
+    pattern_rc_dec(re_state->pattern);
+    re_state->pattern = 0;
+    re_state->scan_start = 0;
+    re_state->scan_end = 0;
+    re_state->jump_pending = 0;
+    if(!re_state->matches.type_size) re_state->matches = VEC_NEW(struct ReMatch, 0);
+    if(!re_state->above.type_size) re_state->above = VEC_NEW(struct ReMatch, 0);
+    re_state_clear_matches(re_state);
 }
 
 
@@ -198,6 +270,9 @@ static void buffer_cleanup(struct Buffer *buff) {
             break;
     }
     re_state_free(&buff->re_state);
+    overlay_free(&buff->diagnostics);
+    bracket_free(&buff->brackets);
+    fold_free(&buff->folds);
     str_free(&buff->onsave);
     memset(buff, 0, sizeof(struct Buffer));
 }
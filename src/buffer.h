@@ -4,7 +4,11 @@
 #include <regex.h>
 #include <stdio.h>
 #include "str.h"
+#include "pattern.h"
 #include "maybe.h"
+#include "overlay.h"
+#include "bracket.h"
+#include "fold.h"
 
 enum FileMode {
     FM_RW = 0,
@@ -43,15 +47,60 @@ struct ReMatch {
 
 struct ReState {
     struct ViewCursor original_cursor;
-    regex_t *regex;
-    // `Vec` of `ReMatch`
+    // the pattern searched for, null if there is none
+    struct Pattern *pattern;
+    // `Vec` of `ReMatch` sorted by position, read them with `re_state_match`
     Vec matches;
-    char *error_str;
+    // the lines of the matches [shift_from, len) are off by `shift_delta`,
+    // edits move the matches after them lazily so that typing in a buffer
+    // with many matches does not rewrite all of them
+    size_t shift_from;
+    ssize_t shift_delta;
+    // the matches cover the lines [scan_start, scan_end), the others are
+    // searched a slice at a time from the event loop
+    size_t scan_start;
+    size_t scan_end;
+    // `Vec` of `ReMatch`, the matches of the `above_lines` lines before
+    // `scan_start` found by the upward scan, last first so every slice is
+    // appended, they join `matches` once the scan reaches the first line
+    Vec above;
+    size_t above_lines;
+    // the cursor is moved to the first match after `original_cursor` once
+    // it is found
+    _Bool jump_pending;
+    // set when the buffer got edited during a batch, the lines
+    // [pending_start, pending_end) are searched again once the batch ends,
+    // the lines after them moved by `pending_delta`
+    _Bool refresh_pending;
+    size_t pending_start;
+    size_t pending_end;
+    ssize_t pending_delta;
 };
 
 void re_state_clear_matches(struct ReState *re_state);
 
-void re_state_clear_matches(struct ReState *re_state);
+// Returns 1 if there is a valid pattern to search for
+int re_state_active(const struct ReState *re_state);
+
+// Returns the match at `idx` with its line up to date
+struct ReMatch re_state_match(const struct ReState *re_state, size_t idx);
+
+// Returns the index of the first match at or after (line, col)
+size_t re_state_find(const struct ReState *re_state, size_t line, size_t col);
+
+// Returns the index of the first match on or after line `line`
+size_t re_state_lower_bound(const struct ReState *re_state, size_t line);
+
+// Moves the lines of the matches [from, len) by `delta`
+void re_state_shift(struct ReState *re_state, size_t from, ssize_t delta);
+
+// Replaces the matches [lo, hi) by the `count` matches of `matches`
+void re_state_replace(
+        struct ReState *re_state,
+        size_t lo,
+        size_t hi,
+        const struct ReMatch *matches,
+        size_t count);
 
 void re_state_reset(struct ReState *re_state);
 
@@ -65,6 +114,15 @@ struct Buffer {
     struct ReState re_state;
     size_t rc;
     Str onsave;
+    // null if the buffer is not highlighted
+    struct Syntax *syntax;
+    // the lines [0, syntax_valid) are highlighted
+    size_t syntax_valid;
+    // the locations reported by the last command run, see
+    // `editor_diagnostics_set`
+    struct Overlay diagnostics;
+    struct BracketIndex brackets;
+    struct FoldTree folds;
 };
 
 // Returns:
@@ -111,10 +169,41 @@ int buffer_init_from_path(
 
 void buffer_line_remove(struct Buffer *buff, size_t idx);
 
+// Removes the lines [idx, idx+count) in one go, the tail of the line array
+// is only moved once
+void buffer_lines_remove(struct Buffer *buff, size_t idx, size_t count);
+
+// Inserts `count` lines at `idx` in one go, the buffer takes ownership of them
+int buffer_lines_insert(struct Buffer *buff, size_t idx, struct Line *lines, size_t count);
+
 // Returns -1 on error and sets errno
 int buffer_dump(
         struct Buffer *buff,
         char *path);
 
+#ifdef TESTING
+
+#include <stdlib.h>
+#include "line.h"
+#include "syntax.h"
+
+// Returns a buffer of the lines for the tests, with the syntax of the file
+// `path` if it is not null, it is defined here since the objects the tests
+// are linked with are not built for testing
+// The syntaxes compiled by the tests are cached in the build directory, not
+// in the cache of the user
+static inline struct Buffer buffer_test_new(const char **lines, size_t count, const char *path) {
+    setenv("XDG_CACHE_HOME", TEST_BUILD_DIR, 1);
+    struct Buffer buff = buffer_new();
+    for(size_t i = 0; i < count; i++) {
+        struct Line l = line_from_cstr((char*)lines[i]);
+        vec_push(&buff.lines, &l);
+    }
+    if(path) buff.syntax = syntax_for_path(path);
+    return buff;
+}
+
+#endif
+
 #endif
 
@@ -1,84 +1,384 @@
 #include "editor.h"
 #include "exec.h"
+#include "grep.h"
+#include "line.h"
 #include "xalloc.h"
 
 #include <stdlib.h>
+#include <ctype.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/wait.h>
+
+// state of a shell command running in the background
+struct CommandJob {
+    // output buffer, null for silent commands
+    struct Buffer *buff;
+    Str command;
+    // trailing bytes of an incomplete UTF-8 sequence
+    char partial[4];
+    size_t partial_len;
+};
+
+static void command_job_append(struct CommandJob *job, const char *s, size_t len) {
+    struct View v = view_new(job->buff);
+    // write at the end of the buffer
+    if(job->buff->lines.len) {
+        view_set_cursor(&v, SIZE_MAX, job->buff->lines.len-1);
+    }
+    view_write(&v, s, len);
+}
+
+static void command_job_output(void *data, const char *s, size_t len) {
+    struct CommandJob *job = data;
+    if(!job->buff) return;
+
+    // finish the character split by the previous read
+    while(job->partial_len && len) {
+        job->partial[job->partial_len++] = *s++;
+        len--;
+        if(job->partial_len == (size_t)utf8_byte_count(job->partial[0])
+                || job->partial_len == sizeof(job->partial)) {
+            command_job_append(job, job->partial, job->partial_len);
+            job->partial_len = 0;
+        }
+    }
+
+    // hold back a character split by this read
+    size_t lead = len;
+    for(size_t i = 1; i <= sizeof(job->partial) && i <= len; i++) {
+        if(!utf8_is_follow(s[len - i])) {
+            lead = len - i;
+            break;
+        }
+    }
+    if(lead < len && utf8_byte_count(s[lead]) > (int)(len - lead)) {
+        job->partial_len = len - lead;
+        memcpy(job->partial, s + lead, job->partial_len);
+        len = lead;
+    }
+
+    command_job_append(job, s, len);
+}
+
+static void command_job_exit(void *data, int status) {
+    struct CommandJob *job = data;
+
+    if(job->buff && job->partial_len) {
+        command_job_append(job, job->partial, job->partial_len);
+    }
+
+    if(WIFSIGNALED(status)) {
+        message_print("`%s` killed by signal %d", str_as_cstr(&job->command), WTERMSIG(status));
+    } else if(WIFEXITED(status) && WEXITSTATUS(status)) {
+        message_print("`%s` exited with status %d", str_as_cstr(&job->command), WEXITSTATUS(status));
+    }
+
+    if(job->buff) {
+        editor_diagnostics_set(job->buff);
+        buffer_rc_dec(job->buff);
+    }
+    str_free(&job->command);
+    xfree(job);
+}
+
+// Opens a scratch buffer in a new window below `win` and focuses it
+// Returns the buffer, owned by the window
+static struct Buffer *command_output_window(struct Window *win) {
+    struct Buffer *buff = xcalloc(1, sizeof(struct Buffer));
+    *buff = buffer_new();
+    // not backed by anything
+    buff->in.ty = INPUT_SCRATCH;
+
+    struct View view = view_new(buff);
+    // no need for line numbers
+    view.options.no_line_num = 1;
+
+    struct Window *man_win = xcalloc(1, sizeof(struct Window));
+    *man_win = window_new();
+
+    window_view_push(man_win, view);
+
+    window_push(win, man_win, SD_Horizontal);
+    // move focus to new window
+    tab_active()->active_window += 1;
+    return buff;
+}
+
+static void command_grep_output(void *data, const char *s, size_t len) {
+    struct CommandJob *job = data;
+    command_job_append(job, s, len);
+}
+
+static void command_grep_exit(void *data, size_t files, size_t matches) {
+    struct CommandJob *job = data;
+    if(!matches) {
+        message_print("E: pattern not found in %zu files: %s", files, str_as_cstr(&job->command));
+    }
+    buffer_rc_dec(job->buff);
+    str_free(&job->command);
+    xfree(job);
+}
+
+// Searches the files under `dir` (the working directory if null) for
+// `pattern`, the results are streamed into a new window where enter opens
+// the one under the cursor
+static int command_grep(struct Window *win, const char *pattern, const char *dir) {
+    struct CommandJob *job = xcalloc(1, sizeof(struct CommandJob));
+    job->command = str_from_cstr(pattern);
+    if(grep_start(pattern, dir, command_grep_output, command_grep_exit, job)) {
+        message_print("E: invalid pattern: %s", pattern);
+        str_free(&job->command);
+        xfree(job);
+        return -1;
+    }
+    job->buff = buffer_rc_inc(command_output_window(win));
+    return 0;
+}
+
+// Copies the shell command `command` into `out`, replacing % with the path
+// of the buffer
+// Returns -1 if the buffer is not backed by a file
+static int command_expand(const char *command, struct View *v, Str *out) {
+    for(size_t i = 0; command[i]; i++) {
+        if(command[i] != '%') {
+            str_push(out, command + i, 1);
+            continue;
+        }
+        switch(v->buff->in.ty) {
+            case INPUT_SCRATCH:
+                message_print("E: buffer is not a file");
+                return -1;
+            case INPUT_FILE: {
+                Str *file_path = &v->buff->in.u.file.path;
+                str_push(
+                    out,
+                    str_as_cstr(file_path),
+                    str_cstr_len(file_path));
+            } break;
+        }
+    }
+    return 0;
+}
+
+// Parses a line address (a line number, `.` or `$`) into a line index
+// Returns -1 if there is none
+static int command_parse_address(char **command, struct View *v, size_t *line) {
+    char *s = *command;
+    if(*s == '.') {
+        *line = v->view_cursor.off_y;
+        s++;
+    } else if(*s == '$') {
+        *line = v->buff->lines.len ? v->buff->lines.len - 1 : 0;
+        s++;
+    } else if(*s >= '0' && *s <= '9') {
+        size_t n = strtoul(s, &s, 10);
+        *line = n ? n - 1 : 0;
+    } else {
+        return -1;
+    }
+    *command = s;
+    return 0;
+}
+
+// Parses a line range (`N`, `N,M` or `%`) at the start of `command`, the
+// range is inclusive
+// Returns:
+//  1 if there was a range
+//  0 if there was none
+//  -1 if the range is invalid
+static int command_parse_range(char **command, struct View *v, size_t *start, size_t *end) {
+    if(**command == '%') {
+        *command += 1;
+        *start = 0;
+        *end = v->buff->lines.len ? v->buff->lines.len - 1 : 0;
+        return 1;
+    }
+    if(command_parse_address(command, v, start)) return 0;
+    *end = *start;
+    if(**command == ',') {
+        *command += 1;
+        if(command_parse_address(command, v, end)) return -1;
+    }
+    if(*start > *end) {
+        size_t tmp = *start;
+        *start = *end;
+        *end = tmp;
+    }
+    return 1;
+}
+
+// Pipes the lines [start, end] through `command` and replaces them with its
+// output, the buffer is left as is if the command fails
+static int command_filter(struct View *v, size_t start, size_t end, const char *command) {
+    Str cmd = str_new();
+    if(command_expand(command, v, &cmd)) {
+        str_free(&cmd);
+        return -1;
+    }
+
+    size_t buff_len = v->buff->lines.len;
+    if(end >= buff_len) end = buff_len ? buff_len - 1 : 0;
+
+    Str in = str_new();
+    for(size_t i = start; i < buff_len && i <= end; i++) {
+        Str *text = &buffer_line_get(v->buff, i)->text;
+        str_push(&in, str_as_cstr(text), str_cstr_len(text));
+        str_push(&in, "\n", 1);
+    }
+
+    Str out = str_new();
+    Str err = str_new();
+    int status = exec_filter(str_as_cstr(&cmd), str_as_cstr(&in), str_cstr_len(&in), &out, &err);
+    str_free(&in);
+
+    int ret = 0;
+    if(status < 0) {
+        message_print("E: unable to spawn: %s", str_as_cstr(&cmd));
+        ret = -1;
+    } else if(!WIFEXITED(status) || WEXITSTATUS(status)) {
+        message_print("E: `%s` failed: %.*s",
+                str_as_cstr(&cmd),
+                (int)str_cstr_len(&err),
+                str_as_cstr(&err));
+        ret = -1;
+    } else {
+        view_replace_lines(v, start, end - start + 1, str_as_cstr(&out), str_cstr_len(&out));
+        if(!str_is_empty(&err)) {
+            message_print("%.*s", (int)str_cstr_len(&err), str_as_cstr(&err));
+        }
+    }
+
+    str_free(&cmd);
+    str_free(&out);
+    str_free(&err);
+    return ret;
+}
+
+// Splits the `delim` terminated field at the start of `*s` in place, \ before
+// the delimiter escapes it, the other escapes are kept as is
+// Returns the field, `*s` points after its delimiter
+static char *command_split_field(char **s, char delim) {
+    char *field = *s;
+    char *r = *s;
+    char *w = *s;
+    while(*r && *r != delim) {
+        if(r[0] == '\\' && r[1] == delim) {
+            r++;
+        } else if(r[0] == '\\' && r[1]) {
+            *w++ = *r++;
+        }
+        *w++ = *r++;
+    }
+    *s = *r ? r + 1 : r;
+    *w = '\0';
+    return field;
+}
+
+// Returns 1 if `command` is a substitution, `s` followed by its delimiter
+static int command_is_substitute(const char *command) {
+    return command[0] == 's'
+        && command[1]
+        && !isalnum((unsigned char)command[1])
+        && !isspace((unsigned char)command[1])
+        && command[1] != '\\'
+        && command[1] != '"'
+        && command[1] != '|';
+}
+
+// Runs `s/pattern/replacement/[g]` on the lines [start, end], an empty
+// pattern reuses the one of the last search
+static int command_substitute(struct View *v, size_t start, size_t end, char *args) {
+    char delim = *args++;
+    char *pattern = command_split_field(&args, delim);
+    char *repl = command_split_field(&args, delim);
+    int global = 0;
+    for(; *args; args++) {
+        if(*args == 'g') {
+            global = 1;
+        } else {
+            message_print("E: trailing characters: %s", args);
+            return -1;
+        }
+    }
+
+    if(!*pattern) {
+        if(!v->buff->re_state.pattern) {
+            message_print("E: no previous pattern");
+            return -1;
+        }
+        pattern = v->buff->re_state.pattern->source;
+    }
+
+    int count = view_substitute(v, start, end, pattern, repl, global);
+    if(count == 0) {
+        message_print("E: pattern not found: %s", pattern);
+        return -1;
+    }
+    return count < 0 ? -1 : 0;
+}
 
 int exec_command(char *command) {
     if(command[0] == ':') {
         command++;
     }
 
+    struct Window *win = tab_window_active(tab_active());
+    struct View *active_view = window_view_active(win);
+
+    size_t range_start = 0;
+    size_t range_end = 0;
+    int has_range = command_parse_range(&command, active_view, &range_start, &range_end);
+    if(has_range < 0) {
+        message_print("E: invalid range");
+        return -1;
+    }
+    if(has_range) {
+        if(command[0] == '!') {
+            return command_filter(active_view, range_start, range_end, command + 1);
+        } else if(command_is_substitute(command)) {
+            return command_substitute(active_view, range_start, range_end, command + 1);
+        } else if(command[0] == '\0') {
+            // a lone address moves the cursor to it
+            view_set_cursor(active_view, 0, range_end);
+            return 0;
+        }
+        message_print("E: command does not take a range");
+        return -1;
+    }
+
+    if(command_is_substitute(command)) {
+        size_t line = active_view->view_cursor.off_y;
+        return command_substitute(active_view, line, line, command + 1);
+    }
+
     // detect a shell command
     if(command[0] == '!' || command[0] == '?') {
         _Bool silent = command[0] == '?';
-        SpawnHandle handle = {0};
         // look for % to replace with the path of the buffer
         Str out = str_new();
+        if(command_expand(command + 1, active_view, &out)) {
+            str_free(&out);
+            return 0;
+        }
 
-        struct Window *win = tab_window_active(tab_active());
-        struct View *active_view = window_view_active(win);
+        struct CommandJob *job = xcalloc(1, sizeof(struct CommandJob));
+        job->command = out;
 
-        for(size_t i = 0; i < strlen(command+1); i++) {
-            if(command[i+1] == '%') {
-                switch(active_view->buff->in.ty) {
-                    case INPUT_SCRATCH:
-                        str_free(&out);
-                        message_print("E: buffer is not a file");
-                        return 0;
-                    case INPUT_FILE: {
-                        Str *file_path = &active_view->buff->in.u.file.path;
-                        str_push(
-                            &out,
-                            str_as_cstr(file_path),
-                            str_cstr_len(file_path));
-                    } break;
-                }
-            } else {
-                str_push(&out, command + i + 1,1);
-            }
-        }
-
-        if(spawn_captured(str_as_cstr(&out), &handle)) {
+        // the command runs in the background, its output is streamed into
+        // the buffer by `exec_jobs_poll` (<C-c> cancels it)
+        // commands showing their output get killed when the editor exits,
+        // silent ones (ie: onsave hooks) are waited for
+        int flags = silent ? 0 : JF_KILL_ON_EXIT;
+        if(exec_job_spawn(str_as_cstr(&out), flags, command_job_output, command_job_exit, job)) {
             message_print("E: unable to spawn: %s", str_as_cstr(&out));
             str_free(&out);
+            xfree(job);
             return 0;
         }
 
-        str_clear(&out);
-        // todo handle ctrl-c so that it's possible to kill
-        // commands that hang, maybe some async here? /shudders/
-        // probably should poll
-        int res = spawn_handle_wait_collect_output(&handle, &out);
-        spawn_handle_free(&handle);
-
-        if(!silent) {
-            struct Buffer *buff = xcalloc(1, sizeof(struct Buffer));
-            *buff = buffer_new();
-            // not backed by anything
-            buff->in.ty = INPUT_SCRATCH;
-
-            struct View view = view_new(buff);
-            // no need for line numbers
-            view.options.no_line_num = 1;
-
-            struct Window *man_win = xcalloc(1, sizeof(struct Window));
-            *man_win = window_new();
-
-            view_write(&view, str_as_cstr(&out), str_cstr_len(&out));
-            // move cursor back to the start of the file
-            view_set_cursor(&view, 0, 0);
-
-
-            window_view_push(man_win, view);
-
-            window_push(win, man_win, SD_Horizontal);
-            // move focus to new window
-            tab_active()->active_window += 1;
-        }
-        str_free(&out);
+        if(!silent) job->buff = buffer_rc_inc(command_output_window(win));
         return 0;
     }
 
@@ -143,6 +443,34 @@ int exec_command(char *command) {
         }
         struct View *active_view = tab_active_view(tab_active());
         view_set_cursor(active_view, 0, n-1);
+    } else if(!strcmp(token, "fold")) {
+        token = strtok(NULL, sep);
+        if(token && !strcmp(token, "indent")) {
+            fold_from_indent(active_view->buff);
+        } else if(token && !strcmp(token, "syntax")) {
+            fold_from_syntax(active_view->buff);
+        } else {
+            message_print("E: Usage: fold indent|syntax");
+            return -1;
+        }
+        // the cursor may be in a fold now
+        view_set_cursor(active_view, active_view->view_cursor.off_x, active_view->view_cursor.off_y);
+    } else if(!strcmp(token, "diag")) {
+        token = strtok(NULL, sep);
+        if(!token || strcmp(token, "clear")) {
+            message_print("E: Usage: diag clear");
+            return -1;
+        }
+        editor_diagnostics_clear();
+    } else if(!strcmp(token, "grep")) {
+        char *pattern = strtok(NULL, sep);
+        if(!pattern) {
+            message_print("E: Usage: grep <pattern> [directory]");
+            return -1;
+        }
+        // a null token is fine
+        token = strtok(NULL, sep);
+        return command_grep(win, pattern, token);
     } else if(!strcmp(token, "onsave")) {
         // use empty delimiter to grab the entire remainder including spaces
         token = strtok(NULL, "");
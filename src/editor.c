@@ -8,6 +8,15 @@
 #include "config.h"
 #include "line.h"
 #include "exec.h"
+#include "pool.h"
+#include "search.h"
+#include "rx.h"
+#include "grep.h"
+#include "pattern.h"
+#include "syntax.h"
+#include "overlay.h"
+#include "indent.h"
+#include "utf.h"
 
 #include <ctype.h>
 #include <regex.h>
@@ -16,10 +25,12 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <wctype.h>
 #include <math.h>
+#include <limits.h>
 
 struct winsize WS = {0};
 
@@ -27,6 +38,10 @@ const char *FILEMODE_REPR[2] = {"", "[RO]"};
 
 int RUNNING = 1;
 
+// number of nested edit batches, rendering and search reruns are deferred
+// until the outermost batch ends
+static size_t BATCH_DEPTH = 0;
+
 struct View MESSAGE = {
     .buff = 0,
     .options = {
@@ -139,9 +154,22 @@ int write_char_escaped(Style *base_style, utf32 c, int fd) {
     return count;
 }
 
-int write_escaped(Style *base_style, const struct Line *line, size_t off, size_t len) {
+// Writes `len` bytes of `s` in `style`
+static int write_styled(const Style *style, const char *s, size_t len) {
+    if(!len) return 0;
+    if(style_begin(style, STDOUT_FILENO) < 0) return -1;
+    if(write(STDOUT_FILENO, s, len) < 0) return -1;
+    if(style_reset(STDOUT_FILENO) < 0) return -1;
+    return 0;
+}
+
+// Writes the characters [off, off+len) of the line in `style`, the
+// printable ones are written together, the others one at a time
+// Returns the width written, -1 on error
+static int write_run_escaped(Style *style, const struct Line *line, size_t off, size_t len) {
+    char buf[256];
+    size_t buf_len = 0;
     int count = 0;
-    int ret;
     for(size_t i = off; i < len+off; i++) {
         utf32 c = 0;
         assert(str_get_char(&line->text, i, &c) != -1);
@@ -150,21 +178,131 @@ int write_escaped(Style *base_style, const struct Line *line, size_t off, size_t
         assert(c && "null in middle of the line");
         assert(c != L'\n' && "new line in middle of the line");
 
+        int width = 0;
+        if(c >= 0x20 && c < 0x7f) width = 1;
+        else if(c != L'\t' && iswprint(utf32_to_wint(c))) width = utf32_width(c);
+        if(width > 0) {
+            if(buf_len + 4 > sizeof(buf)) {
+                if(write_styled(style, buf, buf_len)) return -1;
+                buf_len = 0;
+            }
+            buf_len += utf32_to_utf8(c, buf + buf_len, 4);
+            count += width;
+            continue;
+        }
+
+        if(write_styled(style, buf, buf_len)) return -1;
+        buf_len = 0;
+        int ret = write_char_escaped(style, c, STDOUT_FILENO);
+        if(ret == -1) return ret;
+        count += ret;
+    }
+    if(write_styled(style, buf, buf_len)) return -1;
+    return count;
+}
+
+// A range of the row being drawn styled by a layer
+struct RowSpan {
+    size_t start;
+    size_t end;
+    const Style *style;
+};
+
+// The spans of each layer over the row being drawn, reused from row to row
+// `Vec` of `RowSpan` sorted by start
+static Vec ROW_LAYERS[OVERLAY_LAYERS] = {0};
+
+static void row_layers_clear(void) {
+    for(size_t i = 0; i < OVERLAY_LAYERS; i++) {
+        if(!ROW_LAYERS[i].type_size) ROW_LAYERS[i] = VEC_NEW(struct RowSpan, 0);
+        vec_clear(&ROW_LAYERS[i]);
+    }
+}
+
+static void row_layers_free(void) {
+    for(size_t i = 0; i < OVERLAY_LAYERS; i++) {
+        vec_cleanup(&ROW_LAYERS[i]);
+    }
+}
+
+// Adds the part of [start, end) within [off, off_end) to the layer
+static void row_layer_push(
+        enum OverlayLayer layer,
+        size_t off,
+        size_t off_end,
+        size_t start,
+        size_t end,
+        const Style *style) {
+    if(!style) return;
+    if(start < off) start = off;
+    if(end > off_end) end = off_end;
+    if(start >= end) return;
+    struct RowSpan span = {
+        .start = start,
+        .end = end,
+        .style = style,
+    };
+    vec_push(&ROW_LAYERS[layer], &span);
+}
+
+// Adds the syntax spans of the characters [off, end) of the line
+static void row_layer_syntax(const struct Line *line, size_t off, size_t end) {
+    for(size_t i = line_span_find(line, off); i < line->spans.len; i++) {
+        const struct StyleSpan *span = VEC_GET(struct StyleSpan, &line->spans, i);
+        if(span->start >= end) break;
+        row_layer_push(OVERLAY_SYNTAX, off, end, span->start, span->start + span->len, style_find_by_id(span->id));
+    }
+}
+
+// Writes the characters [off, off+len) of the line with the layers of the
+// row merged, a run goes up to the next change in any of them
+static int write_layers_escaped(Style *base_style, const struct Line *line, size_t off, size_t len) {
+    size_t idx[OVERLAY_LAYERS] = {0};
+    int count = 0;
+    size_t end = off + len;
+    size_t i = off;
+    while(i < end) {
         Style s = *base_style;
-        if(i < line->style_ids.len) {
-            Style *cur = style_find_by_id(*VEC_GET(char, &line->style_ids, i));
-            if(cur) {
-                s = style_merge(s, *cur);
+        size_t run_end = end;
+        for(size_t l = 0; l < OVERLAY_LAYERS; l++) {
+            const Vec *spans = &ROW_LAYERS[l];
+            while(idx[l] < spans->len && (VEC_GET(struct RowSpan, spans, idx[l]))->end <= i) idx[l]++;
+            if(idx[l] == spans->len) continue;
+            // where the spans of a layer overlap the first one wins
+            const struct RowSpan *span = VEC_GET(struct RowSpan, spans, idx[l]);
+            if(span->start <= i) {
+                s = style_merge(s, *span->style);
+                if(span->end < run_end) run_end = span->end;
+            } else if(span->start < run_end) {
+                run_end = span->start;
             }
         }
 
-        ret = write_char_escaped(&s, c, STDOUT_FILENO);
+        int ret = write_run_escaped(&s, line, i, run_end - i);
         if(ret == -1) return ret;
         count += ret;
+        i = run_end;
     }
     return count;
 }
 
+int write_escaped(Style *base_style, const struct Line *line, size_t off, size_t len) {
+    row_layers_clear();
+    row_layer_syntax(line, off, off + len);
+    return write_layers_escaped(base_style, line, off, len);
+}
+
+// Sets [lo, hi) to the characters of the line `line_idx` in the selection
+static void view_selection_line_range(const struct ViewSelection *vs, size_t line_idx, size_t *lo, size_t *hi) {
+    *lo = 0;
+    *hi = 0;
+    if(line_idx < vs->start.off_y || line_idx > vs->end.off_y) return;
+    *hi = SIZE_MAX;
+    if(vs->mode == ViewSelectionMode_LINE) return;
+    if(line_idx == vs->start.off_y) *lo = vs->start.off_x;
+    if(line_idx == vs->end.off_y) *hi = vs->end.off_x + 1;
+}
+
 static int view_write_escaped(
         Style *base_style,
         struct View *v,
@@ -172,37 +310,45 @@ static int view_write_escaped(
         size_t off,
         size_t len,
         Style *highlight,
-        struct ViewSelection *vs) {
-
-    if(!vs) return write_escaped(base_style, buffer_line_get(v->buff, line_idx), off, len);
+        struct ViewSelection *vs,
+        const struct BracketPos *brackets) {
 
-    int count = 0;
-    int ret;
     struct Line *line = buffer_line_get(v->buff, line_idx);
-    for(size_t i = off; i < len+off; i++) {
-        utf32 c = 0;
-        assert(str_get_char(&line->text, i, &c) != -1);
-
-        // could be wide null (unlikely but still)
-        assert(c && "null in middle of the line");
-        assert(c != L'\n' && "new line in middle of the line");
-
-        Style s = *base_style;
+    size_t end = off + len;
+    row_layers_clear();
+    row_layer_syntax(line, off, end);
+
+    const struct Overlay *diagnostics = &v->buff->diagnostics;
+    for(size_t i = overlay_find(diagnostics, line_idx); i < diagnostics->spans.len; i++) {
+        const struct OverlaySpan *span = VEC_GET(struct OverlaySpan, &diagnostics->spans, i);
+        if(span->line != line_idx) break;
+        row_layer_push(OVERLAY_DIAGNOSTICS, off, end, span->col, span->col + span->len, style_find_by_id(span->id));
+    }
 
-        if(i < line->style_ids.len) {
-            Style *cur = style_find_by_id(*VEC_GET(char, &line->style_ids, i));
-            if(cur) {
-                s = style_merge(s, *cur);
-            }
+    const struct ReState *rs = &v->buff->re_state;
+    Style *search_style = style_find(SEARCH_HIGHLIGHT);
+    if(re_state_active(rs) && rs->matches.len && search_style) {
+        size_t match_end = re_state_find(rs, line_idx + 1, 0);
+        for(size_t i = re_state_find(rs, line_idx, 0); i < match_end; i++) {
+            struct ReMatch match = re_state_match(rs, i);
+            row_layer_push(OVERLAY_SEARCH, off, end, match.col, match.col + match.len, search_style);
         }
+    }
 
-        if(view_selection_position_selected(vs, line_idx, i)) s = style_merge(s, *highlight);
+    Style *bracket_style = style_find(BRACKET_HIGHLIGHT);
+    for(size_t i = 0; brackets && i < 2; i++) {
+        if(brackets[i].line != line_idx) continue;
+        row_layer_push(OVERLAY_BRACKETS, off, end, brackets[i].col, brackets[i].col + 1, bracket_style);
+    }
 
-        ret = write_char_escaped(&s, c, STDOUT_FILENO);
-        if(ret == -1) return ret;
-        count += ret;
+    if(vs) {
+        size_t lo = 0;
+        size_t hi = 0;
+        view_selection_line_range(vs, line_idx, &lo, &hi);
+        row_layer_push(OVERLAY_SELECTION, off, end, lo, hi, highlight);
     }
-    return count;
+
+    return write_layers_escaped(base_style, line, off, len);
 }
 
 
@@ -247,11 +393,83 @@ void view_free(struct View *v) {
     if(v->buff) buffer_rc_dec(v->buff);
 }
 
+static void view_search_line(struct View *v, size_t line_idx, Vec *out);
+static int view_search_done(const struct View *v);
+static void view_search_jump(struct View *v);
+static size_t next_char_off(const char *text, size_t len, size_t off);
+
+// Updates the matches of the active search, if any, after the lines
+// [start, start+removed) got replaced by the lines [start, start+added)
+// only the new lines are searched again, the matches after them are moved
+void view_search_update(struct View *v, size_t start, size_t removed, size_t added) {
+    struct ReState *rs = &v->buff->re_state;
+    if(!re_state_active(rs)) return;
+
+    if(BATCH_DEPTH) {
+        // grow the pending span to cover this edit, it is searched once
+        // when the batch ends
+        if(!rs->refresh_pending) {
+            rs->refresh_pending = 1;
+            rs->pending_start = start;
+            rs->pending_end = start + added;
+            rs->pending_delta = (ssize_t)added - (ssize_t)removed;
+            return;
+        }
+        size_t end = rs->pending_end > start + removed ? rs->pending_end : start + removed;
+        rs->pending_end = end + added - removed;
+        if(start < rs->pending_start) rs->pending_start = start;
+        rs->pending_delta += (ssize_t)added - (ssize_t)removed;
+        return;
+    }
+
+    // the lines after the searched ones are not indexed
+    if(start > rs->scan_end) return;
+    // nor are the ones the upward scan went through, they are searched again
+    if(start < rs->scan_start) {
+        vec_clear(&rs->above);
+        rs->above_lines = 0;
+    }
+
+    size_t lo = re_state_lower_bound(rs, start);
+    size_t hi = re_state_lower_bound(rs, start + removed);
+
+    ssize_t delta = (ssize_t)added - (ssize_t)removed;
+    re_state_shift(rs, hi, delta);
+
+    // an edit before the searched lines only moves them
+    if(start + removed < rs->scan_start) {
+        rs->scan_start += delta;
+        rs->scan_end += delta;
+        return;
+    }
+    // the new lines join the searched ones
+    rs->scan_end = rs->scan_end >= start + removed ? rs->scan_end + delta : start + added;
+    if(start < rs->scan_start) rs->scan_start = start;
+
+    Vec fresh = VEC_NEW(struct ReMatch, 0);
+    for(size_t i = start; i < start + added && i < v->buff->lines.len; i++) {
+        view_search_line(v, i, &fresh);
+    }
+    re_state_replace(rs, lo, hi, fresh.buf, fresh.len);
+    vec_cleanup(&fresh);
+}
+
+// Brings the highlighting and the matches of the buffer up to date after the
+// lines [start, start+removed) got replaced by the lines [start, start+added)
+void view_lines_update(struct View *v, size_t start, size_t removed, size_t added) {
+    syntax_update(v->buff, start, removed, added);
+    overlay_update(&v->buff->diagnostics, start, removed, added);
+    bracket_update(v->buff, start, removed, added);
+    fold_update(&v->buff->folds, start, removed, added);
+    view_search_update(v, start, removed, added);
+}
+
 int view_write(struct View *v, const char *restrict s, size_t len) {
     if(len == 0) return 0;
     v->buff->dirty = 1;
 
     size_t line_idx = v->view_cursor.off_y;
+    size_t old_len = v->buff->lines.len;
 
     // make sure there is a line under the cursor
     // needed when the buffer is empty
@@ -296,24 +514,17 @@ int view_write(struct View *v, const char *restrict s, size_t len) {
         free(end_of_line);
     }
 
-    // rerun the search
-    if(v->buff->re_state.matches.len) {
-        re_state_clear_matches(&v->buff->re_state);
-        view_search_re(v);
-    }
+    size_t added = v->view_cursor.off_y - line_idx + 1;
+    view_lines_update(v, line_idx, added - (v->buff->lines.len - old_len), added);
 
     return 0;
 }
 
-void view_clear_highlight(struct View *v) {
-    for(size_t i = 0; i < v->buff->lines.len; i++) {
-        vec_clear(&buffer_line_get(v->buff, i)->style_ids);
-    }
-}
-
 void view_set_cursor(struct View *v, size_t x, size_t y) {
     if(!v->buff || !v->buff->lines.len) return;
-    v->view_cursor.off_y = y < v->buff->lines.len ? y : v->buff->lines.len-1;
+    y = y < v->buff->lines.len ? y : v->buff->lines.len-1;
+    // the lines in a closed fold are not drawn, the cursor goes on its first
+    v->view_cursor.off_y = fold_visible_start(&v->buff->folds, y);
     if(v->view_cursor.off_y < v->line_off) {
         v->line_off = v->view_cursor.off_y;
         v->first_line_char_off = 0;
@@ -427,6 +638,49 @@ Str view_selection_get_text(const struct ViewSelection *vs, const struct View *v
     return selected;
 }
 
+// Moves the cursor to the bracket matching the one under it, or the one
+// matching the next bracket of the line
+// Returns -1 if there is none
+int view_move_cursor_bracket(struct View *v) {
+    if(!v->buff->lines.len) return -1;
+    size_t line = v->view_cursor.off_y;
+    size_t len = str_len(&buffer_line_get(v->buff, line)->text);
+    // the cursor can be right after the end of the line
+    size_t start = v->view_cursor.off_x < len ? v->view_cursor.off_x : len - !!len;
+    for(size_t col = start; col < len; col++) {
+        struct BracketPos match;
+        if(!bracket_match(v->buff, line, col, &match)) {
+            view_set_cursor(v, match.col, match.line);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Folds the lines [start, end], the cursor goes on the first one if it was
+// in them
+// Returns -1 if the fold would cross another one
+int view_fold(struct View *v, size_t start, size_t end) {
+    if(fold_add(&v->buff->folds, start, end)) {
+        message_print("E: a fold cannot cross another one");
+        return -1;
+    }
+    view_set_cursor(v, v->view_cursor.off_x, v->view_cursor.off_y);
+    return 0;
+}
+
+// Runs `cmd` on the folds around the cursor, the cursor then goes on the
+// first line drawn of its fold
+// Returns -1 if there is no fold to run it on
+int view_fold_cmd(struct View *v, int (*cmd)(struct FoldTree *t, size_t line)) {
+    if(cmd(&v->buff->folds, v->view_cursor.off_y)) {
+        message_print("E: no fold found");
+        return -1;
+    }
+    view_set_cursor(v, v->view_cursor.off_x, v->view_cursor.off_y);
+    return 0;
+}
+
 void view_move_cursor_start(struct View *v) {
     view_set_cursor(v, 0, v->view_cursor.off_y);
 }
@@ -446,12 +700,31 @@ void view_move_cursor(struct View *v, ssize_t off_x, ssize_t off_y) {
         new_x = v->view_cursor.target_x;
     }
 
-    ssize_t new_y = (ssize_t)v->view_cursor.off_y + off_y;
-    if(new_y < 0) new_y = 0;
+    // a closed fold counts as one line
+    size_t new_y = fold_visible_move(&v->buff->folds, v->view_cursor.off_y, off_y, v->buff->lines.len);
 
     view_set_cursor(v, new_x, new_y);
 }
 
+// Highlights the lines on screen, the ones hidden by folds are skipped
+static void view_highlight_visible(struct View *v, uint16_t height) {
+    struct FoldTree *folds = &v->buff->folds;
+    size_t len = v->buff->lines.len;
+    // the lines between two folds are lexed at once
+    size_t start = v->line_off;
+    size_t line = v->line_off;
+    // a line takes at least a row
+    for(uint16_t row = 0; row < height && line < len; row++) {
+        size_t end = fold_visible_end(folds, line);
+        if(end != line) {
+            syntax_highlight(v->buff, start, line + 1);
+            start = end + 1;
+        }
+        line = end + 1;
+    }
+    if(start < line) syntax_highlight(v->buff, start, line);
+}
+
 uint16_t view_num_width(const struct View *v) {
     if(v->options.no_line_num) return 0;
     if(v->buff->lines.len <= 1) return 2;
@@ -494,6 +767,16 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
     struct Line *l = buffer_line_get(v->buff, v->view_cursor.off_y);
     if(str_len(&l->text) < v->view_cursor.off_x) v->view_cursor.off_x = str_len(&l->text) ? str_len(&l->text) : 0;
 
+    // the first line on screen is drawn whole if it starts a closed fold
+    struct FoldTree *folds = &v->buff->folds;
+    if(v->line_off < v->buff->lines.len) {
+        size_t line_off = fold_visible_start(folds, v->line_off);
+        if(line_off != v->line_off || fold_visible_end(folds, line_off) != line_off) {
+            v->line_off = line_off;
+            v->first_line_char_off = 0;
+        }
+    }
+
     // check if the cursor is beyond the end of the screen
     {
         uint16_t leading_height = 0;
@@ -505,7 +788,14 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
                 l = line_head(&l, v->view_cursor.off_x+1);
             }
 
-            if(l.render_width > width) {
+            if(fold_visible_end(folds, line_off) != (size_t)line_off) {
+                // a closed fold takes a single row
+                leading_height += 1;
+                if(leading_height > height) {
+                    line_off = fold_visible_end(folds, line_off) + 1;
+                    break;
+                }
+            } else if(l.render_width > width) {
                 leading_height += l.render_width / width;
                 leading_height += (l.render_width % width != 0);
             } else {
@@ -522,7 +812,7 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
                 }
                 break;
             }
-            line_off--;
+            line_off = line_off ? (ssize_t)fold_visible_start(folds, line_off - 1) : -1;
         }
         if(line_off < 0) line_off = 0;
         if(line_off > (ssize_t)v->line_off) {
@@ -533,6 +823,15 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
         }
     }
 
+    view_highlight_visible(v, height);
+
+    // the pair of brackets around the cursor of the active view
+    struct BracketPos brackets_buf[2];
+    const struct BracketPos *brackets = 0;
+    if(ac && !bracket_enclosing(v->buff, v->view_cursor.off_y, v->view_cursor.off_x, &brackets_buf[0], &brackets_buf[1])) {
+        brackets = brackets_buf;
+    }
+
     // render text
     size_t text_height = 0;
     size_t line_idx = 0;
@@ -560,7 +859,16 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
                 );
         }
 
-        size_t target_width = width;
+        // a closed fold is drawn as its first line followed by its size
+        size_t fold_end = fold_visible_end(folds, line_idx + v->line_off);
+        char fold_info[32] = "";
+        size_t fold_info_len = 0;
+        if(fold_end != line_idx + v->line_off) {
+            fold_info_len = snprintf(fold_info, sizeof(fold_info), " +%zu lines", fold_end - line_idx - v->line_off + 1);
+            if(fold_info_len >= width) fold_info_len = 0;
+        }
+
+        size_t target_width = width - fold_info_len;
         ssize_t idx = take_cols(
                 &l.text,
                 &target_width,
@@ -585,7 +893,8 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
                     line_idx == 0 ? v->first_line_char_off : 0,
                     idx,
                     &highlight,
-                    &vs) < 0) assert(0);
+                    &vs,
+                    brackets) < 0) assert(0);
 
         if(ac && line_idx + v->line_off == v->view_cursor.off_y) {
             size_t line_cursor_pos = v->view_cursor.off_x;
@@ -593,6 +902,8 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
                 line_cursor_pos += v->first_line_char_off;
             }
             size_t line_width = render_width(&l.text, line_cursor_pos);
+            // the row of a fold is not wrapped
+            if(fold_end != line_idx + v->line_off) line_width = 0;
             ac->row = vp->off_y
                 + text_height
                 + line_width / width;
@@ -601,7 +912,9 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
                 + line_width % width;
         }
 
-        size_t fill = width - target_width;
+        if(fold_info_len) style_fmt(&line_num_style, STDOUT_FILENO, "%s", fold_info);
+
+        size_t fill = width - target_width - fold_info_len;
         if(fill) {
             // style_fmt(&base_style, STDOUT_FILENO, "%*c", fill, ' ');
             style_fmt(&base_style, STDOUT_FILENO, CSI"%dX", fill);
@@ -611,7 +924,7 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
         l = line_tail(&l, idx);
         text_height += 1;
         // print the wraparound lines
-        while(str_len(&l.text) && text_height < height) {
+        while(fold_end == line_idx + v->line_off && str_len(&l.text) && text_height < height) {
             set_cursor_pos(vp->off_x, vp->off_y+text_height);
             // print line number
             if(view_num_width(v) > 0) {
@@ -630,7 +943,7 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
                     CONFIG.tab_width);
             if(idx == SIZE_MAX) assert(0);
 
-            if(view_write_escaped(&v->style, v, line_idx + v->line_off, line_char_off, idx, &highlight, &vs) < 0) assert(0);
+            if(view_write_escaped(&v->style, v, line_idx + v->line_off, line_char_off, idx, &highlight, &vs, brackets) < 0) assert(0);
 
             size_t fill = width - target_width;
             if(fill) {
@@ -641,7 +954,8 @@ int view_render(struct View *v, ViewPort *vp, const struct winsize *ws, struct A
             l = line_tail(&l, idx);
             text_height += 1;
         }
-        line_idx += 1;
+        // the lines hidden by the fold are skipped
+        line_idx = fold_end + 1 - v->line_off;
     }
 
     // render empty lines
@@ -1085,6 +1399,11 @@ struct View view_clone(struct View *v) {
 /// Erases whatever was selected or the character behind the cursor
 int view_erase(struct View *v) {
     size_t cursor = v->view_cursor.off_x;
+    size_t old_len = v->buff->lines.len;
+    // lines [edit_start, edit_start+edit_added) are what is left of the
+    // edited lines
+    size_t edit_start = v->view_cursor.off_y;
+    size_t edit_added = 0;
 
     match_maybe(&v->selection_end,
         selection_end, {
@@ -1117,11 +1436,12 @@ int view_erase(struct View *v) {
             }
 
             size_t selected_lines_count = vs.end.off_y - vs.start.off_y;
-            for(size_t i = 0; i < selected_lines_count; i++) {
-                buffer_line_remove(v->buff, vs.start.off_y + 1);
-            }
+            edit_start = vs.start.off_y;
             if(vs.mode == ViewSelectionMode_LINE) {
-                buffer_line_remove(v->buff, vs.start.off_y);
+                buffer_lines_remove(v->buff, vs.start.off_y, selected_lines_count + 1);
+            } else {
+                buffer_lines_remove(v->buff, vs.start.off_y + 1, selected_lines_count);
+                edit_added = 1;
             }
         },
         {
@@ -1146,6 +1466,7 @@ int view_erase(struct View *v) {
 
                 line_remove(line, start, cursor-1);
                 v->view_cursor.off_x -= cursor - start;
+                edit_added = 1;
             } else if(v->view_cursor.off_y > 0) {
                 v->buff->dirty = 1;
                 struct Line *prev_line = buffer_line_get(v->buff, v->view_cursor.off_y -1);
@@ -1155,20 +1476,367 @@ int view_erase(struct View *v) {
 
                 buffer_line_remove(v->buff, v->view_cursor.off_y);
                 v->view_cursor.off_y -= 1;
+                edit_start = v->view_cursor.off_y;
+                edit_added = 1;
             }
         }
     );
     if(v->line_off > v->view_cursor.off_y) v->line_off = v->view_cursor.off_y;
 
-    // rerun the search
-    if(v->buff->re_state.matches.len) {
-        re_state_clear_matches(&v->buff->re_state);
-        view_search_re(v);
-    }
+    size_t removed = edit_added + (old_len - v->buff->lines.len);
+    if(removed) view_lines_update(v, edit_start, removed, edit_added);
 
     return 0;
 }
 
+// Moves the cursor to the first character of the line that is not a space
+// or a tab
+static void view_set_cursor_text_start(struct View *v, size_t line) {
+    const struct Line *l = VEC_GET(struct Line, &v->buff->lines, line);
+    const char *s = str_as_cstr(&l->text);
+    // the whitespace is ascii, bytes are characters
+    size_t x = 0;
+    while(x < str_cstr_len(&l->text) && (s[x] == ' ' || s[x] == '\t')) x++;
+    view_set_cursor(v, x, line);
+}
+
+// Removes `count` lines starting at `start` as a single edit
+void view_delete_lines(struct View *v, size_t start, size_t count) {
+    size_t len = v->buff->lines.len;
+    if(start >= len || count == 0) return;
+    if(count > len - start) count = len - start;
+
+    buffer_lines_remove(v->buff, start, count);
+
+    if(v->buff->lines.len == 0) {
+        v->view_cursor.off_x = 0;
+        v->view_cursor.off_y = 0;
+        v->line_off = 0;
+        v->first_line_char_off = 0;
+    } else {
+        // on the text of the line after the deleted ones, like vi
+        view_set_cursor_text_start(v, start < v->buff->lines.len ? start : v->buff->lines.len - 1);
+    }
+
+    view_lines_update(v, start, count, 0);
+}
+
+// Replaces the lines [start, start+count) with the lines of `s`, a trailing
+// new line ends the last line instead of starting an empty one
+void view_replace_lines(struct View *v, size_t start, size_t count, const char *s, size_t len) {
+    size_t buff_len = v->buff->lines.len;
+    if(start > buff_len) start = buff_len;
+    if(count > buff_len - start) count = buff_len - start;
+
+    Vec lines = VEC_NEW(struct Line, 0);
+    size_t off = 0;
+    while(off < len) {
+        size_t end = off;
+        while(end < len && s[end] != '\n') end++;
+        struct Line l = line_new();
+        line_append(&l, s + off, end - off);
+        vec_push(&lines, &l);
+        off = end + 1;
+    }
+
+    size_t added = lines.len;
+    buffer_lines_remove(v->buff, start, count);
+    buffer_lines_insert(v->buff, start, lines.buf, lines.len);
+    vec_cleanup(&lines);
+
+    if(v->buff->lines.len == 0) {
+        v->view_cursor.off_x = 0;
+        v->view_cursor.off_y = 0;
+        v->line_off = 0;
+        v->first_line_char_off = 0;
+    } else {
+        view_set_cursor(v, 0, start);
+    }
+
+    view_lines_update(v, start, count, added);
+}
+
+// Reindents the lines [start, end], then updates the views once
+void view_reindent(struct View *v, size_t start, size_t end) {
+    struct Buffer *buff = v->buff;
+    if(!buff->lines.len) return;
+    if(end >= buff->lines.len) end = buff->lines.len - 1;
+    if(start > end) return;
+
+    // the brackets in strings and comments are told apart by their styles
+    syntax_highlight(buff, start, end + 1);
+    struct IndentState s = indent_start(buff, start);
+    size_t first = SIZE_MAX;
+    size_t last = 0;
+    for(size_t i = start; i <= end; i++) {
+        ssize_t indent = indent_next(&s, buff, i);
+        if(indent < 0) continue;
+        if(!indent_line_set(VEC_GET(struct Line, &buff->lines, i), indent)) continue;
+        if(first == SIZE_MAX) first = i;
+        last = i;
+    }
+
+    view_set_cursor_text_start(v, start);
+    if(first == SIZE_MAX) return;
+    buff->dirty = 1;
+    view_lines_update(v, first, last - first + 1, last - first + 1);
+}
+
+// Removes `count` characters under and after the cursor as a single edit
+void view_delete_chars(struct View *v, size_t count) {
+    struct Line *l = buffer_line_get(v->buff, v->view_cursor.off_y);
+    size_t line_len = str_len(&l->text);
+    size_t start = v->view_cursor.off_x;
+    if(start >= line_len || count == 0) return;
+    if(count > line_len - start) count = line_len - start;
+
+    v->buff->dirty = 1;
+    // `line_remove` takes an inclusive range
+    line_remove(l, start, start + count - 1);
+
+    view_lines_update(v, v->view_cursor.off_y, 1, 1);
+}
+
+// state of a substitution shared by the lines it rewrites
+struct Substitute {
+    // null when the pattern is literal
+    regex_t *regex;
+    // groups the replacement refers to, the match included
+    size_t ngroups;
+    const char *pattern;
+    size_t pattern_len;
+    // finds the matches when the pattern is supported, regexec then only
+    // fills in the groups
+    struct Rx *rx;
+    Vec rx_matches;
+    const char *repl;
+    _Bool global;
+};
+
+// Appends `repl` to `out`, & and \0 are replaced by the match and \1 to \9
+// by the groups of `groups`
+static void substitute_expand(
+        const char *repl,
+        const char *text,
+        const regmatch_t *groups,
+        size_t ngroups,
+        Str *out) {
+
+    const char *s = repl;
+    while(*s) {
+        // the text up to the next special character is copied as is
+        size_t run = strcspn(s, "&\\");
+        str_push(out, s, run);
+        s += run;
+        if(!*s) break;
+
+        size_t group = SIZE_MAX;
+        if(*s == '&') {
+            group = 0;
+        } else if(s[1] >= '0' && s[1] <= '9') {
+            group = *++s - '0';
+        } else if(s[1]) {
+            s++;
+        }
+        if(group == SIZE_MAX) {
+            str_push(out, s, 1);
+        } else if(group < ngroups && groups[group].rm_so >= 0) {
+            str_push(out, text + groups[group].rm_so, groups[group].rm_eo - groups[group].rm_so);
+        }
+        s++;
+    }
+}
+
+// Returns the number of groups `repl` needs, the match included
+static size_t substitute_groups(const char *repl) {
+    size_t ngroups = 1;
+    for(const char *s = repl; *s; s++) {
+        if(*s != '\\' || !s[1]) continue;
+        s++;
+        if(*s >= '1' && *s <= '9' && (size_t)(*s - '0') >= ngroups) ngroups = *s - '0' + 1;
+    }
+    return ngroups;
+}
+
+// Writes the text since `*copied` and the replacement of the match
+// `groups[0]` to `out`
+static void substitute_match(
+        const struct Substitute *sub,
+        const char *text,
+        size_t *copied,
+        const regmatch_t *groups,
+        size_t ngroups,
+        Str *out) {
+
+    str_push(out, text + *copied, groups[0].rm_so - *copied);
+    substitute_expand(sub->repl, text, groups, ngroups, out);
+    *copied = groups[0].rm_eo;
+}
+
+// Finds the first match at or after the byte `off` of `text`
+// Returns the number of groups set or 0 if there is no match
+static size_t substitute_find(
+        struct Substitute *sub,
+        const char *text,
+        size_t len,
+        size_t off,
+        regmatch_t *groups) {
+
+    if(!sub->regex) {
+        ssize_t found = search_literal(text + off, len - off, sub->pattern, sub->pattern_len);
+        if(found < 0) return 0;
+        groups[0].rm_so = off + found;
+        groups[0].rm_eo = off + found + sub->pattern_len;
+        return 1;
+    }
+    groups[0].rm_so = off;
+    groups[0].rm_eo = len;
+    int flags = REG_STARTEND | (off ? REG_NOTBOL : 0);
+    if(regexec(sub->regex, text, sub->ngroups, groups, flags)) return 0;
+    return sub->ngroups;
+}
+
+// `substitute_line` for the patterns of the built-in engine, its matches
+// are the ones of regexec which only runs from their start for the groups
+static size_t substitute_line_rx(struct Substitute *sub, const char *text, size_t len, Str *out) {
+    vec_clear(&sub->rx_matches);
+    size_t count = rx_find_all(sub->rx, text, len, &sub->rx_matches);
+    if(count && !sub->global) count = 1;
+
+    regmatch_t groups[10];
+    size_t copied = 0;
+    // the matches are in characters
+    size_t off = 0;
+    size_t col = 0;
+    for(size_t i = 0; i < count; i++) {
+        struct RxMatch *m = vec_get(&sub->rx_matches, i);
+        for(; col < m->col; col++) off = next_char_off(text, len, off);
+        size_t end = off;
+        for(size_t j = 0; j < m->len; j++) end = next_char_off(text, len, end);
+        col += m->len;
+
+        // regexec is given the match only, the end of the line stays the
+        // only place $ matches
+        size_t ngroups = 1;
+        groups[0].rm_so = off;
+        groups[0].rm_eo = end;
+        if(sub->ngroups > 1) {
+            int flags = REG_STARTEND | (off ? REG_NOTBOL : 0) | (end < len ? REG_NOTEOL : 0);
+            if(!regexec(sub->regex, text, sub->ngroups, groups, flags)) ngroups = sub->ngroups;
+            groups[0].rm_so = off;
+            groups[0].rm_eo = end;
+        }
+        substitute_match(sub, text, &copied, groups, ngroups, out);
+        off = end;
+    }
+    if(count) str_push(out, text + copied, len - copied);
+    return count;
+}
+
+// Writes the line `text` with its matches replaced to `out`, the matches
+// are found and replaced in a single pass over the line
+// Returns the number of replaced matches
+static size_t substitute_line(struct Substitute *sub, const char *text, size_t len, Str *out) {
+    str_clear(out);
+    if(sub->rx) return substitute_line_rx(sub, text, len, out);
+
+    regmatch_t groups[10];
+    size_t count = 0;
+    size_t copied = 0;
+    size_t off = 0;
+    ssize_t last_end = -1;
+    while(off <= len) {
+        size_t ngroups = substitute_find(sub, text, len, off, groups);
+        if(!ngroups) break;
+        size_t so = groups[0].rm_so;
+        size_t eo = groups[0].rm_eo;
+
+        // an empty match right after a match is skipped
+        if(so != eo || (ssize_t)so != last_end) {
+            substitute_match(sub, text, &copied, groups, ngroups, out);
+            last_end = eo;
+            count++;
+            if(!sub->global) break;
+            if(so != eo) {
+                off = eo;
+                continue;
+            }
+        }
+        if(so == len) break;
+        off = next_char_off(text, len, so);
+    }
+    if(count) str_push(out, text + copied, len - copied);
+    return count;
+}
+
+int view_substitute(
+        struct View *v,
+        size_t start,
+        size_t end,
+        const char *pattern,
+        const char *repl,
+        int global) {
+
+    struct Substitute sub = {
+        .pattern = pattern,
+        .pattern_len = strlen(pattern),
+        .rx_matches = VEC_NEW(struct RxMatch, 0),
+        .repl = repl,
+        .global = global,
+    };
+    struct Pattern *p = pattern_get(pattern, 0);
+    if(p->error) {
+        message_print("E: %s", p->error_str);
+        pattern_rc_dec(p);
+        return -1;
+    }
+    if(!p->literal) {
+        sub.regex = pattern_regex(p, 0);
+        sub.ngroups = substitute_groups(repl);
+        if(sub.ngroups > sub.regex->re_nsub + 1) sub.ngroups = sub.regex->re_nsub + 1;
+        sub.rx = pattern_rx(p, 0);
+    }
+
+    size_t buff_len = v->buff->lines.len;
+    if(end >= buff_len) end = buff_len ? buff_len - 1 : 0;
+
+    // every line is rebuilt once, the search is refreshed once at the end
+    size_t count = 0;
+    size_t first_line = SIZE_MAX;
+    size_t last_line = 0;
+    Str out = str_new();
+    for(size_t i = start; i < buff_len && i <= end; i++) {
+        struct Line *l = buffer_line_get(v->buff, i);
+        size_t found = substitute_line(
+                &sub,
+                str_as_cstr(&l->text),
+                str_cstr_len(&l->text),
+                &out);
+        if(!found) continue;
+
+        // the line takes the new text and `out` the old one, to be reused
+        Str old = l->text;
+        l->text = out;
+        out = old;
+        l->render_width = render_width(&l->text, str_len(&l->text));
+        count += found;
+        if(first_line == SIZE_MAX) first_line = i;
+        last_line = i;
+    }
+    str_free(&out);
+
+    if(count) {
+        v->buff->dirty = 1;
+        view_set_cursor(v, 0, last_line);
+        size_t changed = last_line - first_line + 1;
+        view_lines_update(v, first_line, changed, changed);
+    }
+
+    vec_cleanup(&sub.rx_matches);
+    pattern_rc_dec(p);
+    return count;
+}
+
 void view_next(void) {
     struct Tab *cur_tab = tab_active();
     struct Window *cw = tab_window_active(cur_tab);
@@ -1330,35 +1998,136 @@ int view_move_cursor_word_next(struct View *v) {
     return 0;
 }
 
-int count_indent(Str *s) {
-    size_t indent = 0;
-    utf32 c = 0;
-    while(indent < str_len(s)
-            && !str_get_char(s, indent, &c)
-            && iswspace(c)) {
-        indent+=1;
-    }
-    return indent;
+// Indents the line under the cursor from the lines before it, the cursor
+// must be at its start
+static void view_indent_new_line(struct View *v) {
+    Str prefix = str_new();
+    indent_prefix(indent_for(v->buff, v->view_cursor.off_y), &prefix);
+    view_write(v, str_as_cstr(&prefix), str_cstr_len(&prefix));
+    str_free(&prefix);
 }
 
 #define EQ_STATIC_STR(s, buf, len) (sizeof(s) -1) == len && !strncmp(s, buf, len)
 
-int normal_multi_char(Str text) {
+// count typed in front of a normal mode command, 0 when none was typed
+static size_t NORMAL_COUNT = 0;
+// set while the first keys of a multi key command (ie: `dd`) are pending
+static _Bool NORMAL_PENDING = 0;
+
+// set to `q` or `@` while waiting for the register of that command
+static utf32 NORMAL_REGISTER_CMD = 0;
+
+// Returns 1 if the key was consumed as part of a count
+static int normal_count_push(utf32 key) {
+    if(key < '0' || key > '9') return 0;
+    // a leading 0 is the "start of line" motion
+    if(key == '0' && !NORMAL_COUNT) return 0;
+
+    // saturate instead of overflowing, the count is later used as an offset
+    if(NORMAL_COUNT <= (SSIZE_MAX - 9) / 10) {
+        NORMAL_COUNT = NORMAL_COUNT * 10 + (key - '0');
+    }
+    message_append("%c", (char)key);
+    return 1;
+}
+
+// Returns the count of the current command, 1 when none was typed
+static size_t normal_count(void) {
+    return NORMAL_COUNT ? NORMAL_COUNT : 1;
+}
+
+// forgets the count and the pending keys once a command ran
+static void normal_count_clear(void) {
+    // do not erase messages printed by the command itself
+    if((NORMAL_COUNT || NORMAL_PENDING) && !MESSAGE.options.ro) {
+        message_clear();
+    }
+    NORMAL_COUNT = 0;
+    NORMAL_PENDING = 0;
+    NORMAL_REGISTER_CMD = 0;
+}
+
+// runs the `q` or `@` command waiting for its register
+static int normal_register_cmd(utf32 reg) {
+    utf32 cmd = NORMAL_REGISTER_CMD;
+    size_t count = normal_count();
+    normal_count_clear();
+
+    switch(cmd) {
+        case 'q':
+            return macro_record_start(reg);
+        case '@':
+            return macro_replay(reg, count);
+    }
+    return 0;
+}
+
+// `text` contains the count (if any) followed by the keys of the command
+int normal_multi_char(Str text, size_t count) {
     struct View *v = tab_active_view(tab_active());
 
     const char *s = text.v.buf;
     size_t len = str_len(&text);
 
+    // skip the count, it was already parsed by `normal_count_push`
+    while(len && *s >= '0' && *s <= '9') {
+        s++;
+        len--;
+    }
+
     if(EQ_STATIC_STR("gg",s, len)) {
-        view_set_cursor(v, 0, 0);
+        view_set_cursor(v, 0, NORMAL_COUNT ? NORMAL_COUNT - 1 : 0);
         return 1;
-    } else if (EQ_STATIC_STR("dd",s, len)) {
-        if(v->view_cursor.off_y + 1 == v->buff->lines.len) {
-            view_move_cursor(v, 0, -1);
-            buffer_line_remove(v->buff, v->view_cursor.off_y+1);
-        } else {
-            buffer_line_remove(v->buff, v->view_cursor.off_y);
-        }
+    } else if (len >= 2 && s[0] == 'd' && s[len - 1] == 'd' && strspn(s + 1, "0123456789") == len - 2) {
+        // `2d3d` deletes 6 lines, `normal_count_push` read both counts as one
+        size_t before = s != text.v.buf ? strtoul(text.v.buf, 0, 10) : 1;
+        size_t after = len > 2 ? strtoul(s + 1, 0, 10) : 1;
+        size_t lines = after && before > SIZE_MAX / after ? SIZE_MAX : before * after;
+        view_delete_lines(v, v->view_cursor.off_y, lines);
+        return 1;
+    } else if ((EQ_STATIC_STR("==",s, len)) || (EQ_STATIC_STR("=j",s, len))) {
+        struct FoldTree *folds = &v->buff->folds;
+        size_t start = v->view_cursor.off_y;
+        size_t lines = s[1] == 'j' ? count : count - 1;
+        size_t end = fold_visible_move(folds, start, lines, v->buff->lines.len);
+        view_reindent(v, start, fold_visible_end(folds, end));
+        return 1;
+    } else if (EQ_STATIC_STR("=k",s, len)) {
+        size_t end = fold_visible_end(&v->buff->folds, v->view_cursor.off_y);
+        view_reindent(v, fold_visible_move(&v->buff->folds, end, -(ssize_t)count, v->buff->lines.len), end);
+        return 1;
+    } else if (EQ_STATIC_STR("=G",s, len)) {
+        view_reindent(v, v->view_cursor.off_y, SIZE_MAX);
+        return 1;
+    } else if (EQ_STATIC_STR("=gg",s, len)) {
+        view_reindent(v, 0, fold_visible_end(&v->buff->folds, v->view_cursor.off_y));
+        return 1;
+    } else if (EQ_STATIC_STR("zF",s, len)) {
+        size_t start = v->view_cursor.off_y;
+        size_t end = fold_visible_move(&v->buff->folds, start, count - 1, v->buff->lines.len);
+        view_fold(v, start, fold_visible_end(&v->buff->folds, end));
+        return 1;
+    } else if (EQ_STATIC_STR("zo",s, len)) {
+        view_fold_cmd(v, fold_open);
+        return 1;
+    } else if (EQ_STATIC_STR("zc",s, len)) {
+        view_fold_cmd(v, fold_close);
+        return 1;
+    } else if (EQ_STATIC_STR("za",s, len)) {
+        view_fold_cmd(v, fold_toggle);
+        return 1;
+    } else if (EQ_STATIC_STR("zd",s, len)) {
+        view_fold_cmd(v, fold_delete);
+        return 1;
+    } else if (EQ_STATIC_STR("zE",s, len)) {
+        fold_free(&v->buff->folds);
+        return 1;
+    } else if (EQ_STATIC_STR("zR",s, len)) {
+        fold_set_all(&v->buff->folds, 0);
+        return 1;
+    } else if (EQ_STATIC_STR("zM",s, len)) {
+        fold_set_all(&v->buff->folds, 1);
+        view_set_cursor(v, v->view_cursor.off_x, v->view_cursor.off_y);
         return 1;
     }
     return 0;
@@ -1367,19 +2136,57 @@ int normal_multi_char(Str text) {
 int normal_handle_key(struct KeyEvent *e) {
     struct View *v = tab_active_view(tab_active());
 
+    if(e->modifier == 0 && NORMAL_REGISTER_CMD) return normal_register_cmd(e->key);
+    if(e->modifier == 0 && normal_count_push(e->key)) return 0;
+
+    size_t count = normal_count();
+
+    // the last key of the fold and indent commands can be a command of its
+    // own (ie: the `o` of `zo`, the `G` of `=G`), the other multi key
+    // commands do not end with one
+    const char *pending = NORMAL_PENDING ? str_as_cstr(&buffer_line_get(MESSAGE.buff, 0)->text) : "";
+    if(e->modifier == 0 && (*pending == 'z' || *pending == '=') && iswalnum(e->key)) {
+        Str keys = str_from_cstr(pending);
+        char c[4] = {};
+        int len = utf32_to_utf8(e->key, c, 4);
+        str_push(&keys, c, len);
+        int ret = normal_multi_char(keys, count);
+        str_free(&keys);
+        if(ret) {
+            normal_count_clear();
+            return ret;
+        }
+    }
+
     if(e->modifier == 0) {
         switch(e->key) {
             case 'G': {
-                view_move_cursor(v, 0, v->buff->lines.len);
+                if(NORMAL_COUNT) {
+                    view_set_cursor(v, 0, NORMAL_COUNT - 1);
+                } else {
+                    view_move_cursor(v, 0, v->buff->lines.len);
+                }
             } break;
             case 'b': {
-                if(view_move_cursor_word_start(v)) return -1;
+                for(size_t i = 0; i < count; i++) {
+                    struct ViewCursor before = v->view_cursor;
+                    if(view_move_cursor_word_start(v)) return -1;
+                    if(!memcmp(&before, &v->view_cursor, sizeof(before))) break;
+                }
             } break;
             case 'e': {
-                if(view_move_cursor_word_end(v)) return -1;
+                for(size_t i = 0; i < count; i++) {
+                    struct ViewCursor before = v->view_cursor;
+                    if(view_move_cursor_word_end(v)) return -1;
+                    if(!memcmp(&before, &v->view_cursor, sizeof(before))) break;
+                }
             } break;
             case 'w': {
-                if(view_move_cursor_word_next(v)) return -1;
+                for(size_t i = 0; i < count; i++) {
+                    struct ViewCursor before = v->view_cursor;
+                    if(view_move_cursor_word_next(v)) return -1;
+                    if(!memcmp(&before, &v->view_cursor, sizeof(before))) break;
+                }
             } break;
             case '^': {
                 view_move_cursor_start(v);
@@ -1392,15 +2199,10 @@ int normal_handle_key(struct KeyEvent *e) {
                 }
             } break;
             case 'O': {
-                struct Line *l = buffer_line_get(v->buff, v->view_cursor.off_y);
-                int indent = count_indent(&l->text);
-
                 view_move_cursor_start(v);
                 view_write(v, "\n", sizeof("\n")-1);
                 view_move_cursor(v, 0, -1);
-                for(size_t i = 0; i < indent; i++) {
-                    view_write(v, " ", 1);
-                }
+                view_indent_new_line(v);
                 mode_change(M_Insert);
             } break;
             case 'A': {
@@ -1408,13 +2210,12 @@ int normal_handle_key(struct KeyEvent *e) {
                 mode_change(M_Insert);
             } break;
             case 'o': {
-                struct Line *l = buffer_line_get(v->buff, v->view_cursor.off_y);
-                int indent = count_indent(&l->text);
-                view_move_cursor_end(v);
+                // the new line goes after the lines of a closed fold
+                size_t fold_end = fold_visible_end(&v->buff->folds, v->view_cursor.off_y);
+                v->view_cursor.off_y = fold_end;
+                v->view_cursor.off_x = str_len(&buffer_line_get(v->buff, fold_end)->text);
                 view_write(v, "\n", sizeof("\n")-1);
-                for(size_t i = 0; i < indent; i++) {
-                    view_write(v, " ", 1);
-                }
+                view_indent_new_line(v);
                 mode_change(M_Insert);
             } break;
             case 'v': {
@@ -1426,28 +2227,30 @@ int normal_handle_key(struct KeyEvent *e) {
             case '$': {
                 view_move_cursor_end(v);
             } break;
+            case '%': {
+                view_move_cursor_bracket(v);
+            } break;
             case 'x': {
-                view_move_cursor(v, 1,0);
-                view_erase(v);
+                view_delete_chars(v, count);
             } break;
             case '0': {
                 view_move_cursor_start(v);
             } break;
             case KC_ARRDOWN:
             case 'j': {
-                view_move_cursor(v, 0,+1);
+                view_move_cursor(v, 0, +(ssize_t)count);
             } break;
             case KC_ARRUP:
             case 'k': {
-                view_move_cursor(v, 0,-1);
+                view_move_cursor(v, 0, -(ssize_t)count);
             } break;
             case KC_ARRLEFT:
             case 'h': {
-                view_move_cursor(v, -1,0);
+                view_move_cursor(v, -(ssize_t)count, 0);
             } break;
             case KC_ARRRIGHT:
             case 'l': {
-                view_move_cursor(v, +1,0);
+                view_move_cursor(v, +(ssize_t)count, 0);
             } break;
             case 'i': {
                 mode_change(M_Insert);
@@ -1467,68 +2270,108 @@ int normal_handle_key(struct KeyEvent *e) {
                 if(clipboard_get(&selection)) {
                     message_print("E: failed to paste: '%s'", strerror(errno));
                 } else {
-                    view_write(v, str_as_cstr(&selection), str_cstr_len(&selection));
+                    // build the repeated text first so it is inserted
+                    // (and the search rerun) only once
+                    Str repeated = str_new();
+                    for(size_t i = 0; i < count; i++) {
+                        str_push(&repeated, str_as_cstr(&selection), str_cstr_len(&selection));
+                    }
+                    view_write(v, str_as_cstr(&repeated), str_cstr_len(&repeated));
+                    str_free(&repeated);
                 }
                 str_free(&selection);
             } break;
+            case 'q': {
+                if(macro_recording()) {
+                    macro_record_stop();
+                    break;
+                }
+            } // fallthrough
+            case '@': {
+                NORMAL_REGISTER_CMD = e->key;
+                NORMAL_PENDING = 1;
+                message_append("%c", (char)e->key);
+            } return 0;
+            case '\n': {
+                // enter on a result of `:grep` opens it
+                if(v->buff->in.ty == INPUT_SCRATCH && v->view_cursor.off_y < v->buff->lines.len) {
+                    struct Line *l = buffer_line_get(v->buff, v->view_cursor.off_y);
+                    editor_open_location(str_as_cstr(&l->text));
+                }
+            } break;
             case 'n': {
-                cursor_jump_next_search();
+                cursor_jump_next_search(count);
             } break;
             case 'N': {
-                cursor_jump_prev_search();
+                cursor_jump_prev_search(count);
             } break;
             default: {
-                if(iswalnum(e->key)) {
+                if(iswalnum(e->key) || e->key == '=') {
                     char c[4] = {};
                     int len = utf32_to_utf8(e->key, c, 4);
                     message_append("%.*s", len, c);
                     struct Line *l = buffer_line_get(MESSAGE.buff, 0);
-                    int ret = normal_multi_char(l->text);
+                    int ret = normal_multi_char(l->text, count);
                     if(ret) {
-                        message_clear();
+                        NORMAL_PENDING = 1;
+                        normal_count_clear();
                         return ret;
                     }
+                    NORMAL_PENDING = 1;
+                    return 0;
                 }
             } break;
         }
     } else if (e->modifier == KM_Ctrl) {
         switch(e->key) {
             case 'e': {
-                if(v->line_off < v->buff->lines.len-1) {
-                    if(v->view_cursor.off_y == v->line_off) {
+                struct FoldTree *folds = &v->buff->folds;
+                size_t next = fold_visible_move(folds, v->line_off, +1, v->buff->lines.len);
+                if(next != v->line_off) {
+                    if(v->view_cursor.off_y == fold_visible_start(folds, v->line_off)) {
                         view_move_cursor(v, 0, +1);
                     }
-                    v->line_off += 1;
+                    v->line_off = next;
                 }
             } break;
             case 'y': {
+                struct FoldTree *folds = &v->buff->folds;
                 if(v->line_off > 0) {
-                    v->line_off -= 1;
+                    v->line_off = fold_visible_move(folds, v->line_off, -1, v->buff->lines.len);
                     v->first_line_char_off = 0;
                 }
                 size_t line_count = 0;
                 size_t inner_width = view_inner_width(v, &v->vp);
                 struct Buffer *buff = v->buff;
-                size_t i;
+                size_t line = v->line_off;
                 // moves the cursor one line up
                 // when the cursor is at the bottom of the screen
                 // on the previous frame (a limitation of immediate mode UIs)
-                for(i=0; i < v->vp.height; i++) {
+                for(size_t i = 0; i < v->vp.height; i++) {
                     size_t line_width =
-                        buffer_line_get(buff, i + v->line_off)->render_width;
+                        buffer_line_get(buff, line)->render_width;
                     size_t render_height =
                         line_width / inner_width
                         + ((line_width % inner_width) != 0 || line_width == 0);
+                    // a closed fold takes a single row
+                    if(fold_visible_end(folds, line) != line) render_height = 1;
                     if(render_height + line_count >= v->vp.height) {
                         break;
                     }
                     line_count += render_height;
+                    size_t next = fold_visible_move(folds, line, +1, buff->lines.len);
+                    // the whole buffer fits
+                    if(next == line) {
+                        line = buff->lines.len;
+                        break;
+                    }
+                    line = next;
                 }
-                if(v->line_off + i <= v->view_cursor.off_y) {
+                if(line <= v->view_cursor.off_y) {
                     view_set_cursor(
                             v,
                             v->view_cursor.off_x,
-                            v->line_off + i -1);
+                            fold_visible_move(folds, line, -1, buff->lines.len));
                 }
             } break;
             case KC_ARRLEFT:
@@ -1547,6 +2390,7 @@ int normal_handle_key(struct KeyEvent *e) {
         }
     }
 
+    normal_count_clear();
     return 0;
 }
 
@@ -1578,15 +2422,8 @@ int insert_handle_key(struct KeyEvent *e) {
             view_write(v, " ", 1);
         }
     } else if(e->key == '\n') {
-        struct Line *l = buffer_line_get(
-            v->buff,
-            v->view_cursor.off_y);
-        int indent = count_indent(&l->text);
         view_write(v, "\n", 1);
-        // TODO(louis) make the indent stuff work with tabs
-        for(size_t i = 0; i < indent; i++) {
-            view_write(v, " ", 1);
-        }
+        view_indent_new_line(v);
     } else if(e->key == KC_DEL) {
         view_erase(v);
         return 0;
@@ -1721,11 +2558,43 @@ int visual_leave(void) {
     return 0;
 }
 
+// set after a `z` waiting for the `f` of `zf`
+static _Bool VISUAL_PENDING_Z = 0;
+
 int visual_handle_key(struct KeyEvent *e) {
     struct View *v = tab_active_view(tab_active());
 
+    if(VISUAL_PENDING_Z) {
+        VISUAL_PENDING_Z = 0;
+        if(e->modifier == 0 && e->key == 'f') {
+            struct ViewSelection vs = view_selection_from_cursors(
+                *as_ptr(&v->selection_end),
+                v->view_cursor
+            );
+            // this skips the mode change setting the position
+            set_none(&v->selection_end);
+            view_set_cursor(v, 0, vs.start.off_y);
+            view_fold(v, vs.start.off_y, fold_visible_end(&v->buff->folds, vs.end.off_y));
+            mode_change(M_Normal);
+            return 0;
+        }
+    }
+
     if(e->modifier == 0) {
         switch(e->key) {
+            case 'z': {
+                VISUAL_PENDING_Z = 1;
+            } break;
+            case '=': {
+                struct ViewSelection vs = view_selection_from_cursors(
+                    *as_ptr(&v->selection_end),
+                    v->view_cursor
+                );
+                // this skips the mode change setting the position
+                set_none(&v->selection_end);
+                view_reindent(v, vs.start.off_y, fold_visible_end(&v->buff->folds, vs.end.off_y));
+                mode_change(M_Normal);
+            } break;
             case 'G': {
                 view_move_cursor(v, 0, v->buff->lines.len);
             } break;
@@ -1751,6 +2620,18 @@ int visual_handle_key(struct KeyEvent *e) {
             case '$': {
                 view_move_cursor_end(v);
             } break;
+            case '%': {
+                view_move_cursor_bracket(v);
+            } break;
+            case ':': {
+                // prefill the range of the selected lines
+                struct ViewSelection vs = view_selection_from_cursors(
+                    *as_ptr(&v->selection_end),
+                    v->view_cursor
+                );
+                mode_change(M_Command);
+                message_append("%zu,%zu", vs.start.off_y + 1, vs.end.off_y + 1);
+            } break;
             case '0': {
                 view_move_cursor_start(v);
             } break;
@@ -1866,10 +2747,9 @@ int search_enter(void) {
 
 int search_leave(void) {
     struct View *active_view = tab_active_view(tab_active());
-    if(active_view->buff->re_state.error_str) {
-        message_print(
-            "E: regex error: '%s'",
-            active_view->buff->re_state.error_str);
+    struct Pattern *p = active_view->buff->re_state.pattern;
+    if(p && p->error) {
+        message_print("E: regex error: '%s'", p->error_str);
     }
     insert_leave();
     return 0;
@@ -1908,9 +2788,7 @@ int search_handle_key(struct KeyEvent *e) {
             struct Line *line = buffer_line_get(MESSAGE.buff, 0);
             // this only checks the first line
             editor_search(str_as_cstr(&line->text)+1);
-            struct View *active_view = tab_active_view(tab_active());
-            active_view->view_cursor = active_view->buff->re_state.original_cursor;
-            cursor_jump_next_search();
+            view_search_jump(tab_active_view(tab_active()));
         } break;
     }
     return 0;
@@ -1994,6 +2872,132 @@ int mode_change(enum Mode mode) {
     return 0;
 }
 
+// `Vec` of `struct KeyEvent` for each register from `a` to `z`
+static Vec MACROS[26] = {0};
+// register being recorded into, -1 when not recording
+static int MACRO_RECORDING = -1;
+// register replayed by the last `@`, used by `@@`
+static int MACRO_LAST_REPLAYED = -1;
+static size_t MACRO_REPLAY_DEPTH = 0;
+// macros calling themselves would otherwise never stop
+#define MACRO_REPLAY_MAX_DEPTH 64
+// set when a replayed key fails, every level of the replay stops then
+static _Bool MACRO_REPLAY_ABORT = 0;
+
+// Returns
+//  index of the register
+//  -1 if `reg` does not name a register
+static int macro_register_idx(utf32 reg) {
+    if(reg >= 'a' && reg <= 'z') return reg - 'a';
+    return -1;
+}
+
+int macro_recording(void) {
+    return MACRO_RECORDING >= 0;
+}
+
+int macro_record_start(utf32 reg) {
+    int idx = macro_register_idx(reg);
+    if(idx < 0) {
+        message_print("E: invalid register");
+        return -1;
+    }
+    if(MACROS[idx].type_size) {
+        vec_clear(&MACROS[idx]);
+    } else {
+        MACROS[idx] = VEC_NEW(struct KeyEvent, 0);
+    }
+    MACRO_RECORDING = idx;
+    return 0;
+}
+
+void macro_record_stop(void) {
+    if(MACRO_RECORDING < 0) return;
+    // the `q` that stopped the recording was recorded as well
+    vec_pop(&MACROS[MACRO_RECORDING], 0);
+    MACRO_RECORDING = -1;
+}
+
+// Replays the keys of a register `count` times, the whole replay is done as
+// a single batch so the screen and the search are only updated at the end
+int macro_replay(utf32 reg, size_t count) {
+    int idx = reg == '@' ? MACRO_LAST_REPLAYED : macro_register_idx(reg);
+    if(idx < 0) {
+        message_print("E: invalid register");
+        return -1;
+    }
+    if(!MACROS[idx].len) return 0;
+    if(MACRO_REPLAY_DEPTH >= MACRO_REPLAY_MAX_DEPTH) {
+        message_print("E: macro recursion too deep");
+        MACRO_REPLAY_ABORT = 1;
+        return -1;
+    }
+    MACRO_LAST_REPLAYED = idx;
+
+    // copy the keys, the register could be re-recorded during the replay
+    Vec keys = VEC_NEW(struct KeyEvent, 0);
+    vec_extend(&keys, MACROS[idx].buf, MACROS[idx].len);
+
+    MACRO_REPLAY_DEPTH += 1;
+    editor_batch_begin();
+    for(size_t n = 0; n < count && RUNNING && !MACRO_REPLAY_ABORT; n++) {
+        for(size_t i = 0; i < keys.len && RUNNING && !MACRO_REPLAY_ABORT; i++) {
+            struct KeyEvent e = *VEC_GET(struct KeyEvent, &keys, i);
+            if(mode_current().handle_key(&e) < 0) MACRO_REPLAY_ABORT = 1;
+        }
+    }
+    editor_batch_end();
+    MACRO_REPLAY_DEPTH -= 1;
+
+    vec_cleanup(&keys);
+    int ret = MACRO_REPLAY_ABORT ? -1 : 0;
+    // the outermost replay is the last one to stop
+    if(!MACRO_REPLAY_DEPTH) MACRO_REPLAY_ABORT = 0;
+    return ret;
+}
+
+static void macros_free(void) {
+    for(size_t i = 0; i < sizeof(MACROS) / sizeof(*MACROS); i++) {
+        vec_cleanup(&MACROS[i]);
+    }
+}
+
+int editor_handle_key(struct KeyEvent *e) {
+    if(MACRO_RECORDING >= 0) {
+        vec_push(&MACROS[MACRO_RECORDING], e);
+    }
+    return mode_current().handle_key(e);
+}
+
+void editor_batch_begin(void) {
+    BATCH_DEPTH += 1;
+}
+
+// searches the lines edited during a batch, once per buffer
+static void window_batch_flush(struct Window *w) {
+    for(; w; w = w->child) {
+        for(size_t i = 0; i < w->view_stack.len; i++) {
+            struct View *v = VEC_GET(struct View, &w->view_stack, i);
+            struct ReState *rs = &v->buff->re_state;
+            if(rs->refresh_pending) {
+                rs->refresh_pending = 0;
+                size_t added = rs->pending_end - rs->pending_start;
+                view_search_update(v, rs->pending_start, added - rs->pending_delta, added);
+            }
+        }
+    }
+}
+
+void editor_batch_end(void) {
+    assert(BATCH_DEPTH && "unbalanced batch");
+    BATCH_DEPTH -= 1;
+    if(BATCH_DEPTH) return;
+
+    for(size_t i = 0; i < TABS.len; i++) {
+        window_batch_flush(&tab_get(i)->w);
+    }
+}
+
 static size_t message_line_render_height(struct winsize *ws) {
     size_t msg_line_height = MESSAGE.buff->lines.len;
     for(size_t i = 0; i < MESSAGE.buff->lines.len; i++) {
@@ -2019,6 +3023,11 @@ int message_line_render(struct winsize *ws, struct AbsoluteCursor *ac) {
 }
 
 
+// Returns the number of matches starting at or before the cursor
+static size_t view_search_position(const struct View *v) {
+    return re_state_find(&v->buff->re_state, v->view_cursor.off_y, v->view_cursor.off_x + 1);
+}
+
 int active_line_render(struct winsize *ws) {
     struct View *v = tab_active_view(tab_active());
 
@@ -2033,17 +3042,35 @@ int active_line_render(struct winsize *ws) {
             ' ');
 
     set_cursor_pos(0, ws->ws_row - 1 - message_line_render_height(ws));
+    char recording[] = " @?";
+    if(MACRO_RECORDING >= 0) {
+        recording[2] = 'a' + MACRO_RECORDING;
+    }
+    // k/N, the matches up to the cursor out of all of them, with a + while
+    // the buffer is still being searched
+    char search_pos[48] = "";
+    if(re_state_active(&v->buff->re_state) && v->buff->re_state.matches.len) {
+        snprintf(
+                search_pos,
+                sizeof(search_pos),
+                " %zu/%zu%s",
+                view_search_position(v),
+                v->buff->re_state.matches.len,
+                view_search_done(v) ? "" : "+");
+    }
     style_fmt(
             &active_line_style,
             STDOUT_FILENO,
-            "[%s] (%ld, %ld) %ld/%ld %ld %s",
+            "[%s%s] (%ld, %ld) %ld/%ld %ld %s%s",
             mode_current().mode_str,
+            MACRO_RECORDING >= 0 ? recording : "",
             v->view_cursor.off_x + 1,
             v->view_cursor.off_y + 1,
             v->line_off + 1,
             v->buff->lines.len,
             v->first_line_char_off,
-            FILEMODE_REPR[v->buff->fm]
+            FILEMODE_REPR[v->buff->fm],
+            search_pos
             );
 
     return 0;
@@ -2051,6 +3078,8 @@ int active_line_render(struct winsize *ws) {
 
 int editor_render(struct winsize *ws) {
     if(!RUNNING) return 0;
+    // the screen is drawn once the batch is over
+    if(BATCH_DEPTH) return 0;
     write(STDOUT_FILENO, CUR_HIDE, sizeof(CUR_HIDE) -1);
     dprintf(STDOUT_FILENO, CSI"?2026h");
 
@@ -2295,20 +3324,157 @@ void editor_open(const char *path, enum FileMode fm, int no_confirm) {
     *active_view = new_view;
 }
 
-int clipboard_set(const char *s, size_t len) {
+// Parses the `path:line[:col]:` location at the start of `location`, the
+// line and column start at 1
+// Returns -1 if `location` is not a location
+static int location_parse(const char *location, size_t *path_len, size_t *line, size_t *col) {
+    const char *colon = strchr(location, ':');
+    if(!colon || colon == location) return -1;
+    char *end = 0;
+    *line = strtoul(colon + 1, &end, 10);
+    if(end == colon + 1 || *end != ':' || !*line) return -1;
+    // the column is optional
+    *col = 1;
+    if(end[1] >= '0' && end[1] <= '9') {
+        char *col_end = 0;
+        size_t n = strtoul(end + 1, &col_end, 10);
+        if(*col_end == ':' && n) *col = n;
+    }
+    *path_len = colon - location;
+    return 0;
+}
 
-    SpawnHandle handle = {0};
+int editor_open_location(const char *location) {
+    size_t path_len = 0;
+    size_t line = 0;
+    size_t col = 0;
+    if(location_parse(location, &path_len, &line, &col)) return -1;
+
+    // the results are shown below the window they were searched from
+    struct Tab *tab = tab_active();
+    if(tab->active_window) tab->active_window -= 1;
+
+    char *path = strndup(location, path_len);
+    struct View *v = tab_active_view(tab);
+    _Bool opened = v->buff->in.ty == INPUT_FILE
+        && !strcmp(str_as_cstr(&v->buff->in.u.file.path), path);
+    if(!opened) {
+        struct Buffer *before = v->buff;
+        editor_open(path, FM_RW, 0);
+        v = tab_active_view(tab);
+        opened = v->buff != before;
+    }
+    xfree(path);
 
-    int res = spawn_captured(CONFIG.copy_command, &handle);
-    if(res) return res;
+    if(opened) view_set_cursor(v, col - 1, line - 1);
+    return 0;
+}
+
+// A `path:line[:col]:` location in the output of a command
+struct Diagnostic {
+    // resolved by `realpath`, as is if the file does not exist
+    char *path;
+    // start at 1
+    size_t line;
+    size_t col;
+};
+
+static void diagnostic_free(struct Diagnostic *d) {
+    xfree(d->path);
+}
+
+// Returns the path resolved by `realpath`, `./a.c` and `a.c` are the same
+// file, to be freed
+static char *diagnostic_path(const char *path) {
+    char *resolved = realpath(path, 0);
+    return resolved ? resolved : strdup(path);
+}
+
+// Pushes the locations in the output of a command to `found`, a `Vec` of
+// `Diagnostic`
+static void diagnostics_parse(const struct Buffer *out, Vec *found) {
+    for(size_t i = 0; i < out->lines.len; i++) {
+        const struct Line *l = VEC_GET(struct Line, &out->lines, i);
+        const char *location = str_as_cstr(&l->text);
+        size_t path_len = 0;
+        struct Diagnostic d = {0};
+        if(location_parse(location, &path_len, &d.line, &d.col)) continue;
+        char *path = strndup(location, path_len);
+        d.path = diagnostic_path(path);
+        xfree(path);
+        vec_push(found, &d);
+    }
+}
+
+// Marks the diagnostics of the file of `buff`
+static void diagnostics_mark(struct Buffer *buff, const Vec *found, int id) {
+    char *path = diagnostic_path(str_as_cstr(&buff->in.u.file.path));
+    for(size_t i = 0; i < found->len; i++) {
+        const struct Diagnostic *d = VEC_GET(struct Diagnostic, found, i);
+        if(strcmp(d->path, path) || d->line > buff->lines.len) continue;
+
+        // the identifier at the column is marked, or a single character
+        const Str *text = &buffer_line_get(buff, d->line - 1)->text;
+        if(!str_len(text)) {
+            overlay_add(&buff->diagnostics, d->line - 1, 0, 1, id);
+            continue;
+        }
+        size_t col = d->col;
+        if(col - 1 >= str_len(text)) col = str_len(text);
+        const char *s = str_as_cstr(text) + str_get_char_byte_idx(text, col - 1);
+        size_t len = 0;
+        while(s[len] == '_' || (s[len] > 0 && isalnum(s[len]))) len++;
+        overlay_add(&buff->diagnostics, d->line - 1, col - 1, len ? len : 1, id);
+    }
+    xfree(path);
+}
+
+// Clears the diagnostics of every open buffer and marks the ones of `found`
+static void diagnostics_replace(const Vec *found) {
+    int id = style_find_id(DIAGNOSTIC_HIGHLIGHT);
+    // a buffer can be in several views
+    Vec seen = VEC_NEW(struct Buffer*, 0);
+    for(size_t t = 0; t < TABS.len; t++) {
+        for(struct Window *w = &tab_get(t)->w; w; w = w->child) {
+            for(size_t i = 0; i < w->view_stack.len; i++) {
+                struct Buffer *buff = (VEC_GET(struct View, &w->view_stack, i))->buff;
+                _Bool done = 0;
+                for(size_t j = 0; j < seen.len && !done; j++) {
+                    done = *VEC_GET(struct Buffer*, &seen, j) == buff;
+                }
+                if(done) continue;
+                vec_push(&seen, &buff);
+                overlay_clear(&buff->diagnostics);
+                if(id >= 0 && buff->in.ty == INPUT_FILE) diagnostics_mark(buff, found, id);
+            }
+        }
+    }
+    vec_cleanup(&seen);
+}
 
+size_t editor_diagnostics_set(const struct Buffer *out) {
+    Vec found = VEC_NEW(struct Diagnostic, (void(*)(void*))diagnostic_free);
+    diagnostics_parse(out, &found);
+    // the output of the other commands leaves the marks alone
+    size_t count = found.len;
+    if(count) diagnostics_replace(&found);
+    vec_cleanup(&found);
+    return count;
+}
 
-    write(handle.stdin_fd, s, len);
-    close(handle.stdin_fd);
+void editor_diagnostics_clear(void) {
+    Vec found = VEC_NEW(struct Diagnostic, 0);
+    diagnostics_replace(&found);
+    vec_cleanup(&found);
+}
 
+int clipboard_set(const char *s, size_t len) {
     Str output = str_new();
 
-    res = spawn_handle_wait_collect_output(&handle, &output);
+    // the selection is fed while the output is read, a copy command echoing
+    // its input cannot fill its pipe and wait on us forever
+    int res = exec_filter(CONFIG.copy_command, s, len, &output, &output);
+    if(res > 0) res = 0;
 
     if(res || !str_is_empty(&output)) {
         message_print("%.*s", str_cstr_len(&output), str_as_cstr(&output));
@@ -2321,12 +3487,8 @@ int clipboard_set(const char *s, size_t len) {
 }
 
 int clipboard_get(Str *s) {
-    SpawnHandle handle = {0};
-
-    int res = spawn_captured(CONFIG.paste_command, &handle);
-    if(res) return res;
-
-    res = spawn_handle_wait_collect_output(&handle, s);
+    int res = exec_filter(CONFIG.paste_command, 0, 0, s, s);
+    if(res > 0) res = 0;
 
     if(res && !str_is_empty(s)) {
         message_print("%.*s", str_cstr_len(s), str_as_cstr(s));
@@ -2355,139 +3517,369 @@ void editor_init(void) {
     style_register(
         SEARCH_HIGHLIGHT,
         sizeof(SEARCH_HIGHLIGHT) -1,
-        style_bg(style_new(), colour_vt(VT_BLU)),
-        1);
+        style_bg(style_new(), colour_vt(VT_BLU)));
+    style_register(
+        BRACKET_HIGHLIGHT,
+        sizeof(BRACKET_HIGHLIGHT) -1,
+        style_bg(style_new(), colour_vt(VT_CYA)));
+    style_register(
+        DIAGNOSTIC_HIGHLIGHT,
+        sizeof(DIAGNOSTIC_HIGHLIGHT) -1,
+        style_underline_color(style_underline(style_new(), UNDERLINE_SIMPLE), colour_vt(VT_RED)));
+    syntax_init();
 }
 
-void cursor_jump_prev_search(void) {
-    // TODO(louis) binary search
+void cursor_jump_prev_search(size_t count) {
     struct View *active_view = tab_active_view(tab_active());
-    if(!active_view->buff->re_state.matches.len) return;
-
-    struct ReMatch *match = 0;
-    size_t idx = active_view->buff->re_state.matches.len-1;
-
-    match = vec_get(&active_view->buff->re_state.matches, idx);
-    while(match->line > active_view->view_cursor.off_y
-            || (match->line == active_view->view_cursor.off_y
-                && match->col >= active_view->view_cursor.off_x)) {
-        if(idx == 0) {
-            match = vec_get(
-                    &active_view->buff->re_state.matches,
-                    active_view->buff->re_state.matches.len-1);
-            break;
-        }
-        idx--;
-        match = vec_get(&active_view->buff->re_state.matches, idx);
-    }
-
-    view_set_cursor(active_view, match->col, match->line);
+    struct ReState *rs = &active_view->buff->re_state;
+    size_t matches_len = rs->matches.len;
+    if(!matches_len) return;
+
+    // the last match before the cursor, wrapping around
+    size_t idx = re_state_find(rs, active_view->view_cursor.off_y, active_view->view_cursor.off_x);
+    idx = (idx + matches_len - 1) % matches_len;
+    // skip the extra matches in one jump
+    idx = (idx + matches_len - (count - 1) % matches_len) % matches_len;
+
+    struct ReMatch match = re_state_match(rs, idx);
+    view_set_cursor(active_view, match.col, match.line);
 }
 
-void cursor_jump_next_search(void) {
+void cursor_jump_next_search(size_t count) {
     struct View *active_view = tab_active_view(tab_active());
-    if(!active_view->buff->re_state.matches.len) return;
+    struct ReState *rs = &active_view->buff->re_state;
+    size_t matches_len = rs->matches.len;
+    if(!matches_len) return;
 
-    struct ReMatch *match = 0;
-    size_t idx = 0;
+    // the first match after the cursor, wrapping around
+    size_t idx = re_state_find(rs, active_view->view_cursor.off_y, active_view->view_cursor.off_x + 1);
+    // skip the extra matches in one jump
+    idx = (idx + count - 1) % matches_len;
 
-    match = vec_get(&active_view->buff->re_state.matches, idx);
-    while(match->line < active_view->view_cursor.off_y
-            || (match->line == active_view->view_cursor.off_y
-                && match->col <= active_view->view_cursor.off_x)) {
-        if(idx == active_view->buff->re_state.matches.len-1) {
-            match = vec_get(&active_view->buff->re_state.matches, 0);
-            break;
+    struct ReMatch match = re_state_match(rs, idx);
+    view_set_cursor(active_view, match.col, match.line);
+}
+
+// Pushes every occurrence of `pattern` in `text` to `out`
+static void search_line_literal(
+        const char *pattern,
+        const char *text,
+        size_t text_len,
+        size_t line_idx,
+        Vec *out) {
+
+    size_t pattern_len = strlen(pattern);
+    size_t pattern_chars = utf8_count_chars(pattern, pattern_len);
+    size_t off = 0;
+    size_t chars = 0;
+    while(off < text_len) {
+        ssize_t found = search_literal(text + off, text_len - off, pattern, pattern_len);
+        if(found < 0) break;
+        chars += utf8_count_chars(text + off, found);
+        struct ReMatch match = {
+            .line = line_idx,
+            .col = chars,
+            .len = pattern_chars,
+        };
+        vec_push(out, &match);
+        chars += pattern_chars;
+        off += found + pattern_len;
+    }
+}
+
+// Returns the offset of the character after the one at `off`
+static size_t next_char_off(const char *text, size_t len, size_t off) {
+    off++;
+    while(off < len && utf8_is_follow(text[off])) off++;
+    return off;
+}
+
+// Pushes every match of `regex` in `text` to `out`, REG_STARTEND resumes
+// the search after the previous match without copying the line
+static void search_line_regex(
+        regex_t *regex,
+        const char *text,
+        size_t text_len,
+        size_t line_idx,
+        Vec *out) {
+
+    // regexec works in bytes, `chars` counts the characters before `off`
+    size_t off = 0;
+    size_t chars = 0;
+    ssize_t last_end = -1;
+    while(off <= text_len) {
+        regmatch_t m = {
+            .rm_so = off,
+            .rm_eo = text_len,
+        };
+        int flags = REG_STARTEND | (off ? REG_NOTBOL : 0);
+        if(regexec(regex, text, 1, &m, flags)) break;
+        chars += utf8_count_chars(text + off, m.rm_so - off);
+        off = m.rm_so;
+
+        // an empty match right after a match is skipped
+        if(m.rm_so != m.rm_eo || m.rm_so != last_end) {
+            struct ReMatch match = {
+                .line = line_idx,
+                .col = chars,
+                .len = utf8_count_chars(text + m.rm_so, m.rm_eo - m.rm_so),
+            };
+            vec_push(out, &match);
+            last_end = m.rm_eo;
+            if(m.rm_so != m.rm_eo) {
+                chars += match.len;
+                off = m.rm_eo;
+                continue;
+            }
         }
-        idx = (idx + 1) % active_view->buff->re_state.matches.len;
-        match = vec_get(&active_view->buff->re_state.matches, idx);
+        if(off == text_len) break;
+        off = next_char_off(text, text_len, off);
+        chars += 1;
     }
-    if(active_view->view_cursor.off_x == match->col && active_view->view_cursor.off_y == match->line) {
-       match = vec_get(&active_view->buff->re_state.matches, 0);
+}
+
+// Searches the line `l`, its matches are pushed to `out`, only reads `l` so
+// lines can be searched concurrently
+// `rx` and `regex` are the copies of the pattern owned by the calling thread
+static void search_line(
+        const struct ReState *rs,
+        struct Rx *rx,
+        regex_t *regex,
+        const struct Line *l,
+        size_t line_idx,
+        Vec *out) {
+
+    const char *text = str_as_cstr(&l->text);
+    size_t text_bytes = str_cstr_len(&l->text);
+
+    if(rs->pattern->literal) {
+        search_line_literal(rs->pattern->source, text, text_bytes, line_idx, out);
+    } else if(rx) {
+        Vec found = VEC_NEW(struct RxMatch, 0);
+        rx_find_all(rx, text, text_bytes, &found);
+        for(size_t i = 0; i < found.len; i++) {
+            struct RxMatch *m = vec_get(&found, i);
+            struct ReMatch match = {
+                .line = line_idx,
+                .col = m->col,
+                .len = m->len,
+            };
+            vec_push(out, &match);
+        }
+        vec_cleanup(&found);
+    } else {
+        search_line_regex(regex, text, text_bytes, line_idx, out);
     }
+}
 
-    view_set_cursor(active_view, match->col, match->line);
+static void view_search_line(struct View *v, size_t line_idx, Vec *out) {
+    struct Pattern *p = v->buff->re_state.pattern;
+    search_line(
+            &v->buff->re_state,
+            pattern_rx(p, 0),
+            pattern_regex(p, 0),
+            buffer_line_get(v->buff, line_idx),
+            line_idx,
+            out);
 }
 
-void view_search_re(struct View *v) {
-    int ret;
-    size_t matches_size = 50;
-    regmatch_t *matches = xcalloc(matches_size, sizeof(regmatch_t));
+// lines searched by a single task of the parallel search
+#define SEARCH_CHUNK_LINES 4096
 
-    view_clear_highlight(v);
+struct SearchChunks {
+    struct Buffer *buff;
+    // lines to search
+    size_t start;
+    size_t end;
+    // `Vec` of `ReMatch` per chunk
+    Vec *results;
+};
 
-    Maybe(size_t) selected = None();
+static void search_chunk(void *data, size_t idx, size_t worker) {
+    struct SearchChunks *chunks = data;
+    struct Buffer *buff = chunks->buff;
+    size_t start = chunks->start + idx * SEARCH_CHUNK_LINES;
+    size_t end = start + SEARCH_CHUNK_LINES;
+    if(end > chunks->end) end = chunks->end;
+
+    struct ReState *rs = &buff->re_state;
+    struct Rx *rx = pattern_rx(rs->pattern, worker);
+    regex_t *regex = pattern_regex(rs->pattern, worker);
+    // `buffer_line_get` writes to the `Vec`, the tasks only read it
+    for(size_t i = start; i < end; i++) {
+        search_line(
+                rs,
+                rx,
+                regex,
+                VEC_GET(struct Line, &buff->lines, i),
+                i,
+                &chunks->results[idx]);
+    }
+}
 
-    for(size_t i = 0; i < v->buff->lines.len; i++) {
-        size_t line_idx = (i + v->buff->re_state.original_cursor.off_y) % v->buff->lines.len;
+// Searches the lines [start, end) of the view's buffer, their matches are
+// pushed to `out` in order
+// Big spans are split in chunks searched in parallel by the pool
+static void view_search_lines(struct View *v, size_t start, size_t end, Vec *out) {
+    struct ReState *rs = &v->buff->re_state;
+    size_t chunk_count = (end - start + SEARCH_CHUNK_LINES - 1) / SEARCH_CHUNK_LINES;
+    if(chunk_count < 2 || pattern_workers(rs->pattern, pool_size())) {
+        for(size_t i = start; i < end; i++) {
+            view_search_line(v, i, out);
+        }
+        return;
+    }
 
-        struct Line *l = buffer_line_get(v->buff, line_idx);
+    struct SearchChunks chunks = {
+        .buff = v->buff,
+        .start = start,
+        .end = end,
+        .results = xcalloc(chunk_count, sizeof(Vec)),
+    };
+    for(size_t i = 0; i < chunk_count; i++) {
+        chunks.results[i] = VEC_NEW(struct ReMatch, 0);
+    }
 
-        // TODO(louis) maybe use REG_STARTED
-        ret = regexec(v->buff->re_state.regex, str_as_cstr(&l->text), matches_size, matches, 0);
-        if(ret == REG_NOMATCH) continue;
+    pool_run(search_chunk, &chunks, chunk_count);
 
-        if(l->style_ids.len < str_len(&l->text)) {
-            size_t diff = str_len(&l->text) - l->style_ids.len;
+    // the chunks are in line order, so are their matches
+    for(size_t i = 0; i < chunk_count; i++) {
+        vec_extend(out, chunks.results[i].buf, chunks.results[i].len);
+        vec_cleanup(&chunks.results[i]);
+    }
+    xfree(chunks.results);
+}
 
-            char zero = 0;
-            for(size_t i = 0; i < diff; i++) {
-                vec_push(&l->style_ids, &zero);
-            }
-        }
+// Searches the whole buffer, the matches are kept sorted by position
+void view_search_re(struct View *v) {
+    struct ReState *rs = &v->buff->re_state;
+    re_state_clear_matches(rs);
+    view_search_lines(v, 0, v->buff->lines.len, &rs->matches);
+    rs->scan_start = 0;
+    rs->scan_end = v->buff->lines.len;
+}
 
-        for(size_t j = 0; j < matches_size; j++) {
-            // this api sucks so bad
-            if(matches[j].rm_eo == -1) {
-                break;
-            }
+// Returns 1 once the matches cover the whole buffer
+static int view_search_done(const struct View *v) {
+    const struct ReState *rs = &v->buff->re_state;
+    return rs->scan_start == 0 && rs->scan_end >= v->buff->lines.len;
+}
 
-            struct ReMatch match = {
-                .line = line_idx,
-                .col = matches[j].rm_so,
-                .len = matches[j].rm_eo - matches[j].rm_so,
-            };
+// Searches the lines on screen, `view_search_continue` searches the others
+static void view_search_visible(struct View *v) {
+    struct ReState *rs = &v->buff->re_state;
+    re_state_clear_matches(rs);
+    size_t start = v->line_off < v->buff->lines.len ? v->line_off : v->buff->lines.len;
+    // the wrapped lines make it an upper bound
+    size_t end = start + WS.ws_row;
+    if(end > v->buff->lines.len) end = v->buff->lines.len;
+    view_search_lines(v, start, end, &rs->matches);
+    rs->scan_start = start;
+    rs->scan_end = end;
+}
 
-            if(is_none(&selected)
-                    && match.line >= v->buff->re_state.original_cursor.off_y
-                    && match.col >= v->buff->re_state.original_cursor.off_x
-                    && v->buff->re_state.matches.len > 0) {
+// time spent searching per turn of the event loop
+#define SEARCH_SLICE_NS 8000000
 
-                set_some(&selected, v->buff->re_state.matches.len);
-            }
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-            // TODO(louis) add search highlight here
-            char search_hi_id = style_find_id(SEARCH_HIGHLIGHT);
-            memset(l->style_ids.buf + match.col, search_hi_id, match.len);
+// Searches the lines the matches do not cover yet for about
+// SEARCH_SLICE_NS, the ones below the searched lines first
+// Returns 1 if lines were searched
+static int view_search_continue(struct View *v) {
+    struct ReState *rs = &v->buff->re_state;
+    if(!re_state_active(rs) || view_search_done(v)) return 0;
 
-            vec_push(&v->buff->re_state.matches, &match);
+    size_t len = v->buff->lines.len;
+    size_t step = pool_size() * SEARCH_CHUNK_LINES;
+    uint64_t deadline = monotonic_ns() + SEARCH_SLICE_NS;
+    do {
+        if(rs->scan_end < len) {
+            size_t end = len - rs->scan_end > step ? rs->scan_end + step : len;
+            // the new matches must not be part of a pending shift
+            re_state_shift(rs, rs->matches.len, 0);
+            view_search_lines(v, rs->scan_end, end, &rs->matches);
+            rs->scan_end = end;
+        } else {
+            size_t top = rs->scan_start - rs->above_lines;
+            size_t start = top > step ? top - step : 0;
+            Vec found = VEC_NEW(struct ReMatch, 0);
+            view_search_lines(v, start, top, &found);
+            for(size_t i = found.len; i--;) {
+                vec_push(&rs->above, vec_get(&found, i));
+            }
+            vec_cleanup(&found);
+            rs->above_lines = rs->scan_start - start;
+            if(start) continue;
+
+            // every match is after the new lines, they are moved once
+            struct ReMatch *above = rs->above.buf;
+            for(size_t i = 0; i < rs->above.len / 2; i++) {
+                struct ReMatch tmp = above[i];
+                above[i] = above[rs->above.len - 1 - i];
+                above[rs->above.len - 1 - i] = tmp;
+            }
+            re_state_replace(rs, 0, 0, rs->above.buf, rs->above.len);
+            vec_clear(&rs->above);
+            rs->above_lines = 0;
+            rs->scan_start = 0;
         }
-    }
-    free(matches);
+    } while(!view_search_done(v) && monotonic_ns() < deadline);
+    return 1;
+}
+
+// Moves the cursor to the first match after the one it had when the search
+// started, it is moved again as more matches are found until there is one
+// after it
+static void view_search_jump(struct View *v) {
+    struct ReState *rs = &v->buff->re_state;
+    v->view_cursor = rs->original_cursor;
+    cursor_jump_next_search(1);
+    struct ViewCursor *c = &v->view_cursor;
+    struct ViewCursor *o = &rs->original_cursor;
+    _Bool after = c->off_y > o->off_y || (c->off_y == o->off_y && c->off_x > o->off_x);
+    rs->jump_pending = !after && !view_search_done(v);
+}
+
+int editor_search_poll(void) {
+    if(!RUNNING || !TABS.len) return 0;
+    struct View *v = tab_active_view(tab_active());
+    if(!view_search_continue(v)) return 0;
+    if(MODE == M_Search && v->buff->re_state.jump_pending) view_search_jump(v);
+    return 1;
+}
+
+int editor_syntax_poll(void) {
+    if(!RUNNING || !TABS.len) return 0;
+    return syntax_continue(tab_active_view(tab_active())->buff);
 }
 
 void editor_search(const char *re_str) {
     struct View *active_view = tab_active_view(tab_active());
-    int ret;
+    struct ReState *rs = &active_view->buff->re_state;
 
-    re_state_reset(&active_view->buff->re_state);
-    // Extended regexes break when a partial ( is present
-    ret = regcomp(active_view->buff->re_state.regex, re_str, 0);
-
-    if(ret) {
-        active_view->buff->re_state.error_str = xcalloc(128, sizeof(char));
-        regerror(
-            ret,
-            active_view->buff->re_state.regex,
-            active_view->buff->re_state.error_str,
-            127);
-        return;
-    }
+    // the pattern is only compiled the first time it is searched for
+    re_state_reset(rs);
+    rs->pattern = pattern_get(re_str, 0);
+    if(rs->pattern->error) return;
 
-    view_search_re(active_view);
+    // the lines on screen first, the rest of a big buffer is searched from
+    // the event loop
+    view_search_visible(active_view);
+    view_search_continue(active_view);
 }
 
 void editor_teardown(void) {
+    grep_cancel();
+    pattern_cache_clear();
+    syntax_teardown();
+    row_layers_free();
+    pool_shutdown();
+    macros_free();
     vec_cleanup(&TABS);
     view_free(&MESSAGE);
     style_entry_table_free();
@@ -2503,6 +3895,284 @@ TEST_DEF(test_hello)
     TEST_ASSERT(1);
 TEST_ENDDEF
 
+TEST_DEF(test_view_search_update)
+    struct Buffer buff = buffer_new();
+    char *text[] = {"foo", "  bar", "foo bar", "baz"};
+    for(size_t i = 0; i < 4; i++) {
+        struct Line l = line_from_cstr(text[i]);
+        vec_push(&buff.lines, &l);
+    }
+    struct View v = view_new(&buff);
+    re_state_reset(&buff.re_state);
+    buff.re_state.pattern = pattern_get("foo", 0);
+    view_search_re(&v);
+    TEST_ASSERT(buff.re_state.matches.len == 2);
+
+    // a new line with a match before the second one
+    view_set_cursor(&v, 3, 0);
+    view_write(&v, "\nfoo", 4);
+    TEST_ASSERT(buff.re_state.matches.len == 3);
+    TEST_ASSERT(re_state_match(&buff.re_state, 1).line == 1);
+    TEST_ASSERT(re_state_match(&buff.re_state, 2).line == 3);
+
+    view_delete_lines(&v, 0, 2);
+    TEST_ASSERT(buff.re_state.matches.len == 1);
+    TEST_ASSERT(re_state_match(&buff.re_state, 0).line == 1);
+    // the cursor is on the text of the next line, or the last one
+    TEST_ASSERT(v.view_cursor.off_x == 2 && v.view_cursor.off_y == 0);
+    view_delete_lines(&v, 2, 5);
+    TEST_ASSERT(buff.lines.len == 2);
+    TEST_ASSERT(v.view_cursor.off_x == 0 && v.view_cursor.off_y == 1);
+
+    re_state_reset(&buff.re_state);
+    vec_cleanup(&buff.lines);
+    vec_cleanup(&buff.re_state.matches);
+TEST_ENDDEF
+
+TEST_DEF(test_re_state_shift)
+    struct ReState rs = {0};
+    re_state_reset(&rs);
+    for(size_t i = 0; i < 6; i++) {
+        struct ReMatch match = {.line = i, .col = 2, .len = 1};
+        vec_push(&rs.matches, &match);
+    }
+
+    // two lines added above the fourth match, one removed above the second
+    re_state_shift(&rs, 3, 2);
+    re_state_shift(&rs, 1, -1);
+    size_t lines[] = {0, 0, 1, 4, 5, 6};
+    for(size_t i = 0; i < 6; i++) {
+        TEST_ASSERT(re_state_match(&rs, i).line == lines[i]);
+    }
+    TEST_ASSERT(re_state_find(&rs, 4, 0) == 3);
+    TEST_ASSERT(re_state_find(&rs, 4, 3) == 4);
+    TEST_ASSERT(re_state_find(&rs, 2, 0) == 3);
+
+    // the pending shift follows the replaced matches
+    struct ReMatch fresh[] = {{.line = 1, .col = 0, .len = 1}, {.line = 1, .col = 5, .len = 1}};
+    re_state_replace(&rs, 2, 3, fresh, 2);
+    TEST_ASSERT(rs.matches.len == 7);
+    TEST_ASSERT(re_state_match(&rs, 3).line == 1);
+    TEST_ASSERT(re_state_match(&rs, 4).line == 4);
+    TEST_ASSERT(re_state_match(&rs, 6).line == 6);
+
+    vec_cleanup(&rs.matches);
+TEST_ENDDEF
+
+TEST_DEF(test_view_search_lazy)
+    struct Buffer buff = buffer_new();
+    for(size_t i = 0; i < 6; i++) {
+        struct Line l = line_from_cstr("foo");
+        vec_push(&buff.lines, &l);
+    }
+    struct View v = view_new(&buff);
+    struct ReState *rs = &buff.re_state;
+    re_state_reset(rs);
+    rs->pattern = pattern_get("foo", 0);
+
+    unsigned short rows = WS.ws_row;
+    WS.ws_row = 2;
+    v.line_off = 2;
+    view_search_visible(&v);
+    WS.ws_row = rows;
+    TEST_ASSERT(rs->matches.len == 2);
+    TEST_ASSERT(!view_search_done(&v));
+
+    // an edit above the searched lines moves them
+    view_set_cursor(&v, 0, 0);
+    view_write(&v, "foo\n", 4);
+    TEST_ASSERT(rs->scan_start == 3 && rs->scan_end == 5);
+    TEST_ASSERT(re_state_match(rs, 0).line == 3);
+
+    TEST_ASSERT(view_search_continue(&v));
+    TEST_ASSERT(view_search_done(&v));
+    TEST_ASSERT(rs->matches.len == 7);
+    for(size_t i = 0; i < 7; i++) {
+        TEST_ASSERT(re_state_match(rs, i).line == i);
+    }
+
+    // the slices of the upward scan keep their order
+    for(size_t i = 0; i < 3 * SEARCH_CHUNK_LINES; i++) {
+        struct Line l = line_from_cstr("foo");
+        vec_push(&buff.lines, &l);
+    }
+    v.line_off = buff.lines.len - 2;
+    view_search_visible(&v);
+    while(view_search_continue(&v));
+    TEST_ASSERT(rs->matches.len == buff.lines.len && !rs->above.len);
+    for(size_t i = 0; i < buff.lines.len; i++) {
+        TEST_ASSERT(re_state_match(rs, i).line == i);
+    }
+
+    re_state_reset(rs);
+    vec_cleanup(&buff.lines);
+    vec_cleanup(&rs->matches);
+    vec_cleanup(&rs->above);
+TEST_ENDDEF
+
+TEST_DEF(test_search_line_columns)
+    struct Buffer buff = buffer_new();
+    struct Line l = line_from_cstr("\xc3\xa9t\xc3\xa9 foo fooo");
+    vec_push(&buff.lines, &l);
+    struct View v = view_new(&buff);
+    struct ReState *rs = &buff.re_state;
+
+    // columns are in characters with all three engines
+    const char *patterns[] = {"foo", "fo*", "f\\w*"};
+    for(size_t i = 0; i < 3; i++) {
+        re_state_reset(rs);
+        rs->pattern = pattern_get(patterns[i], 0);
+        TEST_ASSERT(rs->pattern->literal == (i == 0));
+        TEST_ASSERT(!rs->pattern->prog == (i != 1));
+        view_search_re(&v);
+        struct ReMatch *match = vec_get(&rs->matches, 0);
+        TEST_ASSERT(match->col == 4);
+        TEST_ASSERT(match->len == 3);
+        // every match of the line is found
+        TEST_ASSERT(rs->matches.len == 2);
+        TEST_ASSERT((VEC_GET(struct ReMatch, &rs->matches, 1))->col == 8);
+        TEST_ASSERT((VEC_GET(struct ReMatch, &rs->matches, 1))->len == (i ? 4 : 3));
+    }
+
+    view_set_cursor(&v, 0, 0);
+    TEST_ASSERT(view_search_position(&v) == 0);
+    view_set_cursor(&v, 4, 0);
+    TEST_ASSERT(view_search_position(&v) == 1);
+    view_set_cursor(&v, 9, 0);
+    TEST_ASSERT(view_search_position(&v) == 2);
+
+    // empty matches advance one character at a time
+    re_state_reset(rs);
+    rs->pattern = pattern_get("\\(o\\)*", 0);
+    view_search_re(&v);
+    TEST_ASSERT(rs->matches.len == 8);
+
+    re_state_reset(rs);
+    vec_cleanup(&buff.lines);
+    vec_cleanup(&rs->matches);
+TEST_ENDDEF
+
+TEST_DEF(test_view_substitute)
+    struct Buffer buff = buffer_new();
+    char *text[] = {"foo bar foo", "baz", "\xc3\xa9" "foo"};
+    for(size_t i = 0; i < 3; i++) {
+        struct Line l = line_from_cstr(text[i]);
+        vec_push(&buff.lines, &l);
+    }
+    struct View v = view_new(&buff);
+    struct ReState *rs = &buff.re_state;
+    re_state_reset(rs);
+    rs->pattern = pattern_get("foo", 0);
+    view_search_re(&v);
+    TEST_ASSERT(rs->matches.len == 3);
+
+    TEST_ASSERT(view_substitute(&v, 0, 2, "\\(f\\)o*", "[\\1&]", 1) == 3);
+    TEST_ASSERT(!strcmp(str_as_cstr(&buffer_line_get(&buff, 0)->text), "[ffoo] bar [ffoo]"));
+    TEST_ASSERT(!strcmp(str_as_cstr(&buffer_line_get(&buff, 1)->text), "baz"));
+    TEST_ASSERT(!strcmp(str_as_cstr(&buffer_line_get(&buff, 2)->text), "\xc3\xa9[ffoo]"));
+    TEST_ASSERT(buffer_line_get(&buff, 0)->render_width == 17);
+    // the search follows the new text
+    TEST_ASSERT(rs->matches.len == 3);
+    TEST_ASSERT(re_state_match(rs, 1).col == 13);
+    TEST_ASSERT(re_state_match(rs, 2).col == 3);
+
+    // only the first match without `global`
+    TEST_ASSERT(view_substitute(&v, 0, 0, "o", "x\\&", 0) == 1);
+    TEST_ASSERT(!strcmp(str_as_cstr(&buffer_line_get(&buff, 0)->text), "[ffx&o] bar [ffoo]"));
+    TEST_ASSERT(view_substitute(&v, 1, 1, "foo", "x", 1) == 0);
+
+    // empty matches
+    TEST_ASSERT(view_substitute(&v, 1, 1, "q*", "-", 1) == 4);
+    TEST_ASSERT(!strcmp(str_as_cstr(&buffer_line_get(&buff, 1)->text), "-b-a-z-"));
+
+    re_state_reset(rs);
+    vec_cleanup(&buff.lines);
+    vec_cleanup(&rs->matches);
+TEST_ENDDEF
+
+TEST_DEF(test_macro_recursive)
+    editor_init();
+    // `a` replays itself twice, every level stops once one is too deep
+    const char *recorded = "2@a";
+    MACROS[0] = VEC_NEW(struct KeyEvent, 0);
+    for(size_t i = 0; i < 3; i++) {
+        struct KeyEvent e = {.key = recorded[i]};
+        vec_push(&MACROS[0], &e);
+    }
+    TEST_ASSERT(macro_replay('a', 2) == -1);
+    TEST_ASSERT(!MACRO_REPLAY_DEPTH && !MACRO_REPLAY_ABORT);
+
+    // the next replay is not stopped
+    vec_clear(&MACROS[0]);
+    struct KeyEvent e = {.key = 'j'};
+    vec_push(&MACROS[0], &e);
+    TEST_ASSERT(macro_replay('a', 1) == 0);
+    editor_teardown();
+TEST_ENDDEF
+
+TEST_DEF(test_diagnostics_parse)
+    struct Buffer buff = buffer_new();
+    char *text[] = {
+        "src/editor.c:3:5: error: x",
+        "make: *** [Makefile:69: build/a.o] Error 1",
+        "./src/editor.c:12: warning: y",
+        "missing.c:0:1: z",
+        "missing.c:7:",
+    };
+    for(size_t i = 0; i < 5; i++) {
+        struct Line l = line_from_cstr(text[i]);
+        vec_push(&buff.lines, &l);
+    }
+    Vec found = VEC_NEW(struct Diagnostic, (void(*)(void*))diagnostic_free);
+    diagnostics_parse(&buff, &found);
+    TEST_ASSERT(found.len == 3);
+
+    // both spellings of the path are the same file
+    char *path = realpath("src/editor.c", 0);
+    const struct Diagnostic *d = VEC_GET(struct Diagnostic, &found, 0);
+    TEST_ASSERT(!strcmp(d->path, path) && d->line == 3 && d->col == 5);
+    d = VEC_GET(struct Diagnostic, &found, 1);
+    TEST_ASSERT(!strcmp(d->path, path) && d->line == 12 && d->col == 1);
+    // the files that do not exist are kept as is
+    d = VEC_GET(struct Diagnostic, &found, 2);
+    TEST_ASSERT(!strcmp(d->path, "missing.c") && d->line == 7);
+    free(path);
+
+    vec_cleanup(&found);
+    vec_cleanup(&buff.lines);
+TEST_ENDDEF
+
+TEST_DEF(test_diagnostics_mark)
+    const char *lines[] = {"int x;", ""};
+    struct Buffer buff = buffer_test_new(lines, 2, 0);
+    // the lines of a file have no text when they are empty
+    line_free(buffer_line_get(&buff, 1));
+    *buffer_line_get(&buff, 1) = line_new();
+    buff.in.ty = INPUT_FILE;
+    buff.in.u.file.path = str_from_cstr("./src/editor.c");
+
+    Vec found = VEC_NEW(struct Diagnostic, (void(*)(void*))diagnostic_free);
+    struct Diagnostic d = {.path = realpath("src/editor.c", 0), .line = 1, .col = 5};
+    vec_push(&found, &d);
+    d = (struct Diagnostic) {.path = realpath("src/editor.c", 0), .line = 2, .col = 3};
+    vec_push(&found, &d);
+    diagnostics_mark(&buff, &found, 1);
+
+    // the identifier at the column, a single column on an empty line
+    const Vec *spans = &buff.diagnostics.spans;
+    TEST_ASSERT(spans->len == 2);
+    const struct OverlaySpan *span = VEC_GET(struct OverlaySpan, spans, 0);
+    TEST_ASSERT(span->line == 0 && span->col == 4 && span->len == 1);
+    span = VEC_GET(struct OverlaySpan, spans, 1);
+    TEST_ASSERT(span->line == 1 && span->col == 0 && span->len == 1);
+
+    overlay_clear(&buff.diagnostics);
+    vec_cleanup(&buff.diagnostics.spans);
+    str_free(&buff.in.u.file.path);
+    vec_cleanup(&found);
+    vec_cleanup(&buff.lines);
+TEST_ENDDEF
+
 TESTS_END
 
 #endif
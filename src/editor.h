@@ -159,6 +159,34 @@ void view_set_cursor(struct View *v, size_t x, size_t y);
 
 int view_write(struct View *v, const char *restrict s, size_t len);
 
+void view_search_update(struct View *v, size_t start, size_t removed, size_t added);
+
+void view_lines_update(struct View *v, size_t start, size_t removed, size_t added);
+
+// Removes the lines [start, start+count), the cursor goes to the first
+// character that is not blank of the line after them
+void view_delete_lines(struct View *v, size_t start, size_t count);
+
+void view_delete_chars(struct View *v, size_t count);
+
+void view_replace_lines(struct View *v, size_t start, size_t count, const char *s, size_t len);
+
+// Reindents the lines [start, end] in a single pass, each line is rewritten
+// in place and the highlighting is updated once
+void view_reindent(struct View *v, size_t start, size_t end);
+
+// Replaces the matches of the basic regex `pattern` in the lines [start, end]
+// with `repl`, where & and \0 stand for the match and \1 to \9 for its
+// groups, only the first match of a line is replaced unless `global` is set
+// Returns the number of replaced matches or -1 if the pattern is invalid
+int view_substitute(
+        struct View *v,
+        size_t start,
+        size_t end,
+        const char *pattern,
+        const char *repl,
+        int global);
+
 void view_search_re(struct View *v);
 
 int view_selection_position_selected(const struct ViewSelection *vs, size_t line_idx, size_t char_off);
@@ -183,6 +211,29 @@ struct View* tab_active_view(struct Tab *tab);
 
 void editor_init(void);
 
+// dispatches a key to the current mode, recording it if a macro is being
+// recorded
+int editor_handle_key(struct KeyEvent *e);
+
+// Edits done between `editor_batch_begin` and `editor_batch_end` do not
+// redraw the screen nor rerun the search, both are done once at the end.
+// Batches can be nested.
+void editor_batch_begin(void);
+
+void editor_batch_end(void);
+
+int macro_recording(void);
+
+// Returns
+//  0 on success
+//  -1 if `reg` is not a valid register
+int macro_record_start(utf32 reg);
+
+void macro_record_stop(void);
+
+// `reg` can be `@` to replay the last replayed register
+int macro_replay(utf32 reg, size_t count);
+
 int editor_render(struct winsize *ws);
 
 void editor_teardown(void);
@@ -199,6 +250,20 @@ void editor_quit(int no_confirm);
 
 void editor_open(const char *path, enum FileMode fm, int no_confirm);
 
+// Opens the `path:line[:col]:` location at the start of `location` (a line
+// of `:grep` or `grep -n`) in the window above the active one
+// Returns -1 if `location` is not a location
+int editor_open_location(const char *location);
+
+// Marks the `path:line[:col]:` locations in the output of a command (ie: the
+// errors of a compiler) in the open files, replacing the previous ones if
+// there are any
+// Returns the number of locations found
+size_t editor_diagnostics_set(const struct Buffer *out);
+
+// Removes the marks of `editor_diagnostics_set`
+void editor_diagnostics_clear(void);
+
 void editor_tabnew(const char *path, enum FileMode fm);
 
 void editor_split_open(const char *path, enum FileMode fm, enum SplitDir split);
@@ -209,11 +274,22 @@ int clipboard_set(const char *s, size_t len);
 
 int clipboard_get(Str *s);
 
-void cursor_jump_prev_search(void);
+// `count` is the number of matches to jump over
+void cursor_jump_prev_search(size_t count);
 
-void cursor_jump_next_search(void);
+void cursor_jump_next_search(size_t count);
 
 void editor_search(const char *re_str);
 
+// Searches the next slice of the lines the active search has not covered
+// yet, called from the event loop
+// Returns 1 if lines were searched
+int editor_search_poll(void);
+
+// Highlights the next slice of the lines of the active buffer that are not
+// highlighted yet, called from the event loop
+// Returns 1 if lines were highlighted
+int editor_syntax_poll(void);
+
 
 #endif
@@ -1,3 +1,6 @@
+// for pipe2
+#define _GNU_SOURCE
+
 #include "exec.h"
 #include "str.h"
 #include "xalloc.h"
@@ -7,6 +10,9 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <spawn.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/wait.h>
 
 // access this process' env
@@ -18,47 +24,116 @@ void spawn_handle_free(SpawnHandle *handle) {
     close(handle->stderr_fd);
 }
 
-int spawn_handle_wait_collect_output(SpawnHandle *handle, Str *out) {
-    #define BUFFER_SIZE 128
-    char buffer[BUFFER_SIZE];
-    int stact_lock = 0;
-    int ret;
-
-    close(handle->stdin_fd);
-    handle->stdin_fd = -1;
-
-    int fds_len = 2;
-    struct pollfd fds[2] = {0};
-    // put stderr first in the list to collect its output first
-    fds[0].fd = handle->stderr_fd;
-    fds[0].events = POLLIN;
-
-    fds[1].fd = handle->stdout_fd;
-    fds[1].events = POLLIN;
-
-    do {
-        ret = poll(fds, fds_len, 10);
-        while(ret > 0) {
-            for(int i = 0; i < fds_len; i++) {
-                if(fds[i].revents & POLLIN) {
-                    ret = read(fds[i].fd, buffer, BUFFER_SIZE);
-                    if(ret < 0) return -1;
-                    str_push(out, buffer, ret);
-                } else if(fds[i].revents & POLLNVAL) {
-                    return -1;
-                } else if(fds[i].revents & POLLHUP) {
-                    // WARN(louis) this code assumes there are only 2 fds
-                    if(i == 0) {
-                        fds[0] = fds[1];
-                        i = -1;
-                    }
-                    fds_len -= 1;
-                }
+// size of the reads and of the pipes used by `spawn_handle_pump`
+#define PUMP_BUFFER_SIZE (1024 * 1024)
+
+static int fd_set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if(flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int spawn_handle_pump(
+        SpawnHandle *handle,
+        const char *in,
+        size_t in_len,
+        Str *out,
+        Str *err) {
+
+    char *buffer = xmalloc(PUMP_BUFFER_SIZE);
+    size_t written = 0;
+    int status = 0;
+    int ret = 0;
+
+    if(!in_len) {
+        close(handle->stdin_fd);
+        handle->stdin_fd = -1;
+    }
+
+    int *fds[3] = {&handle->stdin_fd, &handle->stdout_fd, &handle->stderr_fd};
+    for(size_t i = 0; i < 3; i++) {
+        if(*fds[i] < 0) continue;
+        fd_set_nonblocking(*fds[i]);
+#ifdef F_SETPIPE_SZ
+        // bigger pipes means less round trips through poll, the kernel
+        // caps the size for unprivileged users, failing is fine
+        fcntl(*fds[i], F_SETPIPE_SZ, PUMP_BUFFER_SIZE);
+#endif
+    }
+
+    // stdout and stderr get closed by `spawn_handle_free`, only stop
+    // polling them once they reach EOF
+    _Bool out_open = 1;
+    _Bool err_open = 1;
+
+    while(handle->stdin_fd >= 0 || out_open || err_open) {
+        struct pollfd fds[3] = {0};
+        // put stderr first in the list to collect its output first
+        fds[0].fd = err_open ? handle->stderr_fd : -1;
+        fds[0].events = POLLIN;
+        fds[1].fd = out_open ? handle->stdout_fd : -1;
+        fds[1].events = POLLIN;
+        fds[2].fd = handle->stdin_fd;
+        fds[2].events = POLLOUT;
+
+        if(poll(fds, 3, -1) < 0) {
+            if(errno == EINTR) continue;
+            ret = -1;
+            break;
+        }
+
+        for(size_t i = 0; i < 2; i++) {
+            if(!fds[i].revents) continue;
+            ssize_t count = read(fds[i].fd, buffer, PUMP_BUFFER_SIZE);
+            if(count > 0) {
+                str_push(i == 0 ? err : out, buffer, count);
+            } else if(count == 0 || (errno != EINTR && errno != EAGAIN)) {
+                if(i == 0) err_open = 0;
+                else out_open = 0;
             }
-            ret = poll(fds, fds_len, 10);
         }
-    } while(!waitpid(handle->pid, &stact_lock, WNOHANG));
-    return 0;
+
+        if(fds[2].revents) {
+            ssize_t count = write(handle->stdin_fd, in + written, in_len - written);
+            if(count > 0) written += count;
+            // EPIPE: the command does not want the rest of its input
+            if(written == in_len || (count < 0 && errno != EINTR && errno != EAGAIN)) {
+                close(handle->stdin_fd);
+                handle->stdin_fd = -1;
+            }
+        }
+    }
+    xfree(buffer);
+
+    while(waitpid(handle->pid, &status, 0) < 0) {
+        if(errno != EINTR) return -1;
+    }
+    return ret ? ret : status;
+}
+
+int spawn_handle_wait_collect_output(SpawnHandle *handle, Str *out) {
+    return spawn_handle_pump(handle, 0, 0, out, out) < 0 ? -1 : 0;
+}
+
+// pid of the running filter, 0 when there is none
+static volatile sig_atomic_t FILTER_PID = 0;
+
+int exec_filter(const char *command, const char *in, size_t in_len, Str *out, Str *err) {
+    SpawnHandle handle = {0};
+    if(spawn_captured(command, &handle)) return -1;
+    FILTER_PID = handle.pid;
+    int status = spawn_handle_pump(&handle, in, in_len, out, err);
+    FILTER_PID = 0;
+    spawn_handle_free(&handle);
+    return status;
+}
+
+int exec_filter_cancel(void) {
+    pid_t pid = FILTER_PID;
+    if(!pid) return 0;
+    // the filter leads its own process group, kill the whole group
+    kill(-pid, SIGTERM);
+    return 1;
 }
 
 int spawn_captured(const char *command, SpawnHandle *spawn_handle) {
@@ -84,7 +159,9 @@ int spawn_captured(const char *command, SpawnHandle *spawn_handle) {
     char *null = NULL;
     vec_push(&args, &null);
 
-    if(pipe(pipdes)) {
+    // the pipes are close on exec so that other children do not inherit
+    // them, dup2 in the child clears the flag on its std fds
+    if(pipe2(pipdes, O_CLOEXEC)) {
         xfree(command_buffer);
         return -1;
     }
@@ -92,7 +169,7 @@ int spawn_captured(const char *command, SpawnHandle *spawn_handle) {
     int stdin_out = pipdes[0];
     int stdin_in = pipdes[1];
 
-    if(pipe(pipdes)) {
+    if(pipe2(pipdes, O_CLOEXEC)) {
         close(stdin_out);
         close(stdin_in);
         return -1;
@@ -101,7 +178,7 @@ int spawn_captured(const char *command, SpawnHandle *spawn_handle) {
     int stdout_out = pipdes[0];
     int stdout_in = pipdes[1];
 
-    if(pipe(pipdes)) {
+    if(pipe2(pipdes, O_CLOEXEC)) {
         close(stdin_out);
         close(stdin_in);
         close(stdout_out);
@@ -135,6 +212,15 @@ int spawn_captured(const char *command, SpawnHandle *spawn_handle) {
 
     posix_spawnattr_t attrp;
     posix_spawnattr_init(&attrp);
+    // put the child in its own process group, <C-c> in the terminal should
+    // only reach the editor which then decides what to kill
+    // the editor ignores SIGPIPE, give the default behaviour back to the child
+    sigset_t default_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attrp, &default_signals);
+    posix_spawnattr_setflags(&attrp, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attrp, 0);
 
     int res = posix_spawnp(
             &child_pid,
@@ -162,3 +248,143 @@ int spawn_captured(const char *command, SpawnHandle *spawn_handle) {
     spawn_handle->stderr_fd = stderr_out;
     return 0;
 }
+
+// size of a single read from a job
+#define JOB_READ_SIZE (64 * 1024)
+// upper bound of what is read from a single job per call to `exec_jobs_poll`
+// so that a chatty job does not starve the input
+#define JOB_READ_BUDGET (4 * 1024 * 1024)
+
+typedef struct {
+    SpawnHandle handle;
+    job_output_fn *on_output;
+    job_exit_fn *on_exit;
+    void *data;
+    int flags;
+} ExecJob;
+
+// `Vec` of `ExecJob*`
+static Vec JOBS = VEC_NEW(ExecJob*, 0);
+static volatile sig_atomic_t JOBS_RUNNING = 0;
+
+int exec_job_spawn(
+        const char *command,
+        int flags,
+        job_output_fn *on_output,
+        job_exit_fn *on_exit,
+        void *data) {
+
+    SpawnHandle handle = {0};
+    int res = spawn_captured(command, &handle);
+    if(res) return res;
+
+    // the job does not get any input
+    close(handle.stdin_fd);
+    handle.stdin_fd = -1;
+
+    fd_set_nonblocking(handle.stdout_fd);
+    fd_set_nonblocking(handle.stderr_fd);
+
+    ExecJob *job = xcalloc(1, sizeof(ExecJob));
+    *job = (ExecJob) {
+        .handle = handle,
+        .on_output = on_output,
+        .on_exit = on_exit,
+        .data = data,
+        .flags = flags,
+    };
+    vec_push(&JOBS, &job);
+    JOBS_RUNNING = JOBS.len;
+    return 0;
+}
+
+// Reads what is available on `*fd`, closes it and sets it to -1 on EOF
+// Returns the number of bytes read
+static size_t job_drain_fd(ExecJob *job, int *fd, char *buffer) {
+    size_t total = 0;
+    while(*fd >= 0 && total < JOB_READ_BUDGET) {
+        ssize_t ret = read(*fd, buffer, JOB_READ_SIZE);
+        if(ret > 0) {
+            if(job->on_output) job->on_output(job->data, buffer, ret);
+            total += ret;
+        } else if(ret < 0 && errno == EINTR) {
+            continue;
+        } else if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            // EOF or a real error, either way nothing more will come out of it
+            close(*fd);
+            *fd = -1;
+        }
+    }
+    return total;
+}
+
+static void job_finish(ExecJob *job, int status) {
+    if(job->handle.stdout_fd >= 0) close(job->handle.stdout_fd);
+    if(job->handle.stderr_fd >= 0) close(job->handle.stderr_fd);
+    if(job->on_exit) job->on_exit(job->data, status);
+    xfree(job);
+}
+
+int exec_jobs_poll(void) {
+    if(!JOBS.len) return 0;
+
+    int activity = 0;
+    char *buffer = xmalloc(JOB_READ_SIZE);
+
+    size_t i = 0;
+    while(i < JOBS.len) {
+        ExecJob *job = *VEC_GET(ExecJob*, &JOBS, i);
+
+        // collect stderr first, the same way the blocking version does
+        if(job_drain_fd(job, &job->handle.stderr_fd, buffer)) activity = 1;
+        if(job_drain_fd(job, &job->handle.stdout_fd, buffer)) activity = 1;
+
+        // only reap the job once its output was fully read
+        int status = 0;
+        if(job->handle.stdout_fd < 0
+                && job->handle.stderr_fd < 0
+                && waitpid(job->handle.pid, &status, WNOHANG) == job->handle.pid) {
+            vec_remove(&JOBS, i);
+            JOBS_RUNNING = JOBS.len;
+            job_finish(job, status);
+            activity = 1;
+            continue;
+        }
+        i++;
+    }
+
+    xfree(buffer);
+    return activity;
+}
+
+size_t exec_jobs_running(void) {
+    return JOBS_RUNNING;
+}
+
+void exec_jobs_cancel(void) {
+    for(size_t i = 0; i < JOBS.len; i++) {
+        ExecJob *job = *VEC_GET(ExecJob*, &JOBS, i);
+        // the job leads its own process group, kill the whole group
+        kill(-job->handle.pid, SIGTERM);
+    }
+}
+
+void exec_jobs_shutdown(void) {
+    size_t i = 0;
+    while(i < JOBS.len) {
+        ExecJob *job = *VEC_GET(ExecJob*, &JOBS, i);
+        if(!(job->flags & JF_KILL_ON_EXIT)) {
+            i++;
+            continue;
+        }
+        kill(-job->handle.pid, SIGKILL);
+        int status = 0;
+        while(waitpid(job->handle.pid, &status, 0) < 0 && errno == EINTR);
+        vec_remove(&JOBS, i);
+        JOBS_RUNNING = JOBS.len;
+        job_finish(job, status);
+    }
+    if(!JOBS.len) vec_cleanup(&JOBS);
+}
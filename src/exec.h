@@ -15,6 +15,73 @@ void spawn_handle_free(SpawnHandle *handle);
 
 int spawn_handle_wait_collect_output(SpawnHandle *handle, Str *out);
 
+// Writes `in` to the stdin of the command while reading its stdout into `out`
+// and its stderr into `err` (which can be the same `Str`), the three pipes
+// are serviced concurrently so neither process can block the other on a full
+// pipe, stdin is closed once all of `in` was written
+// Returns:
+//  the status of the command as returned by `waitpid`
+//  -1 on error and sets `errno`
+int spawn_handle_pump(
+        SpawnHandle *handle,
+        const char *in,
+        size_t in_len,
+        Str *out,
+        Str *err);
+
+// Runs `command` with `in` as its input, see `spawn_handle_pump`
+int exec_filter(const char *command, const char *in, size_t in_len, Str *out, Str *err);
+
+// Kills the running filter, safe to call from a signal handler
+// Returns:
+//  1 if a filter was running
+//  0 otherwise
+int exec_filter_cancel(void);
+
+// Spawns `command` in its own process group with its stdin, stdout and stderr
+// connected to pipes
 int spawn_captured(const char *command, SpawnHandle *spawn_handle);
 
+// Called with the output (stdout and stderr) of a job as it arrives
+typedef void (job_output_fn)(void *data, const char *s, size_t len);
+
+// Called once the job exited and all of its output was read
+//  `status` is the status returned by `waitpid`
+typedef void (job_exit_fn)(void *data, int status);
+
+enum JobFlags {
+    // the job is killed by `exec_jobs_shutdown` instead of being waited for
+    JF_KILL_ON_EXIT = 1,
+};
+
+// Runs `command` in the background, its stdin is closed, its output is read
+// by `exec_jobs_poll`
+// `flags` is a bitset of `JobFlags`
+// Returns:
+//  0 on success
+//  non zero if the command could not be spawned
+int exec_job_spawn(
+        const char *command,
+        int flags,
+        job_output_fn *on_output,
+        job_exit_fn *on_exit,
+        void *data);
+
+// Reads what the running jobs printed and reaps the ones that exited,
+// never blocks
+// Returns:
+//  1 if any job printed something or exited
+//  0 otherwise
+int exec_jobs_poll(void);
+
+// Number of jobs still running, safe to call from a signal handler
+size_t exec_jobs_running(void);
+
+// Kills every running job (and the processes they spawned)
+void exec_jobs_cancel(void);
+
+// Kills the jobs spawned with `JF_KILL_ON_EXIT`, the others are left running
+// and should be waited for with `exec_jobs_poll`
+void exec_jobs_shutdown(void);
+
 #endif
@@ -0,0 +1,540 @@
+#include "fold.h"
+#include "buffer.h"
+#include "config.h"
+#include "line.h"
+#include "highlight.h"
+#include "syntax.h"
+#include "utf.h"
+#include "xalloc.h"
+
+struct FoldNode {
+    struct FoldNode *left;
+    struct FoldNode *right;
+    uint32_t prio;
+    struct Fold fold;
+    // added to the lines of the children, not yet applied to them
+    ssize_t shift;
+    // last line of the folds of the subtree
+    size_t max_end;
+    // last line of the closed folds of the subtree, -1 if there is none
+    ssize_t max_closed_end;
+};
+
+static uint32_t FOLD_SEED = 2891336453u;
+
+static uint32_t fold_random(void) {
+    // xorshift32
+    FOLD_SEED ^= FOLD_SEED << 13;
+    FOLD_SEED ^= FOLD_SEED >> 17;
+    FOLD_SEED ^= FOLD_SEED << 5;
+    return FOLD_SEED;
+}
+
+static void fold_node_shift(struct FoldNode *n, ssize_t delta) {
+    if(!n) return;
+    n->fold.start += delta;
+    n->fold.end += delta;
+    n->max_end += delta;
+    if(n->max_closed_end >= 0) n->max_closed_end += delta;
+    n->shift += delta;
+}
+
+// Applies the pending shift of the node to its children
+static void fold_push(struct FoldNode *n) {
+    if(!n->shift) return;
+    fold_node_shift(n->left, n->shift);
+    fold_node_shift(n->right, n->shift);
+    n->shift = 0;
+}
+
+static void fold_pull(struct FoldNode *n) {
+    n->max_end = n->fold.end;
+    n->max_closed_end = n->fold.closed ? (ssize_t)n->fold.end : -1;
+    struct FoldNode *children[2] = {n->left, n->right};
+    for(size_t i = 0; i < 2; i++) {
+        if(!children[i]) continue;
+        if(children[i]->max_end > n->max_end) n->max_end = children[i]->max_end;
+        if(children[i]->max_closed_end > n->max_closed_end) n->max_closed_end = children[i]->max_closed_end;
+    }
+}
+
+// The folds are ordered by their first line, then the outer ones first
+static _Bool fold_before(const struct Fold *f, size_t start, size_t end) {
+    return f->start < start || (f->start == start && f->end > end);
+}
+
+// Splits the tree in the folds before (start, end) and the rest, the fold
+// (start, end) itself goes with the ones before if `inclusive` is set
+static void fold_split(
+        struct FoldNode *n,
+        size_t start,
+        size_t end,
+        _Bool inclusive,
+        struct FoldNode **a,
+        struct FoldNode **b) {
+    if(!n) {
+        *a = 0;
+        *b = 0;
+        return;
+    }
+    fold_push(n);
+    _Bool same = n->fold.start == start && n->fold.end == end;
+    if(fold_before(&n->fold, start, end) || (inclusive && same)) {
+        fold_split(n->right, start, end, inclusive, &n->right, b);
+        *a = n;
+    } else {
+        fold_split(n->left, start, end, inclusive, a, &n->left);
+        *b = n;
+    }
+    fold_pull(n);
+}
+
+static struct FoldNode *fold_merge(struct FoldNode *a, struct FoldNode *b) {
+    if(!a) return b;
+    if(!b) return a;
+    if(a->prio > b->prio) {
+        fold_push(a);
+        a->right = fold_merge(a->right, b);
+        fold_pull(a);
+        return a;
+    }
+    fold_push(b);
+    b->left = fold_merge(a, b->left);
+    fold_pull(b);
+    return b;
+}
+
+static void fold_node_free(struct FoldNode *n) {
+    if(!n) return;
+    fold_node_free(n->left);
+    fold_node_free(n->right);
+    xfree(n);
+}
+
+void fold_free(struct FoldTree *t) {
+    fold_node_free(t->root);
+    t->root = 0;
+}
+
+// Returns the outermost closed fold around `line`, 0 if there is none
+static struct FoldNode *fold_find_closed(struct FoldNode *n, size_t line) {
+    while(n && n->max_closed_end >= (ssize_t)line) {
+        fold_push(n);
+        // if none of the closed folds on the left is around the line they
+        // all start after it, and so does everything on the right
+        if(n->left && n->left->max_closed_end >= (ssize_t)line) {
+            n = n->left;
+            continue;
+        }
+        if(n->fold.start > line) return 0;
+        if(n->fold.closed && n->fold.end >= line) return n;
+        n = n->right;
+    }
+    return 0;
+}
+
+// Pushes the folds around `line` to `out`, the outer ones first
+static void fold_find_around(struct FoldNode *n, size_t line, Vec *out) {
+    if(!n || n->max_end < line) return;
+    fold_push(n);
+    fold_find_around(n->left, line, out);
+    if(n->fold.start > line) return;
+    if(n->fold.end >= line) vec_push(out, &n->fold);
+    fold_find_around(n->right, line, out);
+}
+
+// Removes the fold (start, end) from the tree
+// Returns -1 if there is none
+static int fold_remove(struct FoldTree *t, size_t start, size_t end) {
+    struct FoldNode *before = 0;
+    struct FoldNode *rest = 0;
+    struct FoldNode *same = 0;
+    struct FoldNode *after = 0;
+    fold_split(t->root, start, end, 0, &before, &rest);
+    fold_split(rest, start, end, 1, &same, &after);
+    t->root = fold_merge(before, after);
+    if(!same) return -1;
+    fold_node_free(same);
+    return 0;
+}
+
+static void fold_insert(struct FoldTree *t, struct Fold fold) {
+    struct FoldNode *n = xcalloc(1, sizeof(struct FoldNode));
+    n->prio = fold_random();
+    n->fold = fold;
+    fold_pull(n);
+    struct FoldNode *before = 0;
+    struct FoldNode *after = 0;
+    fold_split(t->root, fold.start, fold.end, 1, &before, &after);
+    t->root = fold_merge(fold_merge(before, n), after);
+}
+
+// Sets whether the fold (start, end) is closed
+static void fold_node_set(struct FoldNode *n, size_t start, size_t end, _Bool closed) {
+    if(!n) return;
+    fold_push(n);
+    if(n->fold.start == start && n->fold.end == end) {
+        n->fold.closed = closed;
+    } else if(fold_before(&n->fold, start, end)) {
+        fold_node_set(n->right, start, end, closed);
+    } else {
+        fold_node_set(n->left, start, end, closed);
+    }
+    fold_pull(n);
+}
+
+int fold_add(struct FoldTree *t, size_t start, size_t end) {
+    if(end <= start) return -1;
+    Vec around = VEC_NEW(struct Fold, 0);
+    fold_find_around(t->root, start, &around);
+    fold_find_around(t->root, end, &around);
+    int ret = 0;
+    for(size_t i = 0; i < around.len; i++) {
+        const struct Fold *f = VEC_GET(struct Fold, &around, i);
+        _Bool inside = f->start >= start && f->end <= end;
+        _Bool outside = f->start <= start && f->end >= end;
+        if(!inside && !outside) ret = -1;
+        if(f->start == start && f->end == end) ret = -1;
+    }
+    vec_cleanup(&around);
+    if(ret) return ret;
+    fold_insert(t, (struct Fold) {.start = start, .end = end, .closed = 1});
+    return 0;
+}
+
+// Returns the index in `around` of the innermost fold around the line that
+// is not hidden, -1 if there is none
+static ssize_t fold_innermost_shown(const Vec *around) {
+    size_t i = 0;
+    while(i < around->len && !(VEC_GET(struct Fold, around, i))->closed) i++;
+    // the outermost closed fold is shown, the ones in it are not
+    if(i < around->len) return i;
+    return (ssize_t)around->len - 1;
+}
+
+int fold_delete(struct FoldTree *t, size_t line) {
+    Vec around = VEC_NEW(struct Fold, 0);
+    fold_find_around(t->root, line, &around);
+    ssize_t i = fold_innermost_shown(&around);
+    int ret = -1;
+    if(i >= 0) {
+        struct Fold f = *VEC_GET(struct Fold, &around, i);
+        ret = fold_remove(t, f.start, f.end);
+    }
+    vec_cleanup(&around);
+    return ret;
+}
+
+int fold_open(struct FoldTree *t, size_t line) {
+    struct FoldNode *n = fold_find_closed(t->root, line);
+    if(!n) return -1;
+    fold_node_set(t->root, n->fold.start, n->fold.end, 0);
+    return 0;
+}
+
+int fold_close(struct FoldTree *t, size_t line) {
+    Vec around = VEC_NEW(struct Fold, 0);
+    fold_find_around(t->root, line, &around);
+    ssize_t i = fold_innermost_shown(&around);
+    // a closed fold closes the one around it
+    if(i >= 0 && (VEC_GET(struct Fold, &around, i))->closed) i--;
+    int ret = -1;
+    if(i >= 0) {
+        struct Fold f = *VEC_GET(struct Fold, &around, i);
+        fold_node_set(t->root, f.start, f.end, 1);
+        ret = 0;
+    }
+    vec_cleanup(&around);
+    return ret;
+}
+
+int fold_toggle(struct FoldTree *t, size_t line) {
+    if(!fold_open(t, line)) return 0;
+    return fold_close(t, line);
+}
+
+static void fold_node_set_all(struct FoldNode *n, _Bool closed) {
+    if(!n) return;
+    fold_push(n);
+    n->fold.closed = closed;
+    fold_node_set_all(n->left, closed);
+    fold_node_set_all(n->right, closed);
+    fold_pull(n);
+}
+
+void fold_set_all(struct FoldTree *t, _Bool closed) {
+    fold_node_set_all(t->root, closed);
+}
+
+size_t fold_visible_start(struct FoldTree *t, size_t line) {
+    struct FoldNode *n = fold_find_closed(t->root, line);
+    return n ? n->fold.start : line;
+}
+
+size_t fold_visible_end(struct FoldTree *t, size_t line) {
+    struct FoldNode *n = fold_find_closed(t->root, line);
+    return n ? n->fold.end : line;
+}
+
+size_t fold_visible_move(struct FoldTree *t, size_t line, ssize_t count, size_t len) {
+    if(!len) return 0;
+    if(line >= len) line = len - 1;
+    // nothing is hidden
+    if(!t->root || t->root->max_closed_end < 0) {
+        if(count < 0) return (size_t)-count > line ? 0 : line + count;
+        return (size_t)count >= len - line ? len - 1 : line + count;
+    }
+    line = fold_visible_start(t, line);
+    for(; count > 0; count--) {
+        size_t next = fold_visible_end(t, line) + 1;
+        if(next >= len) break;
+        line = next;
+    }
+    for(; count < 0 && line; count++) {
+        line = fold_visible_start(t, line - 1);
+    }
+    return line;
+}
+
+// Moves the last line of the folds starting before `start` that end after
+// it, the others are skipped
+static void fold_update_ends(struct FoldNode *n, size_t start, size_t removed, size_t added) {
+    if(!n || n->max_end < start) return;
+    fold_push(n);
+    fold_update_ends(n->left, start, removed, added);
+    fold_update_ends(n->right, start, removed, added);
+    if(n->fold.end >= start + removed) {
+        n->fold.end = n->fold.end + added - removed;
+    } else if(n->fold.end >= start + added) {
+        // it ended in the removed lines, it now ends with the added ones
+        n->fold.end = start + added - 1;
+    }
+    fold_pull(n);
+}
+
+// Pushes the nodes of the subtree to `out` in order and frees them
+static void fold_node_take(struct FoldNode *n, Vec *out) {
+    if(!n) return;
+    fold_push(n);
+    fold_node_take(n->left, out);
+    vec_push(out, &n->fold);
+    fold_node_take(n->right, out);
+    xfree(n);
+}
+
+void fold_update(struct FoldTree *t, size_t start, size_t removed, size_t added) {
+    if(!t->root || (removed == added && t->root->max_end < start)) return;
+    struct FoldNode *before = 0;
+    struct FoldNode *rest = 0;
+    struct FoldNode *replaced = 0;
+    struct FoldNode *after = 0;
+    fold_split(t->root, start, SIZE_MAX, 0, &before, &rest);
+    fold_split(rest, start + removed, SIZE_MAX, 0, &replaced, &after);
+
+    fold_update_ends(before, start, removed, added);
+    fold_node_shift(after, (ssize_t)added - (ssize_t)removed);
+    t->root = fold_merge(before, after);
+    // a fold that ended in the removed lines and started on the line before
+    // them is down to that line
+    if(!added && start) fold_remove(t, start - 1, start - 1);
+
+    // the folds starting in the removed lines are only kept if they start
+    // in the added ones, there are few of them
+    Vec folds = VEC_NEW(struct Fold, 0);
+    fold_node_take(replaced, &folds);
+    for(size_t i = 0; i < folds.len; i++) {
+        struct Fold f = *VEC_GET(struct Fold, &folds, i);
+        if(f.start >= start + added) continue;
+        if(f.end >= start + removed) {
+            f.end = f.end + added - removed;
+        } else if(f.end >= start + added) {
+            f.end = start + added - 1;
+        }
+        if(f.end > f.start) fold_insert(t, f);
+    }
+    vec_cleanup(&folds);
+}
+
+// Returns the indentation of the line in columns, -1 if it is blank
+static ssize_t fold_line_indent(const struct Line *l) {
+    const char *s = str_as_cstr(&l->text);
+    size_t len = str_cstr_len(&l->text);
+    size_t indent = 0;
+    for(size_t i = 0; i < len; i++) {
+        if(s[i] == ' ') indent++;
+        else if(s[i] == '\t') indent += CONFIG.tab_width - indent % CONFIG.tab_width;
+        else if(s[i] == '\r' || s[i] == '\n') break;
+        else return indent;
+    }
+    return -1;
+}
+
+void fold_from_indent(struct Buffer *buff) {
+    fold_free(&buff->folds);
+    // lines whose block is not over yet, the indentations grow
+    Vec heads = VEC_NEW(size_t, 0);
+    size_t last = 0;
+    for(size_t i = 0; i <= buff->lines.len; i++) {
+        ssize_t indent = 0;
+        const char *s = "";
+        if(i < buff->lines.len) {
+            const struct Line *l = VEC_GET(struct Line, &buff->lines, i);
+            indent = fold_line_indent(l);
+            if(indent < 0) continue;
+            s = str_as_cstr(&l->text);
+            while(*s == ' ' || *s == '\t') s++;
+        }
+        while(heads.len) {
+            size_t head = *VEC_GET(size_t, &heads, heads.len - 1);
+            ssize_t head_indent = fold_line_indent(VEC_GET(struct Line, &buff->lines, head));
+            if(head_indent < indent) break;
+            vec_pop(&heads, 0);
+            size_t end = last;
+            // the bracket closing the block goes with it
+            if(head_indent == indent && i < buff->lines.len && (*s == '}' || *s == ')' || *s == ']')) end = i;
+            fold_add(&buff->folds, head, end);
+        }
+        if(i < buff->lines.len) vec_push(&heads, &i);
+        last = i;
+    }
+    vec_cleanup(&heads);
+}
+
+void fold_from_syntax(struct Buffer *buff) {
+    fold_free(&buff->folds);
+    syntax_highlight(buff, 0, buff->lines.len);
+    int string = style_find_id(SYNTAX_STRING);
+    int comment = style_find_id(SYNTAX_COMMENT);
+    // lines of the brackets not closed yet
+    Vec open = VEC_NEW(size_t, 0);
+    for(size_t i = 0; i < buff->lines.len; i++) {
+        const struct Line *l = VEC_GET(struct Line, &buff->lines, i);
+        const char *s = str_as_cstr(&l->text);
+        size_t len = str_cstr_len(&l->text);
+        size_t col = 0;
+        for(size_t b = 0; b < len; b++) {
+            if(utf8_is_follow(s[b])) continue;
+            col++;
+            _Bool opens = s[b] == '(' || s[b] == '[' || s[b] == '{';
+            _Bool closes = s[b] == ')' || s[b] == ']' || s[b] == '}';
+            if(!opens && !closes) continue;
+            uint16_t id = line_style_at(l, col - 1);
+            if(id != STYLE_ID_NONE && (id == string || id == comment)) continue;
+            if(opens) {
+                vec_push(&open, &i);
+            } else if(open.len) {
+                size_t start = 0;
+                vec_pop(&open, &start);
+                if(start < i) fold_add(&buff->folds, start, i);
+            }
+        }
+    }
+    vec_cleanup(&open);
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+
+static int fold_test_visible(struct FoldTree *t, size_t line, size_t start, size_t end) {
+    return fold_visible_start(t, line) == start && fold_visible_end(t, line) == end;
+}
+
+TESTS_START
+
+TEST_DEF(test_fold_tree)
+    struct FoldTree t = {0};
+    TEST_ASSERT(!fold_add(&t, 10, 20));
+    TEST_ASSERT(!fold_add(&t, 12, 15));
+    TEST_ASSERT(!fold_add(&t, 30, 40));
+    // folds nest but do not cross
+    TEST_ASSERT(fold_add(&t, 15, 25) == -1);
+    TEST_ASSERT(fold_add(&t, 12, 15) == -1);
+    TEST_ASSERT(fold_add(&t, 5, 5) == -1);
+
+    TEST_ASSERT(fold_test_visible(&t, 14, 10, 20));
+    TEST_ASSERT(fold_test_visible(&t, 21, 21, 21));
+    TEST_ASSERT(fold_visible_move(&t, 9, 2, 100) == 21);
+    TEST_ASSERT(fold_visible_move(&t, 22, -2, 100) == 10);
+    TEST_ASSERT(fold_visible_move(&t, 29, 3, 100) == 42);
+    TEST_ASSERT(fold_visible_move(&t, 41, -1000, 100) == 0);
+
+    // the outer fold opens first, then the inner one shows
+    TEST_ASSERT(!fold_open(&t, 14));
+    TEST_ASSERT(fold_test_visible(&t, 14, 12, 15));
+    TEST_ASSERT(fold_test_visible(&t, 11, 11, 11));
+    TEST_ASSERT(!fold_toggle(&t, 12));
+    TEST_ASSERT(fold_test_visible(&t, 14, 14, 14));
+    // closing an open fold, then the one around it
+    TEST_ASSERT(!fold_close(&t, 14));
+    TEST_ASSERT(fold_test_visible(&t, 14, 12, 15));
+    TEST_ASSERT(!fold_close(&t, 12));
+    TEST_ASSERT(fold_test_visible(&t, 14, 10, 20));
+    TEST_ASSERT(fold_close(&t, 10) == -1);
+
+    fold_set_all(&t, 0);
+    TEST_ASSERT(fold_test_visible(&t, 35, 35, 35));
+    fold_set_all(&t, 1);
+
+    // the folds after an edit move, the ones around it grow
+    fold_update(&t, 13, 0, 5);
+    TEST_ASSERT(fold_test_visible(&t, 18, 10, 25));
+    TEST_ASSERT(fold_test_visible(&t, 40, 35, 45));
+    fold_open(&t, 10);
+    TEST_ASSERT(fold_test_visible(&t, 18, 12, 20));
+    // the ones in removed lines are dropped
+    fold_update(&t, 11, 12, 0);
+    TEST_ASSERT(fold_test_visible(&t, 25, 23, 33));
+    TEST_ASSERT(!fold_close(&t, 11));
+    TEST_ASSERT(fold_test_visible(&t, 11, 10, 13));
+    TEST_ASSERT(!fold_delete(&t, 11));
+    TEST_ASSERT(fold_test_visible(&t, 11, 11, 11));
+    TEST_ASSERT(fold_delete(&t, 11) == -1);
+    // and so are the ones left with a single line
+    TEST_ASSERT(!fold_add(&t, 50, 52));
+    fold_update(&t, 51, 3, 0);
+    TEST_ASSERT(fold_delete(&t, 50) == -1);
+    fold_free(&t);
+TEST_ENDDEF
+
+TEST_DEF(test_fold_from_indent)
+    const char *lines[] = {
+        "int f(void) {",
+        "    if(a) {",
+        "        b();",
+        "",
+        "        c();",
+        "    }",
+        "}",
+        "int g;",
+    };
+    struct Buffer buff = buffer_new();
+    for(size_t i = 0; i < 8; i++) {
+        struct Line l = line_from_cstr((char*)lines[i]);
+        vec_push(&buff.lines, &l);
+    }
+    fold_from_indent(&buff);
+    TEST_ASSERT(fold_test_visible(&buff.folds, 4, 0, 6));
+    TEST_ASSERT(fold_test_visible(&buff.folds, 7, 7, 7));
+    TEST_ASSERT(!fold_open(&buff.folds, 0));
+    TEST_ASSERT(fold_test_visible(&buff.folds, 3, 1, 5));
+    fold_free(&buff.folds);
+    vec_cleanup(&buff.lines);
+TEST_ENDDEF
+
+TEST_DEF(test_fold_deep)
+    // the hidden lines are skipped, not walked
+    struct FoldTree t = {0};
+    for(size_t i = 0; i < 20000; i++) {
+        TEST_ASSERT(!fold_add(&t, i * 10, i * 10 + 8));
+    }
+    TEST_ASSERT(fold_visible_move(&t, 0, 2, 200000) == 10);
+    TEST_ASSERT(fold_visible_move(&t, 123456, 1, 200000) == 123459);
+    fold_update(&t, 0, 0, 1);
+    TEST_ASSERT(fold_test_visible(&t, 123458, 123451, 123459));
+    fold_free(&t);
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef FOLD_H
+#define FOLD_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct Buffer;
+
+// Folds of a buffer, each covers the lines [start, end] and when it is
+// closed only its first line is drawn. Folds nest but never cross.
+// They are kept in an interval tree ordered by their first line, each node
+// holding the last line of the folds of its subtree, so the closed fold
+// hiding a line is found in O(log n) and an edit shifts the folds after it
+// in O(log n).
+
+struct FoldNode;
+
+struct FoldTree {
+    struct FoldNode *root;
+};
+
+struct Fold {
+    size_t start;
+    size_t end;
+    _Bool closed;
+};
+
+void fold_free(struct FoldTree *t);
+
+// Adds the closed fold [start, end]
+// Returns:
+//  0 on success
+//  -1 if it would cross another fold or it is a single line
+int fold_add(struct FoldTree *t, size_t start, size_t end);
+
+// Removes the innermost fold around `line`
+// Returns -1 if there is none
+int fold_delete(struct FoldTree *t, size_t line);
+
+// Opens the closed fold `line` is the first visible line of
+// Returns -1 if there is none
+int fold_open(struct FoldTree *t, size_t line);
+
+// Closes the innermost open fold around `line` that is not hidden
+// Returns -1 if there is none
+int fold_close(struct FoldTree *t, size_t line);
+
+// Opens the fold `line` is the first visible line of, or closes the one
+// around it
+// Returns -1 if there is none
+int fold_toggle(struct FoldTree *t, size_t line);
+
+// Opens or closes all the folds
+void fold_set_all(struct FoldTree *t, _Bool closed);
+
+// Returns the first line of the outermost closed fold around `line`,
+// `line` itself if it is not folded
+size_t fold_visible_start(struct FoldTree *t, size_t line);
+
+// Returns the last line of the outermost closed fold around `line`,
+// `line` itself if it is not folded
+size_t fold_visible_end(struct FoldTree *t, size_t line);
+
+// Returns the first line drawn `count` drawn lines away from the first line
+// drawn for `line`, within [0, len)
+size_t fold_visible_move(struct FoldTree *t, size_t line, ssize_t count, size_t len);
+
+// Moves the folds after the lines [start, start+removed) got replaced by
+// the lines [start, start+added), the folds inside the removed lines are
+// dropped
+void fold_update(struct FoldTree *t, size_t start, size_t removed, size_t added);
+
+// Replaces the folds of the buffer by closed ones around the blocks of
+// lines indented more than the line before them
+void fold_from_indent(struct Buffer *buff);
+
+// Replaces the folds of the buffer by closed ones around the brackets
+// spanning lines, the ones in strings and comments are skipped
+void fold_from_syntax(struct Buffer *buff);
+
+#endif
@@ -0,0 +1,446 @@
+#include "grep.h"
+#include "pattern.h"
+#include "pool.h"
+#include "search.h"
+#include "rx.h"
+#include "str.h"
+#include "utf.h"
+#include "xalloc.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// time `grep_poll` spends per call
+#define GREP_SLICE_NS 8000000
+// files searched by a single `pool_run` per worker
+#define GREP_BATCH_PER_WORKER 8
+// a file with a null byte in its first bytes is binary
+#define GREP_BINARY_PROBE 8192
+// the text of a result is cut after this many bytes
+#define GREP_MAX_TEXT 256
+
+// state of a worker thread
+struct GrepWorker {
+    // copies of the pattern owned by the worker
+    struct Rx *rx;
+    regex_t *regex;
+    // `Vec` of `RxMatch`
+    Vec matches;
+};
+
+static struct {
+    _Bool running;
+    struct Pattern *pattern;
+    struct GrepWorker *workers;
+    size_t workers_len;
+
+    // `Vec` of `Str`, the directories left to walk
+    Vec dirs;
+    // `Vec` of `Str`, the files found but not searched yet
+    Vec files;
+    // `Vec` of `Str`, the results of the batch being searched, one per file
+    Vec results;
+    // first file of `files` in the batch
+    size_t batch_start;
+
+    size_t files_searched;
+    size_t matches;
+
+    grep_output_fn *on_output;
+    grep_exit_fn *on_exit;
+    void *data;
+} GREP = {0};
+
+static uint64_t grep_monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Appends `s` to `out` with the bytes that are not valid UTF-8 (or null)
+// replaced by '?' so any file can be shown in a buffer
+static void grep_push_text(Str *out, const char *s, size_t len) {
+    size_t start = 0;
+    size_t i = 0;
+    while(i < len) {
+        int count = utf8_byte_count(s[i]);
+        _Bool valid = s[i] != '\0' && count >= 1 && i + count <= len;
+        for(int j = 1; valid && j < count; j++) {
+            if(!utf8_is_follow(s[i + j])) valid = 0;
+        }
+        if(valid) {
+            i += count;
+            continue;
+        }
+        str_push(out, s + start, i - start);
+        str_push(out, "?", 1);
+        i += 1;
+        start = i;
+    }
+    str_push(out, s + start, len - start);
+}
+
+// Appends the result for the line [line, line_end) of `path`, `match` is the
+// byte offset of the first match in the line
+static void grep_push_result(
+        Str *out,
+        const char *path,
+        size_t line_no,
+        const char *line,
+        const char *line_end,
+        const char *match) {
+
+    size_t col = utf8_count_chars(line, match - line) + 1;
+    if(line_end > line && line_end[-1] == '\r') line_end--;
+    size_t len = line_end - line;
+    if(len > GREP_MAX_TEXT) {
+        len = GREP_MAX_TEXT;
+        while(len && utf8_is_follow(line[len])) len--;
+    }
+
+    char prefix[64];
+    int prefix_len = snprintf(prefix, sizeof(prefix), ":%zu:%zu: ", line_no, col);
+    str_push(out, path, strlen(path));
+    str_push(out, prefix, prefix_len);
+    grep_push_text(out, line, len);
+    str_push(out, "\n", 1);
+}
+
+// Finds the first match in the line [line, end)
+// Returns the match or null if there is none
+static const char *grep_line_match(struct GrepWorker *w, const char *line, const char *end) {
+    size_t len = end - line;
+    if(w->rx) {
+        vec_clear(&w->matches);
+        if(!rx_find_all(w->rx, line, len, &w->matches)) return 0;
+        struct RxMatch *m = vec_get(&w->matches, 0);
+        const char *match = line;
+        for(size_t i = 0; i < m->col; i++) {
+            match++;
+            while(match < end && utf8_is_follow(*match)) match++;
+        }
+        return match;
+    }
+    regmatch_t m = {
+        .rm_so = 0,
+        .rm_eo = len,
+    };
+    if(regexec(w->regex, line, 1, &m, REG_STARTEND)) return 0;
+    return line + m.rm_so;
+}
+
+// Pushes the results of the file `path` of `size` bytes mapped at `text`
+// Returns the number of matching lines
+static size_t grep_text(
+        struct GrepWorker *w,
+        const char *path,
+        const char *text,
+        size_t size,
+        Str *out) {
+
+    const char *end = text + size;
+    const char *line = text;
+    size_t line_no = 1;
+    size_t count = 0;
+
+    if(GREP.pattern->literal) {
+        // the pattern is looked for in the whole file, only the lines of the
+        // occurrences are delimited
+        const char *pattern = GREP.pattern->source;
+        size_t pattern_len = strlen(pattern);
+        while(line < end) {
+            ssize_t found = search_literal(line, end - line, pattern, pattern_len);
+            if(found < 0) break;
+            const char *match = line + found;
+            const char *nl;
+            while((nl = memchr(line, '\n', match - line))) {
+                line = nl + 1;
+                line_no++;
+            }
+            const char *line_end = memchr(match, '\n', end - match);
+            if(!line_end) line_end = end;
+            grep_push_result(out, path, line_no, line, line_end, match);
+            count++;
+            line = line_end + 1;
+            line_no++;
+        }
+        return count;
+    }
+
+    while(line < end) {
+        const char *line_end = memchr(line, '\n', end - line);
+        if(!line_end) line_end = end;
+        const char *match = grep_line_match(w, line, line_end);
+        if(match) {
+            grep_push_result(out, path, line_no, line, line_end, match);
+            count++;
+        }
+        line = line_end + 1;
+        line_no++;
+    }
+    return count;
+}
+
+// Searches the file `idx` of the batch
+static void grep_file(void *data, size_t idx, size_t worker) {
+    (void)data;
+    Str *path = vec_get(&GREP.files, GREP.batch_start + idx);
+    Str *out = vec_get(&GREP.results, idx);
+    struct GrepWorker *w = &GREP.workers[worker];
+
+    int fd = open(str_as_cstr(path), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return;
+    struct stat st;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    const char *text = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(text == MAP_FAILED) return;
+
+    size_t probe = size < GREP_BINARY_PROBE ? size : GREP_BINARY_PROBE;
+    if(!memchr(text, '\0', probe)) {
+        grep_text(w, str_as_cstr(path), text, size, out);
+    }
+    munmap((void*)text, size);
+}
+
+// Lists the directory at the end of `dirs`, its subdirectories are walked
+// later and its files are queued to be searched
+static void grep_walk_dir(void) {
+    Str dir;
+    vec_pop(&GREP.dirs, &dir);
+
+    DIR *d = opendir(str_as_cstr(&dir));
+    if(!d) {
+        str_free(&dir);
+        return;
+    }
+    struct dirent *ent;
+    while((ent = readdir(d))) {
+        if(ent->d_name[0] == '.' && (!ent->d_name[1] || (ent->d_name[1] == '.' && !ent->d_name[2]))) {
+            continue;
+        }
+        Str path = str_new();
+        // the paths under the working directory are shown without `./`
+        if(strcmp(str_as_cstr(&dir), ".")) {
+            str_push(&path, str_as_cstr(&dir), str_cstr_len(&dir));
+            str_push(&path, "/", 1);
+        }
+        str_push(&path, ent->d_name, strlen(ent->d_name));
+
+        unsigned char type = ent->d_type;
+        if(type == DT_UNKNOWN) {
+            struct stat st;
+            if(lstat(str_as_cstr(&path), &st)) type = DT_UNKNOWN;
+            else if(S_ISDIR(st.st_mode)) type = DT_DIR;
+            else if(S_ISREG(st.st_mode)) type = DT_REG;
+        }
+        // symbolic links are not followed, they could loop
+        if(type == DT_DIR && ent->d_name[0] != '.') {
+            vec_push(&GREP.dirs, &path);
+        } else if(type == DT_REG) {
+            vec_push(&GREP.files, &path);
+        } else {
+            str_free(&path);
+        }
+    }
+    closedir(d);
+    str_free(&dir);
+}
+
+static void grep_free(void) {
+    for(size_t i = 0; i < GREP.workers_len; i++) {
+        vec_cleanup(&GREP.workers[i].matches);
+    }
+    xfree(GREP.workers);
+    pattern_rc_dec(GREP.pattern);
+    vec_cleanup(&GREP.dirs);
+    vec_cleanup(&GREP.files);
+    vec_cleanup(&GREP.results);
+    memset(&GREP, 0, sizeof(GREP));
+}
+
+static void grep_finish(void) {
+    grep_exit_fn *on_exit = GREP.on_exit;
+    void *data = GREP.data;
+    size_t files = GREP.files_searched;
+    size_t matches = GREP.matches;
+    grep_free();
+    on_exit(data, files, matches);
+}
+
+int grep_start(
+        const char *pattern,
+        const char *dir,
+        grep_output_fn *on_output,
+        grep_exit_fn *on_exit,
+        void *data) {
+
+    struct Pattern *p = pattern_get(pattern, 0);
+    size_t workers = pool_size();
+    if(pattern_workers(p, workers)) {
+        pattern_rc_dec(p);
+        return -1;
+    }
+
+    grep_cancel();
+
+    GREP.pattern = p;
+    GREP.workers_len = workers;
+    GREP.workers = xcalloc(workers, sizeof(struct GrepWorker));
+    for(size_t i = 0; i < workers; i++) {
+        struct GrepWorker *w = &GREP.workers[i];
+        w->matches = VEC_NEW(struct RxMatch, 0);
+        w->rx = pattern_rx(p, i);
+        w->regex = pattern_regex(p, i);
+    }
+
+    GREP.dirs = VEC_NEW(Str, (void(*)(void*))str_free);
+    GREP.files = VEC_NEW(Str, (void(*)(void*))str_free);
+    GREP.results = VEC_NEW(Str, (void(*)(void*))str_free);
+    Str root = str_from_cstr(dir && *dir ? dir : ".");
+    vec_push(&GREP.dirs, &root);
+
+    GREP.on_output = on_output;
+    GREP.on_exit = on_exit;
+    GREP.data = data;
+    GREP.running = 1;
+    return 0;
+}
+
+int grep_poll(void) {
+    if(!GREP.running) return 0;
+
+    uint64_t deadline = grep_monotonic_ns() + GREP_SLICE_NS;
+    size_t batch_len = GREP.workers_len * GREP_BATCH_PER_WORKER;
+    Str out = str_new();
+    do {
+        // walk enough of the tree to fill a batch
+        while(GREP.files.len < batch_len && GREP.dirs.len) {
+            grep_walk_dir();
+        }
+        if(!GREP.files.len) break;
+
+        // the last files found are searched first, they are the cheapest to
+        // remove
+        size_t count = GREP.files.len < batch_len ? GREP.files.len : batch_len;
+        GREP.batch_start = GREP.files.len - count;
+        for(size_t i = 0; i < count; i++) {
+            Str result = str_new();
+            vec_push(&GREP.results, &result);
+        }
+        pool_run(grep_file, 0, count);
+
+        for(size_t i = 0; i < count; i++) {
+            Str *result = vec_get(&GREP.results, i);
+            if(str_is_empty(result)) continue;
+            const char *s = str_as_cstr(result);
+            for(size_t j = 0; j < str_cstr_len(result); j++) {
+                GREP.matches += s[j] == '\n';
+            }
+            str_push(&out, s, str_cstr_len(result));
+        }
+        vec_clear(&GREP.results);
+        vec_remove_range(&GREP.files, GREP.batch_start, count);
+        GREP.files_searched += count;
+    } while(grep_monotonic_ns() < deadline);
+
+    if(!str_is_empty(&out)) {
+        GREP.on_output(GREP.data, str_as_cstr(&out), str_cstr_len(&out));
+    }
+    str_free(&out);
+
+    if(!GREP.files.len && !GREP.dirs.len) grep_finish();
+    return 1;
+}
+
+void grep_cancel(void) {
+    if(GREP.running) grep_finish();
+}
+
+int grep_running(void) {
+    return GREP.running;
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static void grep_test_output(void *data, const char *s, size_t len) {
+    str_push(data, s, len);
+}
+
+static void grep_test_exit(void *data, size_t files, size_t matches) {
+    (void)data;
+    (void)files;
+    (void)matches;
+}
+
+static void grep_test_write(const char *path, const char *s, size_t len) {
+    FILE *f = fopen(path, "w");
+    fwrite(s, 1, len, f);
+    fclose(f);
+}
+
+TESTS_START
+
+TEST_DEF(test_grep)
+    char dir[] = TEST_BUILD_DIR "/cedit_grepXXXXXX";
+    TEST_ASSERT(mkdtemp(dir));
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/a.txt", dir);
+    grep_test_write(path, "one\ntwo foo\n\xc3\xa9 foo foo\r\n", 24);
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/sub/b.bin", dir);
+    grep_test_write(path, "foo\0", 4);
+    snprintf(path, sizeof(path), "%s/.hidden", dir);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/.hidden/c.txt", dir);
+    grep_test_write(path, "foo", 3);
+
+    // the literal path and both regex engines agree
+    const char *patterns[] = {"foo", "fo*", "\\(f\\)oo"};
+    for(size_t i = 0; i < 3; i++) {
+        Str out = str_new();
+        TEST_ASSERT(!grep_start(patterns[i], dir, grep_test_output, grep_test_exit, &out));
+        while(grep_poll());
+        char expected[8192];
+        snprintf(expected, sizeof(expected),
+                "%s/a.txt:2:5: two foo\n%s/a.txt:3:3: \xc3\xa9 foo foo\n", dir, dir);
+        TEST_ASSERT(!strcmp(str_as_cstr(&out), expected));
+        str_free(&out);
+    }
+    TEST_ASSERT(grep_start("\\(", dir, grep_test_output, grep_test_exit, 0) == -1);
+
+    const char *files[] = {"a.txt", "sub/b.bin", ".hidden/c.txt"};
+    for(size_t i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        TEST_ASSERT(!unlink(path));
+    }
+    const char *dirs[] = {"sub", ".hidden"};
+    for(size_t i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, dirs[i]);
+        TEST_ASSERT(!rmdir(path));
+    }
+    TEST_ASSERT(!rmdir(dir));
+    pool_shutdown();
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef GREP_H
+#define GREP_H 1
+
+#include <stddef.h>
+
+// Searches every file under a directory for a basic regex. The directories
+// are walked from the event loop a slice at a time and the files of a slice
+// are searched by the thread pool, their results are reported in order once
+// the slice is done. Binary files and hidden directories are skipped.
+
+// Called with the results of a slice, one `path:line:col: text` line per
+// matching line, `line` and `col` start at 1 and `col` is in characters
+typedef void (grep_output_fn)(void *data, const char *s, size_t len);
+
+// Called once every file was searched or the search was cancelled
+typedef void (grep_exit_fn)(void *data, size_t files, size_t matches);
+
+// Starts searching the files under `dir` for `pattern`, a running search is
+// cancelled first
+// Returns:
+//  0 on success
+//  -1 if the pattern is invalid
+int grep_start(
+        const char *pattern,
+        const char *dir,
+        grep_output_fn *on_output,
+        grep_exit_fn *on_exit,
+        void *data);
+
+// Searches the next slice of files, never runs for much longer than a slice
+// Returns:
+//  1 if a search is running
+//  0 otherwise
+int grep_poll(void);
+
+// Stops the running search, if any
+void grep_cancel(void);
+
+// Returns whether a search is running
+int grep_running(void);
+
+#endif
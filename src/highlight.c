@@ -2,79 +2,138 @@
 #include "vt.h"
 
 #include "xalloc.h"
+#include "str.h"
 
 #include <string.h>
 
-size_t CURRENT_ID = 0;
-
 struct StyleEntry {
+    // null once delisted, the id is never given to another style
     char *name;
+    size_t name_len;
+    uint64_t hash;
     Style style;
 };
 
-struct StyleEntry STYLE_ENTRY_TABLE[255] = {0};
-
-void style_entry_free(struct StyleEntry *entry) {
-    if(entry->name) {
-        xfree(entry->name);
+// `Vec` of `StyleEntry` indexed by id
+Vec STYLE_ENTRY_TABLE = VEC_NEW(struct StyleEntry, 0);
+
+// Open addressed index of the names in `STYLE_ENTRY_TABLE`, holds ids or
+// one of these
+#define STYLE_SLOT_EMPTY STYLE_ID_NONE
+#define STYLE_SLOT_DELETED (STYLE_ID_NONE - 1)
+
+static uint16_t *STYLE_SLOTS = 0;
+// a power of 2
+static size_t STYLE_SLOTS_CAP = 0;
+// ids and deleted slots
+static size_t STYLE_SLOTS_USED = 0;
+
+static uint64_t style_hash(const char *name, size_t len) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 0x100000001b3ull;
     }
+    return hash;
 }
 
-int style_find_id(char *name) {
-    for(size_t i = 0; i < 255; i++) {
-        char *entry_name = STYLE_ENTRY_TABLE[i].name;
-        if(entry_name && !strcmp(name, entry_name)) {
+static struct StyleEntry *style_entry(size_t id) {
+    return VEC_GET(struct StyleEntry, &STYLE_ENTRY_TABLE, id);
+}
+
+// Returns the slot of the name, or the empty slot it would go in
+static size_t style_slot_find(const char *name, size_t len, uint64_t hash) {
+    size_t mask = STYLE_SLOTS_CAP - 1;
+    for(size_t i = hash & mask;; i = (i + 1) & mask) {
+        uint16_t id = STYLE_SLOTS[i];
+        if(id == STYLE_SLOT_EMPTY) return i;
+        if(id == STYLE_SLOT_DELETED) continue;
+        struct StyleEntry *entry = style_entry(id);
+        if(entry->hash == hash
+                && entry->name_len == len
+                && !memcmp(entry->name, name, len)) {
             return i;
         }
     }
-    return -1;
 }
 
-int find_next_free_after(uint8_t target_id) {
-    for(size_t i = target_id; i < 255; i++) {
-        if(!STYLE_ENTRY_TABLE[i].name) return i;
+// Rebuilds the index with room for one more name, dropping the deleted slots
+static void style_slots_grow(void) {
+    // kept at most half full
+    if((STYLE_SLOTS_USED + 1) * 2 <= STYLE_SLOTS_CAP) return;
+    size_t live = 0;
+    for(size_t i = 0; i < STYLE_ENTRY_TABLE.len; i++) {
+        live += style_entry(i)->name != 0;
+    }
+    size_t cap = STYLE_SLOTS_CAP ? STYLE_SLOTS_CAP : 64;
+    while((live + 1) * 2 > cap) cap *= 2;
+
+    xfree(STYLE_SLOTS);
+    STYLE_SLOTS = xcalloc(cap, sizeof(uint16_t));
+    STYLE_SLOTS_CAP = cap;
+    STYLE_SLOTS_USED = live;
+    memset(STYLE_SLOTS, 0xff, cap * sizeof(uint16_t));
+    for(size_t i = 0; i < STYLE_ENTRY_TABLE.len; i++) {
+        struct StyleEntry *entry = style_entry(i);
+        if(!entry->name) continue;
+        STYLE_SLOTS[style_slot_find(entry->name, entry->name_len, entry->hash)] = i;
     }
-    return -1;
 }
 
-// tries to register a style, already defined styles have priority
-// Returns:
-//   < 0 On error (out of space after priority)
-//  >= 0 On success (style id)
-int style_register(char *name, size_t name_len, Style style, uint8_t priority) {
-    // table has 255 slots (indices 0-254); clamp so the loop in
-    // find_next_free_after (i < 255) can always start within range
-    uint8_t target_id = priority >= 255 ? 0 : (uint8_t)(254 - priority);
-    int id = find_next_free_after(target_id);
-    if(id < 0) return id;
-
-    struct StyleEntry *entry = &STYLE_ENTRY_TABLE[id];
-
-    entry->name = xcalloc(name_len+1, sizeof(char));
-
-    memcpy(entry->name, name, name_len);
+static int style_find_id_len(const char *name, size_t len) {
+    if(!STYLE_SLOTS_CAP) return -1;
+    size_t slot = style_slot_find(name, len, style_hash(name, len));
+    uint16_t id = STYLE_SLOTS[slot];
+    return id == STYLE_SLOT_EMPTY ? -1 : id;
+}
 
-    entry->style = style;
+int style_find_id(char *name) {
+    return style_find_id_len(name, strlen(name));
+}
 
+int style_register(char *name, size_t name_len, Style style) {
+    int id = style_find_id_len(name, name_len);
+    if(id >= 0) return id;
+    if(STYLE_ENTRY_TABLE.len >= STYLE_ID_MAX) return -1;
+
+    style_slots_grow();
+    uint64_t hash = style_hash(name, name_len);
+    struct StyleEntry entry = {
+        .name = xcalloc(name_len+1, sizeof(char)),
+        .name_len = name_len,
+        .hash = hash,
+        .style = style,
+    };
+    memcpy(entry.name, name, name_len);
+
+    id = STYLE_ENTRY_TABLE.len;
+    vec_push(&STYLE_ENTRY_TABLE, &entry);
+    STYLE_SLOTS[style_slot_find(name, name_len, hash)] = id;
+    STYLE_SLOTS_USED += 1;
     return id;
 }
 
-Style* style_find_by_id(uint8_t id) {
-    if(!STYLE_ENTRY_TABLE[id].name) return 0;
-    return &STYLE_ENTRY_TABLE[id].style;
+Style* style_find_by_id(uint16_t id) {
+    if(id >= STYLE_ENTRY_TABLE.len || !style_entry(id)->name) return 0;
+    return &style_entry(id)->style;
 }
 
 Style* style_find(char *name) {
     int id = style_find_id(name);
     if(id < 0) return 0;
-    return &STYLE_ENTRY_TABLE[id].style;
+    return &style_entry(id)->style;
 }
 
-int style_delist_by_id(uint8_t id) {
-    if(!STYLE_ENTRY_TABLE[id].name) return -1;
+int style_delist_by_id(uint16_t id) {
+    if(id >= STYLE_ENTRY_TABLE.len) return -1;
+    struct StyleEntry *entry = style_entry(id);
+    if(!entry->name) return -1;
 
-    xfree(STYLE_ENTRY_TABLE[id].name);
-    STYLE_ENTRY_TABLE[id].name = 0;
+    size_t slot = style_slot_find(entry->name, entry->name_len, entry->hash);
+    STYLE_SLOTS[slot] = STYLE_SLOT_DELETED;
+    xfree(entry->name);
+    entry->name = 0;
 
     return 0;
 }
@@ -86,7 +145,52 @@ int style_delist(char *name) {
 }
 
 void style_entry_table_free(void) {
-    for(size_t i = 0; i < 255; i++) {
-        style_entry_free(&STYLE_ENTRY_TABLE[i]);
+    for(size_t i = 0; i < STYLE_ENTRY_TABLE.len; i++) {
+        struct StyleEntry *entry = style_entry(i);
+        if(entry->name) xfree(entry->name);
     }
+    vec_cleanup(&STYLE_ENTRY_TABLE);
+    xfree(STYLE_SLOTS);
+    STYLE_SLOTS = 0;
+    STYLE_SLOTS_CAP = 0;
+    STYLE_SLOTS_USED = 0;
 }
+
+#ifdef TESTING
+
+#include "tests.h"
+
+#include <stdio.h>
+
+TESTS_START
+
+TEST_DEF(test_style_registry)
+    int search = style_register("search", 6, style_new());
+    TEST_ASSERT(search == 0);
+    // registering a name again keeps the first style
+    TEST_ASSERT(style_register("search", 6, style_fg(style_new(), colour_vt(VT_RED))) == search);
+    TEST_ASSERT(style_find_by_id(search)->fg.t == COL_NONE);
+
+    char name[32];
+    for(int i = 0; i < 1000; i++) {
+        int len = snprintf(name, sizeof(name), "group_%d", i);
+        TEST_ASSERT(style_register(name, len, style_new()) == i + 1);
+    }
+    TEST_ASSERT(style_find_id("group_999") == 1000);
+    TEST_ASSERT(style_find_id("group_1000") == -1);
+
+    // ids are stable, a delisted one is not reused
+    TEST_ASSERT(style_delist("group_3") == 0);
+    TEST_ASSERT(style_find_id("group_3") == -1);
+    TEST_ASSERT(style_find_by_id(4) == 0);
+    TEST_ASSERT(style_find_id("group_4") == 5);
+    TEST_ASSERT(style_register("group_3", 7, style_new()) == 1001);
+    TEST_ASSERT(style_find_by_id(STYLE_ID_NONE) == 0);
+
+    style_entry_table_free();
+    TEST_ASSERT(style_find_id("search") == -1);
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
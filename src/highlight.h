@@ -5,22 +5,32 @@
 #include <stdint.h>
 
 #define SEARCH_HIGHLIGHT "search_highlight"
+#define DIAGNOSTIC_HIGHLIGHT "diagnostic_highlight"
+#define BRACKET_HIGHLIGHT "bracket_highlight"
 
-// tries to register a style, already defined styles have priority
+// id of the characters without a style
+#define STYLE_ID_NONE UINT16_MAX
+// the ids are below it
+#define STYLE_ID_MAX (UINT16_MAX - 1)
+
+// Registers a style under a new id, the ids are never reused, an already
+// registered name keeps its style
 // Returns:
-//   < 0 On error (out of space after priority)
+//   < 0 On error (out of ids)
 //  >= 0 On success (style id)
-int style_register(char *name, size_t name_len, Style style, uint8_t priority);
+int style_register(char *name, size_t name_len, Style style);
 
+// Returns the id of the style, -1 if there is none
 int style_find_id(char *name);
 
+// The returned style is valid until the next style is registered
 Style* style_find(char *name);
 
-Style* style_find_by_id(uint8_t id);
+Style* style_find_by_id(uint16_t id);
 
 int style_delist(char *name);
 
-int style_delist_by_id(uint8_t id);
+int style_delist_by_id(uint16_t id);
 
 void style_entry_table_free(void);
 
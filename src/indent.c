@@ -0,0 +1,245 @@
+#include "indent.h"
+#include "buffer.h"
+#include "config.h"
+#include "highlight.h"
+#include "line.h"
+#include "syntax.h"
+#include "utf.h"
+
+#include <string.h>
+
+// used by the buffers without a syntax
+static const struct SyntaxIndent INDENT_DEFAULT = {
+    .open = "{([",
+    .close = "})]",
+    .flush = "",
+};
+
+static const struct SyntaxIndent *indent_rules(const struct Buffer *buff) {
+    return buff->syntax ? &buff->syntax->indent : &INDENT_DEFAULT;
+}
+
+// Returns the index of the first byte of the line that is not whitespace
+static size_t indent_text_start(const struct Line *l) {
+    const char *s = str_as_cstr(&l->text);
+    size_t len = str_cstr_len(&l->text);
+    size_t i = 0;
+    while(i < len && (s[i] == ' ' || s[i] == '\t')) i++;
+    return i;
+}
+
+// Returns the indentation of the line in columns
+static size_t indent_width(const struct Line *l) {
+    const char *s = str_as_cstr(&l->text);
+    size_t end = indent_text_start(l);
+    size_t width = 0;
+    for(size_t i = 0; i < end; i++) {
+        width += s[i] == '\t' ? CONFIG.tab_width - width % CONFIG.tab_width : 1;
+    }
+    return width;
+}
+
+// Returns whether the line starts in a comment or a string of the line
+// before it
+static _Bool indent_in_text(const struct Buffer *buff, size_t line) {
+    if(!buff->syntax || !line) return 0;
+    return (VEC_GET(struct Line, &buff->lines, line - 1))->syntax_state != 0;
+}
+
+// Returns how many levels the brackets of the line leave open, the ones in
+// strings and comments are skipped
+static ssize_t indent_count(const struct IndentState *s, const struct Line *l) {
+    const char *text = str_as_cstr(&l->text);
+    size_t len = str_cstr_len(&l->text);
+    ssize_t depth = 0;
+    size_t col = 0;
+    for(size_t i = 0; i < len; i++) {
+        if(utf8_is_follow(text[i])) continue;
+        col++;
+        // the brackets are ascii
+        if(text[i] & 0x80 || !s->brackets[(int)text[i]]) continue;
+        uint16_t id = line_style_at(l, col - 1);
+        if(id != STYLE_ID_NONE && (id == s->string_id || id == s->comment_id)) continue;
+        depth += s->brackets[(int)text[i]];
+    }
+    return depth;
+}
+
+// Returns how many brackets close the line starts with
+static size_t indent_lead(const struct IndentState *st, const struct Line *l) {
+    const char *s = str_as_cstr(&l->text);
+    size_t len = str_cstr_len(&l->text);
+    size_t lead = 0;
+    for(size_t i = indent_text_start(l); i < len && !(s[i] & 0x80) && st->brackets[(int)s[i]] < 0; i++) {
+        lead++;
+    }
+    return lead;
+}
+
+// Returns whether the line is flush with the margin
+static _Bool indent_flush(const struct SyntaxIndent *rules, const struct Line *l) {
+    const char *s = str_as_cstr(&l->text);
+    size_t i = indent_text_start(l);
+    return i < str_cstr_len(&l->text) && s[i] && strchr(rules->flush, s[i]);
+}
+
+struct IndentState indent_start(struct Buffer *buff, size_t line) {
+    const struct SyntaxIndent *rules = indent_rules(buff);
+    struct IndentState s = {
+        .comment = -1,
+        .string_id = style_find_id(SYNTAX_STRING),
+        .comment_id = style_find_id(SYNTAX_COMMENT),
+    };
+    for(const char *c = rules->open; *c; c++) s.brackets[(int)*c] = 1;
+    for(const char *c = rules->close; *c; c++) s.brackets[(int)*c] = -1;
+    if(line > buff->lines.len) line = buff->lines.len;
+    while(line--) {
+        const struct Line *l = VEC_GET(struct Line, &buff->lines, line);
+        if(indent_text_start(l) == str_cstr_len(&l->text)) continue;
+        if(indent_in_text(buff, line) || indent_flush(rules, l)) continue;
+        s.base = indent_width(l);
+        s.depth = indent_count(&s, l) + indent_lead(&s, l);
+        break;
+    }
+    return s;
+}
+
+ssize_t indent_next(struct IndentState *s, struct Buffer *buff, size_t line) {
+    const struct SyntaxIndent *rules = indent_rules(buff);
+    const struct Line *l = VEC_GET(struct Line, &buff->lines, line);
+    size_t start = indent_text_start(l);
+    // blank lines lose their whitespace
+    if(start == str_cstr_len(&l->text)) return 0;
+
+    if(indent_in_text(buff, line)) {
+        s->depth += indent_count(s, l);
+        size_t col = utf8_count_chars(str_as_cstr(&l->text), start);
+        _Bool star = str_as_cstr(&l->text)[start] == '*' && line_style_at(l, col) == s->comment_id;
+        return s->comment >= 0 && star ? s->comment + 1 : -1;
+    }
+    if(indent_flush(rules, l)) return 0;
+
+    size_t lead = indent_lead(s, l);
+    ssize_t indent = (ssize_t)s->base + (s->depth - (ssize_t)lead) * CONFIG.tab_width;
+    if(indent < 0) indent = 0;
+    s->base = indent;
+    s->depth = indent_count(s, l) + lead;
+    s->comment = buff->syntax && l->syntax_state ? indent : -1;
+    return indent;
+}
+
+size_t indent_for(struct Buffer *buff, size_t line) {
+    struct IndentState s = indent_start(buff, line);
+    if(line >= buff->lines.len) {
+        ssize_t indent = (ssize_t)s.base + s.depth * CONFIG.tab_width;
+        return indent < 0 ? 0 : indent;
+    }
+    // an empty line is indented as if it had text
+    const struct Line *l = VEC_GET(struct Line, &buff->lines, line);
+    if(indent_text_start(l) == str_cstr_len(&l->text)) {
+        ssize_t indent = (ssize_t)s.base + s.depth * CONFIG.tab_width;
+        return indent < 0 ? 0 : indent;
+    }
+    ssize_t indent = indent_next(&s, buff, line);
+    return indent < 0 ? indent_width(l) : (size_t)indent;
+}
+
+void indent_prefix(size_t indent, Str *out) {
+    if(!CONFIG.use_spaces) {
+        for(; indent >= (size_t)CONFIG.tab_width; indent -= CONFIG.tab_width) {
+            str_push(out, "\t", 1);
+        }
+    }
+    for(; indent; indent--) {
+        str_push(out, " ", 1);
+    }
+}
+
+int indent_line_set(struct Line *l, size_t indent) {
+    size_t start = indent_text_start(l);
+    const char *s = str_as_cstr(&l->text);
+    // most lines are already indented right
+    size_t tabs = CONFIG.use_spaces ? 0 : indent / CONFIG.tab_width;
+    size_t spaces = indent - tabs * CONFIG.tab_width;
+    if(start == tabs + spaces) {
+        size_t i = 0;
+        while(i < tabs && s[i] == '\t') i++;
+        while(i < start && s[i] == ' ') i++;
+        if(i == start) return 0;
+    }
+    Str prefix = str_new();
+    indent_prefix(indent, &prefix);
+    // the whitespace is ascii, bytes are characters
+    if(start) line_remove(l, 0, start - 1);
+    line_insert_at(l, 0, str_as_cstr(&prefix), str_cstr_len(&prefix));
+    str_free(&prefix);
+    return 1;
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+
+static int indent_test_line(struct Buffer *buff, size_t line, const char *text) {
+    return !strcmp(str_as_cstr(&buffer_line_get(buff, line)->text), text);
+}
+
+TESTS_START
+
+TEST_DEF(test_indent)
+    syntax_init();
+    const char *lines[] = {
+        "#include <stdio.h>",
+        "int f(int a) {",
+        "if(a) {",
+        "  g(\"{\", // (",
+        "a);",
+        "      } else {",
+        "   /* {",
+        "* [",
+        "       */",
+        "#ifdef X",
+        "return 1;",
+        "#endif",
+        "   }",
+        "",
+        "  }",
+        "    int b;",
+    };
+    struct Buffer buff = buffer_test_new(lines, 16, "src/test.c");
+    syntax_highlight(&buff, 0, buff.lines.len);
+
+    struct IndentState s = indent_start(&buff, 0);
+    for(size_t i = 0; i < buff.lines.len; i++) {
+        ssize_t indent = indent_next(&s, &buff, i);
+        if(indent >= 0) indent_line_set(buffer_line_get(&buff, i), indent);
+    }
+    TEST_ASSERT(indent_test_line(&buff, 0, "#include <stdio.h>"));
+    TEST_ASSERT(indent_test_line(&buff, 1, "int f(int a) {"));
+    TEST_ASSERT(indent_test_line(&buff, 2, "    if(a) {"));
+    // the brackets in strings and comments are skipped
+    TEST_ASSERT(indent_test_line(&buff, 3, "        g(\"{\", // ("));
+    TEST_ASSERT(indent_test_line(&buff, 4, "            a);"));
+    TEST_ASSERT(indent_test_line(&buff, 5, "    } else {"));
+    // the lines of a comment are aligned on its first line
+    TEST_ASSERT(indent_test_line(&buff, 6, "        /* {"));
+    TEST_ASSERT(indent_test_line(&buff, 7, "         * ["));
+    TEST_ASSERT(indent_test_line(&buff, 8, "         */"));
+    TEST_ASSERT(indent_test_line(&buff, 9, "#ifdef X"));
+    TEST_ASSERT(indent_test_line(&buff, 10, "        return 1;"));
+    TEST_ASSERT(indent_test_line(&buff, 12, "    }"));
+    TEST_ASSERT(indent_test_line(&buff, 13, ""));
+    TEST_ASSERT(indent_test_line(&buff, 14, "}"));
+    TEST_ASSERT(indent_test_line(&buff, 15, "int b;"));
+
+    // a new line after an opening bracket is one level deeper
+    TEST_ASSERT(indent_for(&buff, 3) == 8);
+    TEST_ASSERT(indent_for(&buff, 16) == 0);
+    vec_cleanup(&buff.lines);
+    syntax_teardown();
+    style_entry_table_free();
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
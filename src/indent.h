@@ -0,0 +1,57 @@
+#ifndef INDENT_H
+#define INDENT_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "str.h"
+
+struct Buffer;
+struct Line;
+
+// The indentation of a line is the one of the line of code before it, one
+// level deeper for every bracket left open on that line and one level
+// shallower for every bracket closed at the start of the line. The brackets
+// in strings and comments are skipped using the styles of the lexer, and the
+// lines starting in a comment or a string (from the end state of the line
+// before them) are left alone, apart from the `*` of a comment that is
+// aligned on the line the comment started on.
+
+// Indentation carried from one line to the next
+struct IndentState {
+    // indentation in columns of the last line of code
+    size_t base;
+    // levels opened since that line
+    ssize_t depth;
+    // indentation of the line the comment the lines are in started on, -1
+    // if they are not in one
+    ssize_t comment;
+    // style ids of the strings and comments of the lexer
+    int string_id;
+    int comment_id;
+    // 1 for the ascii characters that open a level, -1 for the ones that
+    // close one
+    int8_t brackets[128];
+};
+
+// Returns the state before the line `line`, from the lines of code before it
+struct IndentState indent_start(struct Buffer *buff, size_t line);
+
+// Returns the indentation in columns of the line `line`, the one after the
+// line of the state, and moves the state after it
+// Returns -1 if the line should be left as is
+ssize_t indent_next(struct IndentState *s, struct Buffer *buff, size_t line);
+
+// Returns the indentation in columns of the line `line`
+size_t indent_for(struct Buffer *buff, size_t line);
+
+// Pushes the whitespace of an indentation of `indent` columns to `out`
+void indent_prefix(size_t indent, Str *out);
+
+// Replaces the leading whitespace of the line by an indentation of `indent`
+// columns, the styles of the line are then stale
+// Returns 1 if the line changed
+int indent_line_set(struct Line *l, size_t indent);
+
+#endif
@@ -0,0 +1,111 @@
+#include "journal.h"
+#include "str.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static int JOURNAL_FD = -1;
+// input read during the current iteration of the main loop
+static Vec PENDING_INPUT = VEC_NEW(char, 0);
+
+static int journal_write_record(enum JournalRecordType ty, const void *payload, uint32_t len) {
+    uint8_t type = ty;
+    if(write(JOURNAL_FD, &type, sizeof(type)) != sizeof(type)) return -1;
+    if(write(JOURNAL_FD, &len, sizeof(len)) != sizeof(len)) return -1;
+    if(len && write(JOURNAL_FD, payload, len) != (ssize_t)len) return -1;
+    return 0;
+}
+
+int journal_open(const char *path) {
+    journal_close();
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) return -1;
+    if(write(fd, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) -1) != sizeof(JOURNAL_MAGIC) -1) {
+        close(fd);
+        if(!errno) errno = EIO;
+        return -1;
+    }
+    JOURNAL_FD = fd;
+    return 0;
+}
+
+void journal_close(void) {
+    if(JOURNAL_FD < 0) return;
+    journal_input_flush();
+    close(JOURNAL_FD);
+    JOURNAL_FD = -1;
+    vec_cleanup(&PENDING_INPUT);
+}
+
+void journal_input(const void *bytes, size_t len) {
+    if(JOURNAL_FD < 0 || !len) return;
+    vec_extend(&PENDING_INPUT, bytes, len);
+}
+
+void journal_input_flush(void) {
+    if(JOURNAL_FD < 0 || !PENDING_INPUT.len) return;
+    journal_write_record(JR_INPUT, PENDING_INPUT.buf, PENDING_INPUT.len);
+    vec_clear(&PENDING_INPUT);
+}
+
+void journal_resize(const struct winsize *ws) {
+    if(JOURNAL_FD < 0) return;
+    // keep the ordering between the input and the resize
+    journal_input_flush();
+    struct JournalResize resize = {
+        .rows = ws->ws_row,
+        .cols = ws->ws_col,
+    };
+    journal_write_record(JR_RESIZE, &resize, sizeof(resize));
+}
+
+FILE* journal_reader_open(const char *path) {
+    FILE *f = fopen(path, "r");
+    if(!f) return 0;
+    char magic[sizeof(JOURNAL_MAGIC) -1] = {0};
+    if(fread(magic, 1, sizeof(magic), f) != sizeof(magic)
+            || memcmp(magic, JOURNAL_MAGIC, sizeof(magic))) {
+        fclose(f);
+        errno = EINVAL;
+        return 0;
+    }
+    return f;
+}
+
+int journal_read(FILE *f, struct JournalRecord *rec) {
+    uint8_t type = 0;
+    uint32_t len = 0;
+    if(!rec->payload.type_size) rec->payload = VEC_NEW(char, 0);
+
+    if(fread(&type, sizeof(type), 1, f) != 1) {
+        if(ferror(f)) return -1;
+        return 0;
+    }
+    if(fread(&len, sizeof(len), 1, f) != 1) goto truncated;
+
+    vec_clear(&rec->payload);
+    if(len) {
+        vec_grow_to_fit(&rec->payload, len);
+        if(fread(rec->payload.buf, 1, len, f) != len) goto truncated;
+        rec->payload.len = len;
+    }
+
+    switch(type) {
+        case JR_INPUT:
+            break;
+        case JR_RESIZE:
+            if(len != sizeof(struct JournalResize)) goto truncated;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    rec->ty = type;
+    return 1;
+
+    truncated:
+        errno = ferror(f) ? EIO : EINVAL;
+        return -1;
+}
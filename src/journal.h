@@ -0,0 +1,69 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+
+#include "str.h"
+
+// A journal is the raw input of a session, it can be replayed
+// deterministically by `bench_replay`.
+//
+// Layout:
+//  JOURNAL_MAGIC
+//  followed by records: <uint8_t type><uint32_t payload len><payload>
+
+#define JOURNAL_MAGIC "cjr1"
+
+enum JournalRecordType {
+    // raw bytes read from the terminal during one iteration of the main loop
+    JR_INPUT = 1,
+    // payload is `struct JournalResize`
+    JR_RESIZE = 2,
+};
+
+struct JournalResize {
+    uint16_t rows;
+    uint16_t cols;
+};
+
+struct JournalRecord {
+    enum JournalRecordType ty;
+    // raw payload of the record
+    Vec payload;
+};
+
+// Starts recording to `path`, the file is truncated
+// Returns:
+//  0 on success
+//  -1 on error and sets `errno`
+int journal_open(const char *path);
+
+// Stops recording, does nothing if no journal is open
+void journal_close(void);
+
+// Buffers bytes read from the terminal, does nothing if no journal is open
+void journal_input(const void *bytes, size_t len);
+
+// Writes the input buffered since the last call as a single record
+void journal_input_flush(void);
+
+void journal_resize(const struct winsize *ws);
+
+// Opens a journal for reading and checks its magic
+// Returns:
+//  Non zero on success
+//  0 on error and sets `errno`
+FILE* journal_reader_open(const char *path);
+
+// `rec` has to be null initialised before the first call, its payload is
+// reused between calls
+// Returns:
+//  1 when a record was read
+//  0 at the end of the journal
+//  -1 on error and sets `errno`
+int journal_read(FILE *f, struct JournalRecord *rec);
+
+#endif
@@ -1,12 +1,13 @@
 #include "line.h"
 
 #include <stdint.h>
+#include "highlight.h"
 #include "vt.h"
 
 struct Line line_new(void) {
     struct Line l = {0};
     l.text = str_new();
-    l.style_ids = VEC_NEW(uint8_t, 0);
+    l.spans = VEC_NEW(struct StyleSpan, 0);
     return l;
 }
 
@@ -20,18 +21,126 @@ struct Line line_from_cstr(char *s) {
 
 void line_free(struct Line *l) {
     str_free(&l->text);
-    vec_cleanup(&l->style_ids);
+    vec_cleanup(&l->spans);
 }
 
+size_t line_span_find(const struct Line *l, size_t idx) {
+    const struct StyleSpan *spans = l->spans.buf;
+    size_t lo = 0;
+    size_t hi = l->spans.len;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if((size_t)spans[mid].start + spans[mid].len <= idx) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+uint16_t line_style_at(const struct Line *l, size_t idx) {
+    size_t i = line_span_find(l, idx);
+    if(i == l->spans.len) return STYLE_ID_NONE;
+    const struct StyleSpan *span = VEC_GET(struct StyleSpan, &l->spans, i);
+    return span->start <= idx ? span->id : STYLE_ID_NONE;
+}
+
+void line_span_push(struct Line *l, size_t start, size_t len, uint16_t id) {
+    if(l->spans.len) {
+        struct StyleSpan *last = VEC_GET(struct StyleSpan, &l->spans, l->spans.len - 1);
+        if(last->id == id && last->start + last->len == start) {
+            size_t room = UINT16_MAX - last->len;
+            size_t taken = len < room ? len : room;
+            last->len += taken;
+            start += taken;
+            len -= taken;
+        }
+    }
+    // the spans longer than a span can be are split
+    while(len) {
+        size_t taken = len < UINT16_MAX ? len : UINT16_MAX;
+        struct StyleSpan span = {
+            .start = start,
+            .len = taken,
+            .id = id,
+        };
+        vec_push(&l->spans, &span);
+        start += taken;
+        len -= taken;
+    }
+}
+
+// Moves the spans after the character `idx` by the `count` characters
+// inserted there, the span around them grows with them
+static void line_spans_insert(struct Line *l, size_t idx, size_t count) {
+    size_t around = l->spans.len;
+    for(size_t i = line_span_find(l, idx); i < l->spans.len; i++) {
+        struct StyleSpan *span = VEC_GET(struct StyleSpan, &l->spans, i);
+        if(span->start >= idx) span->start += count;
+        else around = i;
+    }
+    if(around == l->spans.len) return;
+
+    struct StyleSpan *span = VEC_GET(struct StyleSpan, &l->spans, around);
+    size_t len = span->len + count;
+    span->len = len < UINT16_MAX ? len : UINT16_MAX;
+    // the rest is split in spans after it, like `line_span_push` does
+    struct StyleSpan rest = {
+        .start = span->start + span->len,
+        .id = span->id,
+    };
+    len -= span->len;
+    for(size_t i = around + 1; len; i++) {
+        rest.len = len < UINT16_MAX ? len : UINT16_MAX;
+        vec_insert_range(&l->spans, i, &rest, 1);
+        rest.start += rest.len;
+        len -= rest.len;
+    }
+}
+
+// Removes the characters [idx, idx+count) from the spans and moves the
+// spans after them back
+static void line_spans_remove(struct Line *l, size_t idx, size_t count) {
+    size_t end = idx + count;
+    size_t kept = line_span_find(l, idx);
+    for(size_t i = kept; i < l->spans.len; i++) {
+        struct StyleSpan span = *VEC_GET(struct StyleSpan, &l->spans, i);
+        size_t start = span.start;
+        size_t span_end = start + span.len;
+        // the parts of the span before and after the removed characters
+        size_t head = start < idx ? idx - start : 0;
+        size_t tail = span_end > end ? span_end - (start > end ? start : end) : 0;
+        if(!head && !tail) continue;
+        span.start = start < idx ? start : (start >= end ? start - count : idx);
+        span.len = head + tail;
+        *VEC_GET(struct StyleSpan, &l->spans, kept) = span;
+        kept++;
+    }
+    l->spans.len = kept;
+}
+
+// render width of the `count` characters starting at character `idx`
+static size_t line_width_of(struct Line *l, size_t idx, size_t count) {
+    Str tail = str_tail(&l->text, idx);
+    return render_width(&tail, count);
+}
+
+// the width is updated with the inserted characters only so that repeated
+// edits do not rescan the whole line
 int line_insert_at(struct Line *l, size_t idx, const char *s, size_t len) {
+    size_t old_len = str_len(&l->text);
     int ret = str_insert_at(&l->text, idx, s, len);
-    l->render_width = render_width(&l->text, str_len(&l->text));
+    if(str_len(&l->text) > old_len) line_spans_insert(l, idx, str_len(&l->text) - old_len);
+    if(ret) {
+        l->render_width = render_width(&l->text, str_len(&l->text));
+        return ret;
+    }
+    l->render_width += line_width_of(l, idx, str_len(&l->text) - old_len);
     return ret;
 }
 
 void line_clear(struct Line *l) {
     l->render_width = 0;
     str_clear(&l->text);
+    vec_clear(&l->spans);
 }
 
 void line_trunc(struct Line *l, size_t idx) {
@@ -39,6 +148,16 @@ void line_trunc(struct Line *l, size_t idx) {
     size_t trunked_width = render_width(&tail, str_len(&tail));
     str_trunc(&l->text, idx);
     l->render_width -= trunked_width;
+
+    size_t i = line_span_find(l, idx);
+    if(i < l->spans.len) {
+        struct StyleSpan *span = VEC_GET(struct StyleSpan, &l->spans, i);
+        if(span->start < idx) {
+            span->len = idx - span->start;
+            i++;
+        }
+        l->spans.len = i;
+    }
 }
 
 struct Line line_head(struct Line *l, size_t idx) {
@@ -46,7 +165,7 @@ struct Line line_head(struct Line *l, size_t idx) {
     size_t head_width = render_width(&head, str_len(&head));
     return (struct Line) {
         .text = head,
-        .style_ids = l->style_ids,
+        .spans = l->spans,
         .render_width = head_width,
     };
 }
@@ -56,19 +175,107 @@ struct Line line_tail(struct Line *l, size_t idx) {
     size_t tail_width = render_width(&tail, str_len(&tail));
     return (struct Line) {
         .text = tail,
-        .style_ids = l->style_ids,
+        .spans = l->spans,
         .render_width = tail_width,
     };
 }
 
 int line_remove(struct Line *l, size_t start, size_t end) {
+    size_t removed_width = 0;
+    if(end < str_len(&l->text)) {
+        removed_width = line_width_of(l, start, end - start + 1);
+    }
+    size_t old_len = str_len(&l->text);
     int ret = str_remove(&l->text, start, end);
-    l->render_width = render_width(&l->text, str_len(&l->text));
+    if(str_len(&l->text) < old_len) line_spans_remove(l, start, old_len - str_len(&l->text));
+    if(ret) {
+        l->render_width = render_width(&l->text, str_len(&l->text));
+        return ret;
+    }
+    l->render_width -= removed_width;
     return ret;
 }
 
 int line_append(struct Line *l, const char *s, size_t len) {
+    size_t old_len = str_len(&l->text);
     int ret = str_push(&l->text, s, len);
-    l->render_width = render_width(&l->text, str_len(&l->text));
+    if(ret) {
+        l->render_width = render_width(&l->text, str_len(&l->text));
+        return ret;
+    }
+    l->render_width += line_width_of(l, old_len, str_len(&l->text) - old_len);
     return ret;
 }
+
+#ifdef TESTING
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "xalloc.h"
+
+// Returns the spans of the line formatted as "start:len:id,..."
+static char *line_test_spans(const struct Line *l) {
+    static char out[256];
+    size_t off = 0;
+    out[0] = 0;
+    for(size_t i = 0; i < l->spans.len; i++) {
+        struct StyleSpan *span = VEC_GET(struct StyleSpan, &l->spans, i);
+        off += snprintf(out + off, sizeof(out) - off, "%s%u:%u:%u", i ? "," : "", span->start, span->len, span->id);
+    }
+    return out;
+}
+
+TESTS_START
+
+TEST_DEF(test_line_spans)
+    struct Line l = line_from_cstr("int abc = 42;");
+    line_span_push(&l, 0, 3, 1);
+    line_span_push(&l, 10, 2, 2);
+    // adjacent spans of the same style are merged
+    line_span_push(&l, 12, 1, 2);
+    TEST_ASSERT(!strcmp(line_test_spans(&l), "0:3:1,10:3:2"));
+    TEST_ASSERT(line_style_at(&l, 2) == 1);
+    TEST_ASSERT(line_style_at(&l, 3) == STYLE_ID_NONE);
+    TEST_ASSERT(line_style_at(&l, 11) == 2);
+    TEST_ASSERT(line_style_at(&l, 13) == STYLE_ID_NONE);
+    TEST_ASSERT(line_span_find(&l, 5) == 1);
+
+    // the characters inserted in a span take its style
+    line_insert_at(&l, 1, "xx", 2);
+    TEST_ASSERT(!strcmp(line_test_spans(&l), "0:5:1,12:3:2"));
+    line_insert_at(&l, 12, "-", 1);
+    TEST_ASSERT(!strcmp(line_test_spans(&l), "0:5:1,13:3:2"));
+
+    // removing "xnt abc = -4" cuts both spans
+    line_remove(&l, 2, 13);
+    TEST_ASSERT(!strcmp(str_as_cstr(&l.text), "ix2;"));
+    TEST_ASSERT(!strcmp(line_test_spans(&l), "0:2:1,2:2:2"));
+    line_remove(&l, 0, 1);
+    TEST_ASSERT(!strcmp(line_test_spans(&l), "0:2:2"));
+
+    line_trunc(&l, 1);
+    TEST_ASSERT(!strcmp(line_test_spans(&l), "0:1:2"));
+    line_clear(&l);
+    TEST_ASSERT(!l.spans.len);
+
+    // spans too long for one are split
+    line_span_push(&l, 0, UINT16_MAX + 10, 3);
+    TEST_ASSERT(l.spans.len == 2);
+    TEST_ASSERT(line_style_at(&l, UINT16_MAX + 5) == 3);
+    // and so are the ones growing too long
+    line_clear(&l);
+    char *text = xcalloc(UINT16_MAX, 1);
+    memset(text, 'a', UINT16_MAX - 1);
+    line_insert_at(&l, 0, text, UINT16_MAX - 1);
+    line_span_push(&l, 0, UINT16_MAX - 1, 4);
+    line_insert_at(&l, 10, "xyz", 3);
+    TEST_ASSERT(!strcmp(line_test_spans(&l), "0:65535:4,65535:2:4"));
+    xfree(text);
+    line_free(&l);
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
@@ -3,11 +3,23 @@
 
 #include "str.h"
 
+#include <stdint.h>
+
+// Characters [start, start+len) drawn with the style `id`
+struct StyleSpan {
+    uint32_t start;
+    uint16_t len;
+    uint16_t id;
+};
+
 struct Line {
     Str text;
     size_t render_width;
-    // `Vec` of `uint8_t`
-    Vec style_ids;
+    // `Vec` of `StyleSpan` sorted by start, they do not overlap and the
+    // characters outside of them have no style
+    Vec spans;
+    // state of the lexer at the start of the next line, see syntax.h
+    uint8_t syntax_state;
 };
 
 struct Line line_new(void);
@@ -32,5 +44,15 @@ int line_remove(struct Line *l, size_t start, size_t end);
 
 int line_append(struct Line *l, const char *s, size_t len);
 
+// Styles the characters [start, start+len), they must come after the
+// last span, it is extended if it ends at `start` with the same style
+void line_span_push(struct Line *l, size_t start, size_t len, uint16_t id);
+
+// Returns the index of the first span ending after the character `idx`
+size_t line_span_find(const struct Line *l, size_t idx);
+
+// Returns the style id of the character `idx`, `STYLE_ID_NONE` if it has none
+uint16_t line_style_at(const struct Line *l, size_t idx);
+
 #endif
 
@@ -13,6 +13,9 @@
 #include "vt.h"
 #include "editor.h"
 #include "utf.h"
+#include "journal.h"
+#include "exec.h"
+#include "grep.h"
 
 #include <sanitizer/asan_interface.h>
 
@@ -65,6 +68,20 @@ void cleanup_exit(int _i __attribute__((unused))) {
     _exit(1);
 }
 
+static volatile sig_atomic_t INTERRUPTED = 0;
+
+// <C-c> cancels the running shell commands and `:grep`, or exits when there
+// are none
+void on_interrupt(int i) {
+    // a filter blocks the main loop, it has to be killed from here
+    if(exec_filter_cancel()) return;
+    if(exec_jobs_running() || grep_running()) {
+        INTERRUPTED = 1;
+        return;
+    }
+    cleanup_exit(i);
+}
+
 // i parameter is ignored
 void on_resize(int i) {
     (void)i;
@@ -82,18 +99,37 @@ int handle_keys(void) {
     int ret = 0;
     while((ret = readkey(STDIN_FILENO, &e)) > 0) {
         had_key = 1;
-        struct ModeInterface mode = mode_current();
-        mode.handle_key(&e);
+        editor_handle_key(&e);
         memset(&e, 0, sizeof(struct KeyEvent));
     }
     if(ret == -1) return -1;
     return had_key;
 }
 
-int main(int argc, const char **argv) {
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-j journal] [file...]\n", name);
+    fprintf(stderr, "  -j journal  record the input of the session to `journal`\n");
+}
+
+int main(int argc, char **argv) {
     __sanitizer_set_report_path("./asan.log");
 
     // parse options
+    int opt = 0;
+    while((opt = getopt(argc, argv, "j:")) != -1) {
+        switch(opt) {
+            case 'j':
+                if(journal_open(optarg)) {
+                    perror("unable to open journal");
+                    exit(1);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+
     load_locale();
 
     // register cleanup
@@ -120,7 +156,7 @@ int main(int argc, const char **argv) {
 
     term_init();
 
-    for(int i = 1; i < argc; i++) {
+    for(int i = optind; i < argc; i++) {
         struct Buffer *buff = calloc(1, sizeof(struct Buffer));
         if(!buffer_init_from_path(buff, argv[i], FM_RW)) {}
         // try to open the file as readonly
@@ -147,18 +183,49 @@ int main(int argc, const char **argv) {
     // register a function that restores the state of the terminal
     // on exit signals
     signal(SIGTERM, cleanup_exit);
-    signal(SIGINT, cleanup_exit);
+    signal(SIGINT, on_interrupt);
+    // a command exiting before reading all of its input must not kill the
+    // editor, the write fails with EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
 
     editor_init();
 
+    journal_resize(&WS);
     editor_render(&WS);
     int ret;
     while(RUNNING) {
+        // record the resize before the keys read after it
+        if(REDRAW) journal_resize(&WS);
+        if(INTERRUPTED) {
+            INTERRUPTED = 0;
+            exec_jobs_cancel();
+            grep_cancel();
+        }
+        // stream the output of the running shell commands
+        if(exec_jobs_poll()) REDRAW = 1;
+        // search and highlight the rest of a big buffer a slice at a time,
+        // and the files of a running `:grep`
+        int searching = editor_search_poll();
+        searching |= editor_syntax_poll();
+        searching |= grep_poll();
+        if(searching) REDRAW = 1;
         if((ret = handle_keys())  || REDRAW) {
             assert(ret >= 0 && "bad keys");
+            journal_input_flush();
             REDRAW = 0;
             editor_render(&WS);
         }
+        if(!searching) usleep(CONFIG.poll_delay);
+    }
+    journal_close();
+    // let the silent commands (ie: onsave hooks) finish, <C-c> cancels them
+    exec_jobs_shutdown();
+    while(exec_jobs_running()) {
+        if(INTERRUPTED) {
+            INTERRUPTED = 0;
+            exec_jobs_cancel();
+        }
+        exec_jobs_poll();
         usleep(CONFIG.poll_delay);
     }
     editor_teardown();
@@ -0,0 +1,88 @@
+#include "overlay.h"
+
+struct Overlay overlay_new(void) {
+    return (struct Overlay) {
+        .spans = VEC_NEW(struct OverlaySpan, 0),
+    };
+}
+
+void overlay_free(struct Overlay *ov) {
+    vec_cleanup(&ov->spans);
+}
+
+// Returns the index of the first span at or after (line, col)
+static size_t overlay_find_pos(const struct Overlay *ov, size_t line, size_t col) {
+    const struct OverlaySpan *spans = ov->spans.buf;
+    size_t lo = 0;
+    size_t hi = ov->spans.len;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(spans[mid].line < line || (spans[mid].line == line && spans[mid].col < col)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+size_t overlay_find(const struct Overlay *ov, size_t line) {
+    return overlay_find_pos(ov, line, 0);
+}
+
+void overlay_add(struct Overlay *ov, size_t line, size_t col, size_t len, uint16_t id) {
+    if(!ov->spans.type_size) *ov = overlay_new();
+    struct OverlaySpan span = {
+        .line = line,
+        .col = col,
+        .len = len,
+        .id = id,
+    };
+    vec_insert_range(&ov->spans, overlay_find_pos(ov, line, col + 1), &span, 1);
+}
+
+void overlay_clear(struct Overlay *ov) {
+    vec_clear(&ov->spans);
+}
+
+void overlay_update(struct Overlay *ov, size_t start, size_t removed, size_t added) {
+    size_t lo = overlay_find(ov, start);
+    size_t hi = overlay_find(ov, start + removed);
+    vec_remove_range(&ov->spans, lo, hi - lo);
+    for(size_t i = lo; i < ov->spans.len; i++) {
+        struct OverlaySpan *span = VEC_GET(struct OverlaySpan, &ov->spans, i);
+        span->line = span->line - removed + added;
+    }
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+
+TESTS_START
+
+TEST_DEF(test_overlay)
+    struct Overlay ov = {0};
+    overlay_add(&ov, 4, 2, 3, 1);
+    overlay_add(&ov, 1, 0, 1, 1);
+    overlay_add(&ov, 4, 0, 1, 2);
+    overlay_add(&ov, 9, 0, 1, 3);
+    TEST_ASSERT(ov.spans.len == 4);
+    TEST_ASSERT(overlay_find(&ov, 2) == 1);
+    struct OverlaySpan *span = VEC_GET(struct OverlaySpan, &ov.spans, 1);
+    TEST_ASSERT(span->line == 4 && span->col == 0);
+
+    // the spans of the replaced lines are dropped, the ones after are moved
+    overlay_update(&ov, 3, 2, 5);
+    TEST_ASSERT(ov.spans.len == 2);
+    span = VEC_GET(struct OverlaySpan, &ov.spans, 1);
+    TEST_ASSERT(span->line == 12 && span->id == 3);
+    overlay_update(&ov, 0, 0, 1);
+    span = VEC_GET(struct OverlaySpan, &ov.spans, 0);
+    TEST_ASSERT(span->line == 2);
+
+    overlay_clear(&ov);
+    TEST_ASSERT(overlay_find(&ov, 0) == 0);
+    overlay_free(&ov);
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
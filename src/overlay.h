@@ -0,0 +1,56 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "str.h"
+
+// The styles drawn over the text come from layers, each keeping its own
+// spans, they are merged one row at a time when it is drawn, the later
+// layers over the earlier ones. Updating a layer never touches the others.
+enum OverlayLayer {
+    // `Line.spans`, set by the lexer
+    OVERLAY_SYNTAX = 0,
+    // `Buffer.diagnostics`
+    OVERLAY_DIAGNOSTICS,
+    // the matches of the active search
+    OVERLAY_SEARCH,
+    // the pair of brackets around the cursor
+    OVERLAY_BRACKETS,
+    // the selection of the view
+    OVERLAY_SELECTION,
+    OVERLAY_LAYERS,
+};
+
+struct OverlaySpan {
+    size_t line;
+    // in characters
+    size_t col;
+    size_t len;
+    uint16_t id;
+};
+
+// A layer of styled ranges of a buffer that is not rebuilt by the lexer
+struct Overlay {
+    // `Vec` of `OverlaySpan` sorted by position
+    Vec spans;
+};
+
+struct Overlay overlay_new(void);
+
+void overlay_free(struct Overlay *ov);
+
+// Adds a span, the spans of a layer may overlap
+void overlay_add(struct Overlay *ov, size_t line, size_t col, size_t len, uint16_t id);
+
+void overlay_clear(struct Overlay *ov);
+
+// Returns the index of the first span on or after line `line`
+size_t overlay_find(const struct Overlay *ov, size_t line);
+
+// Drops the spans of the lines [start, start+removed) that got replaced by
+// the lines [start, start+added) and moves the ones after them
+void overlay_update(struct Overlay *ov, size_t start, size_t removed, size_t added);
+
+#endif
@@ -0,0 +1,180 @@
+#include "pattern.h"
+#include "rx.h"
+#include "search.h"
+#include "str.h"
+#include "xalloc.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// number of patterns the cache keeps alive
+#define PATTERN_CACHE_SIZE 32
+
+// `Vec` of `struct Pattern*` from the least to the most recently used, the
+// cache holds a reference to each of them
+static Vec CACHE = {0};
+
+static uint64_t pattern_hash(const char *source, int cflags) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull ^ (uint64_t)cflags;
+    for(const char *s = source; *s; s++) {
+        hash ^= (unsigned char)*s;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static struct Pattern *pattern_compile(const char *source, int cflags, uint64_t hash) {
+    struct Pattern *p = xcalloc(1, sizeof(struct Pattern));
+    p->source = strdup(source);
+    p->cflags = cflags;
+    p->hash = hash;
+    p->rc = 1;
+
+    p->regex = xmalloc(sizeof(regex_t));
+    p->error = regcomp(p->regex, source, cflags);
+    if(p->error) {
+        p->error_str = xcalloc(128, sizeof(char));
+        regerror(p->error, p->regex, p->error_str, 127);
+        return p;
+    }
+    p->workers = 1;
+
+    // the other engines only handle the default syntax
+    if(cflags) return p;
+    p->literal = search_is_literal(source);
+    if(!p->literal) p->prog = rx_compile(source);
+    if(p->prog) {
+        p->rx = xmalloc(sizeof(struct Rx*));
+        p->rx[0] = rx_new(p->prog);
+    }
+    return p;
+}
+
+static void pattern_free(struct Pattern *p) {
+    for(size_t i = 0; i < p->workers; i++) {
+        regfree(&p->regex[i]);
+        if(p->rx) rx_free(p->rx[i]);
+    }
+    xfree(p->regex);
+    xfree(p->rx);
+    rx_prog_free(p->prog);
+    xfree(p->error_str);
+    xfree(p->source);
+    xfree(p);
+}
+
+struct Pattern *pattern_get(const char *source, int cflags) {
+    if(!CACHE.type_size) CACHE = VEC_NEW(struct Pattern*, 0);
+
+    uint64_t hash = pattern_hash(source, cflags);
+    for(size_t i = CACHE.len; i > 0; i--) {
+        struct Pattern *p = *VEC_GET(struct Pattern*, &CACHE, i - 1);
+        if(p->hash != hash || p->cflags != cflags || strcmp(p->source, source)) continue;
+        // move it to the most recently used end
+        vec_remove(&CACHE, i - 1);
+        vec_push(&CACHE, &p);
+        return pattern_rc_inc(p);
+    }
+
+    struct Pattern *p = pattern_compile(source, cflags, hash);
+    if(CACHE.len == PATTERN_CACHE_SIZE) {
+        pattern_rc_dec(*VEC_GET(struct Pattern*, &CACHE, 0));
+        vec_remove(&CACHE, 0);
+    }
+    vec_push(&CACHE, &p);
+    return pattern_rc_inc(p);
+}
+
+struct Pattern *pattern_rc_inc(struct Pattern *p) {
+    p->rc += 1;
+    return p;
+}
+
+void pattern_rc_dec(struct Pattern *p) {
+    if(!p) return;
+    assert(p->rc && "pattern freed twice");
+    p->rc -= 1;
+    if(!p->rc) pattern_free(p);
+}
+
+int pattern_workers(struct Pattern *p, size_t workers) {
+    if(p->error) return -1;
+    if(workers <= p->workers) return 0;
+
+    p->regex = xrealloc(p->regex, workers * sizeof(regex_t));
+    if(p->rx) p->rx = xrealloc(p->rx, workers * sizeof(struct Rx*));
+    while(p->workers < workers) {
+        if(regcomp(&p->regex[p->workers], p->source, p->cflags)) return -1;
+        if(p->rx) p->rx[p->workers] = rx_new(p->prog);
+        p->workers += 1;
+    }
+    return 0;
+}
+
+regex_t *pattern_regex(struct Pattern *p, size_t worker) {
+    if(p->error) return 0;
+    assert(worker < p->workers && "`pattern_workers` was not called");
+    return &p->regex[worker];
+}
+
+struct Rx *pattern_rx(struct Pattern *p, size_t worker) {
+    if(!p->rx) return 0;
+    assert(worker < p->workers && "`pattern_workers` was not called");
+    return p->rx[worker];
+}
+
+void pattern_cache_clear(void) {
+    for(size_t i = 0; i < CACHE.len; i++) {
+        pattern_rc_dec(*VEC_GET(struct Pattern*, &CACHE, i));
+    }
+    vec_cleanup(&CACHE);
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+
+TESTS_START
+
+TEST_DEF(test_pattern_cache)
+    struct Pattern *a = pattern_get("fo*", 0);
+    TEST_ASSERT(!a->error);
+    TEST_ASSERT(a->prog && pattern_rx(a, 0));
+    // the same pattern is not compiled again
+    struct Pattern *b = pattern_get("fo*", 0);
+    TEST_ASSERT(a == b);
+    struct Pattern *icase = pattern_get("fo*", REG_ICASE);
+    TEST_ASSERT(icase != a);
+    pattern_rc_dec(icase);
+    pattern_rc_dec(b);
+
+    struct Pattern *bad = pattern_get("\\(", 0);
+    TEST_ASSERT(bad->error && bad->error_str);
+    TEST_ASSERT(!pattern_regex(bad, 0));
+    TEST_ASSERT(pattern_workers(bad, 4) == -1);
+    pattern_rc_dec(bad);
+
+    TEST_ASSERT(!pattern_workers(a, 4));
+    TEST_ASSERT(pattern_rx(a, 3) && pattern_rx(a, 3) != pattern_rx(a, 0));
+    TEST_ASSERT(!regexec(pattern_regex(a, 3), "foo", 0, 0, 0));
+
+    // the least recently used pattern is dropped, the ones in use stay valid
+    char source[16];
+    for(size_t i = 0; i < PATTERN_CACHE_SIZE; i++) {
+        snprintf(source, sizeof(source), "p%zu", i);
+        pattern_rc_dec(pattern_get(source, 0));
+    }
+    TEST_ASSERT(a->rc == 1);
+    struct Pattern *c = pattern_get("fo*", 0);
+    TEST_ASSERT(c != a);
+    TEST_ASSERT(!strcmp(a->source, "fo*"));
+    pattern_rc_dec(a);
+    pattern_rc_dec(c);
+    pattern_cache_clear();
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
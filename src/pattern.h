@@ -0,0 +1,66 @@
+#ifndef PATTERN_H
+#define PATTERN_H 1
+
+#include <regex.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A pattern compiled once and shared by everything searching for it (the
+// searches of every buffer, substitutions and `:grep`). The patterns used
+// last are kept in a cache so that searching for them again, from any
+// buffer, does not compile them again.
+//
+// The cache is only used from the main thread, the copies of a pattern
+// returned by `pattern_regex` and `pattern_rx` are the ones the tasks of
+// the pool can use.
+struct Pattern {
+    char *source;
+    // `regcomp` flags
+    int cflags;
+    uint64_t hash;
+    // 0 if the pattern compiled, the `regcomp` error otherwise
+    int error;
+    // message of `error`, null if there is none
+    char *error_str;
+    // `source` has no special characters, it only matches itself and can be
+    // searched with `search_literal`
+    _Bool literal;
+    // `source` compiled by the built-in engine, null if it does not support
+    // it
+    struct RxProg *prog;
+    // one copy per worker, regexec serialises the threads sharing a
+    // `regex_t` and a `Rx` must not be shared, the first ones are created
+    // with the pattern
+    regex_t *regex;
+    struct Rx **rx;
+    size_t workers;
+    size_t rc;
+};
+
+// Returns the pattern for `source` compiled with `cflags`, from the cache if
+// it was used recently, with its reference count incremented
+// The pattern is returned even if it is invalid, see `error`
+struct Pattern *pattern_get(const char *source, int cflags);
+
+struct Pattern *pattern_rc_inc(struct Pattern *p);
+
+void pattern_rc_dec(struct Pattern *p);
+
+// Creates the copies of the pattern for the workers [0, workers), must be
+// called before the tasks using them run
+// Returns -1 if the pattern is invalid
+int pattern_workers(struct Pattern *p, size_t workers);
+
+// The copy of `regex_t` of `worker`, null if the pattern is invalid
+// Outside of the tasks of the pool the main thread uses the worker 0
+regex_t *pattern_regex(struct Pattern *p, size_t worker);
+
+// The `Rx` of `worker`, null if the built-in engine does not support the
+// pattern
+struct Rx *pattern_rx(struct Pattern *p, size_t worker);
+
+// Drops the patterns of the cache, the ones still referenced are freed by
+// their last `pattern_rc_dec`
+void pattern_cache_clear(void);
+
+#endif
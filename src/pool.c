@@ -0,0 +1,175 @@
+#include "pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+// upper bound of the number of worker threads
+#define POOL_MAX_WORKERS 64
+
+static struct {
+    pthread_mutex_t lock;
+    // signaled when a new batch is available or when stopping
+    pthread_cond_t work_ready;
+    // signaled when the last worker is done with the batch
+    pthread_cond_t work_done;
+    pthread_t threads[POOL_MAX_WORKERS];
+    size_t workers;
+    _Bool started;
+    _Bool stopping;
+    _Bool running;
+    // incremented for every batch so the workers can tell them apart
+    unsigned long generation;
+    // workers still busy with the current batch
+    size_t active;
+
+    pool_task_fn *task;
+    void *data;
+    size_t count;
+    // index of the next task to hand out
+    atomic_size_t next;
+} POOL = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_ready = PTHREAD_COND_INITIALIZER,
+    .work_done = PTHREAD_COND_INITIALIZER,
+};
+
+// Runs tasks from the current batch until there are none left
+static void pool_drain(size_t worker) {
+    size_t idx;
+    while((idx = atomic_fetch_add(&POOL.next, 1)) < POOL.count) {
+        POOL.task(POOL.data, idx, worker);
+    }
+}
+
+static void *pool_worker(void *arg) {
+    size_t worker = (size_t)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&POOL.lock);
+    for(;;) {
+        while(!POOL.stopping && POOL.generation == seen) {
+            pthread_cond_wait(&POOL.work_ready, &POOL.lock);
+        }
+        if(POOL.stopping) break;
+        seen = POOL.generation;
+        pthread_mutex_unlock(&POOL.lock);
+
+        pool_drain(worker);
+
+        pthread_mutex_lock(&POOL.lock);
+        POOL.active -= 1;
+        if(!POOL.active) pthread_cond_signal(&POOL.work_done);
+    }
+    pthread_mutex_unlock(&POOL.lock);
+    return 0;
+}
+
+static void pool_start(void) {
+    POOL.started = 1;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    // the calling thread takes part in every batch
+    size_t wanted = cores > 1 ? (size_t)cores - 1 : 0;
+    if(wanted > POOL_MAX_WORKERS) wanted = POOL_MAX_WORKERS;
+
+    // signals are for the main thread, the workers inherit this mask
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for(size_t i = 0; i < wanted; i++) {
+        if(pthread_create(&POOL.threads[i], 0, pool_worker, (void*)i)) break;
+        POOL.workers += 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+}
+
+size_t pool_size(void) {
+    if(!POOL.started) pool_start();
+    return POOL.workers + 1;
+}
+
+void pool_run(pool_task_fn *task, void *data, size_t count) {
+    if(!count) return;
+    if(!POOL.started) pool_start();
+    assert(!POOL.running && "pool_run called from a task");
+
+    // the calling thread uses the last worker id
+    size_t self = POOL.workers;
+
+    if(count == 1 || !POOL.workers) {
+        for(size_t i = 0; i < count; i++) task(data, i, self);
+        return;
+    }
+
+    pthread_mutex_lock(&POOL.lock);
+    POOL.running = 1;
+    POOL.task = task;
+    POOL.data = data;
+    POOL.count = count;
+    atomic_store(&POOL.next, 0);
+    POOL.active = POOL.workers;
+    POOL.generation += 1;
+    pthread_cond_broadcast(&POOL.work_ready);
+    pthread_mutex_unlock(&POOL.lock);
+
+    pool_drain(self);
+
+    pthread_mutex_lock(&POOL.lock);
+    while(POOL.active) {
+        pthread_cond_wait(&POOL.work_done, &POOL.lock);
+    }
+    POOL.running = 0;
+    pthread_mutex_unlock(&POOL.lock);
+}
+
+void pool_shutdown(void) {
+    if(!POOL.started) return;
+
+    pthread_mutex_lock(&POOL.lock);
+    POOL.stopping = 1;
+    pthread_cond_broadcast(&POOL.work_ready);
+    pthread_mutex_unlock(&POOL.lock);
+
+    for(size_t i = 0; i < POOL.workers; i++) {
+        pthread_join(POOL.threads[i], 0);
+    }
+    POOL.workers = 0;
+    POOL.started = 0;
+    POOL.stopping = 0;
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+
+static void pool_test_task(void *data, size_t idx, size_t worker) {
+    atomic_size_t *counts = data;
+    (void)worker;
+    atomic_fetch_add(&counts[idx], idx + 1);
+}
+
+TESTS_START
+
+TEST_DEF(test_pool_run)
+    atomic_size_t counts[1000];
+    for(size_t i = 0; i < 1000; i++) atomic_init(&counts[i], 0);
+
+    pool_run(pool_test_task, counts, 1000);
+    pool_run(pool_test_task, counts, 1000);
+
+    _Bool all_ran_twice = 1;
+    for(size_t i = 0; i < 1000; i++) {
+        if(atomic_load(&counts[i]) != 2 * (i + 1)) all_ran_twice = 0;
+    }
+    TEST_ASSERT(all_ran_twice);
+    TEST_ASSERT(pool_size() >= 1);
+    pool_shutdown();
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
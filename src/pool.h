@@ -0,0 +1,26 @@
+#ifndef POOL_H
+#define POOL_H 1
+
+#include <stddef.h>
+
+// A fixed set of worker threads, one per core, that run batches of
+// independent tasks. The threads are spawned on the first `pool_run`.
+
+// Runs a single task
+//  `idx` is the index of the task in the batch
+//  `worker` identifies the thread running it, in [0, pool_size()), two tasks
+//  never run at the same time with the same `worker`
+typedef void (pool_task_fn)(void *data, size_t idx, size_t worker);
+
+// Number of distinct `worker` values passed to the tasks
+size_t pool_size(void);
+
+// Runs `task` for every index in [0, count) spread over the workers and the
+// calling thread, returns once they all ran
+// Must not be called from a task
+void pool_run(pool_task_fn *task, void *data, size_t count);
+
+// Stops and joins the worker threads
+void pool_shutdown(void);
+
+#endif
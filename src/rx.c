@@ -0,0 +1,1197 @@
+#include "rx.h"
+#include "utf.h"
+#include "xalloc.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+// upper bound of the instructions of a program, guards against huge
+// intervals like a\{1000\}\{1000\}
+#define RX_MAX_INSTS (1 << 20)
+// the DFA is thrown away and rebuilt from scratch past that many states
+#define RX_MAX_STATES 2048
+
+#define RX_MAX_CODE_POINT 0x10FFFF
+
+// ---- syntax tree ----
+
+enum RxNodeType {
+    RN_EMPTY,
+    // matches one code point in `ranges`
+    RN_SET,
+    RN_CAT,
+    RN_ALT,
+    RN_REPEAT,
+    RN_BOL,
+    RN_EOL,
+};
+
+struct RxRange {
+    uint32_t lo;
+    uint32_t hi;
+};
+
+struct RxNode {
+    enum RxNodeType ty;
+    // RN_SET: `Vec` of `RxRange`
+    Vec ranges;
+    // RN_CAT, RN_ALT: `Vec` of `struct RxNode*`
+    Vec children;
+    // RN_REPEAT: `max` is -1 when unbounded
+    struct RxNode *child;
+    int min;
+    int max;
+};
+
+static struct RxNode *rx_node_new(enum RxNodeType ty) {
+    struct RxNode *node = xcalloc(1, sizeof(struct RxNode));
+    node->ty = ty;
+    node->ranges = VEC_NEW(struct RxRange, 0);
+    node->children = VEC_NEW(struct RxNode*, 0);
+    return node;
+}
+
+static void rx_node_free(struct RxNode *node) {
+    if(!node) return;
+    for(size_t i = 0; i < node->children.len; i++) {
+        rx_node_free(*VEC_GET(struct RxNode*, &node->children, i));
+    }
+    rx_node_free(node->child);
+    vec_cleanup(&node->ranges);
+    vec_cleanup(&node->children);
+    xfree(node);
+}
+
+static struct RxNode *rx_node_char(uint32_t c) {
+    struct RxNode *node = rx_node_new(RN_SET);
+    struct RxRange range = {c, c};
+    vec_push(&node->ranges, &range);
+    return node;
+}
+
+// ---- parser ----
+
+struct RxParser {
+    const char *s;
+    size_t len;
+    size_t pos;
+    // set on a syntax error or an unsupported feature
+    _Bool failed;
+};
+
+static int rx_peek_escape(struct RxParser *p, char c) {
+    return p->pos + 1 < p->len && p->s[p->pos] == '\\' && p->s[p->pos+1] == c;
+}
+
+// Returns 1 if a concatenation ends at `pos`
+static int rx_at_cat_end(struct RxParser *p, size_t pos) {
+    if(pos == p->len) return 1;
+    return pos + 1 < p->len && p->s[pos] == '\\' && (p->s[pos+1] == '|' || p->s[pos+1] == ')');
+}
+
+// Decodes the code point at the current position
+static uint32_t rx_next_char(struct RxParser *p) {
+    utf32 c = 0;
+    int count = utf8_to_utf32(p->s + p->pos, p->len - p->pos, &c);
+    if(count <= 0) {
+        p->failed = 1;
+        p->pos = p->len;
+        return 0;
+    }
+    p->pos += count;
+    return c;
+}
+
+// Sorts and merges overlapping ranges
+static int rx_range_cmp(const void *a, const void *b) {
+    const struct RxRange *ra = a;
+    const struct RxRange *rb = b;
+    return ra->lo < rb->lo ? -1 : ra->lo > rb->lo;
+}
+
+static void rx_ranges_normalise(Vec *ranges) {
+    if(!ranges->len) return;
+    qsort(ranges->buf, ranges->len, sizeof(struct RxRange), rx_range_cmp);
+    struct RxRange *r = ranges->buf;
+    size_t out = 0;
+    for(size_t i = 1; i < ranges->len; i++) {
+        if(r[i].lo <= r[out].hi + 1) {
+            if(r[i].hi > r[out].hi) r[out].hi = r[i].hi;
+        } else {
+            r[++out] = r[i];
+        }
+    }
+    ranges->len = out + 1;
+}
+
+static struct RxNode *rx_parse_bracket(struct RxParser *p) {
+    // skip [
+    p->pos++;
+    struct RxNode *node = rx_node_new(RN_SET);
+    _Bool negate = 0;
+    if(p->pos < p->len && p->s[p->pos] == '^') {
+        negate = 1;
+        p->pos++;
+    }
+
+    _Bool first = 1;
+    for(;;) {
+        if(p->pos >= p->len) {
+            p->failed = 1;
+            return node;
+        }
+        char c = p->s[p->pos];
+        if(c == ']' && !first) {
+            p->pos++;
+            break;
+        }
+        first = 0;
+        if(c == '[' && p->pos + 1 < p->len
+                && (p->s[p->pos+1] == ':' || p->s[p->pos+1] == '=' || p->s[p->pos+1] == '.')) {
+            // named classes and friends depend on the locale
+            p->failed = 1;
+            return node;
+        }
+
+        struct RxRange range;
+        range.lo = rx_next_char(p);
+        range.hi = range.lo;
+        if(p->pos + 1 < p->len && p->s[p->pos] == '-' && p->s[p->pos+1] != ']') {
+            p->pos++;
+            if(p->s[p->pos] == '[') {
+                p->failed = 1;
+                return node;
+            }
+            range.hi = rx_next_char(p);
+            if(range.hi < range.lo) {
+                p->failed = 1;
+                return node;
+            }
+        }
+        if(p->failed) return node;
+        vec_push(&node->ranges, &range);
+    }
+
+    rx_ranges_normalise(&node->ranges);
+    if(negate) {
+        Vec complement = VEC_NEW(struct RxRange, 0);
+        uint32_t next = 0;
+        for(size_t i = 0; i < node->ranges.len; i++) {
+            struct RxRange *r = vec_get(&node->ranges, i);
+            if(r->lo > next) {
+                struct RxRange gap = {next, r->lo - 1};
+                vec_push(&complement, &gap);
+            }
+            next = r->hi + 1;
+        }
+        if(next <= RX_MAX_CODE_POINT) {
+            struct RxRange gap = {next, RX_MAX_CODE_POINT};
+            vec_push(&complement, &gap);
+        }
+        vec_cleanup(&node->ranges);
+        node->ranges = complement;
+    }
+    return node;
+}
+
+// Parses the digits of an interval
+static int rx_parse_int(struct RxParser *p, int *out) {
+    size_t start = p->pos;
+    long n = 0;
+    while(p->pos < p->len && p->s[p->pos] >= '0' && p->s[p->pos] <= '9') {
+        n = n * 10 + (p->s[p->pos] - '0');
+        if(n > 0x7fff) {
+            p->failed = 1;
+            return 0;
+        }
+        p->pos++;
+    }
+    *out = n;
+    return p->pos != start;
+}
+
+static struct RxNode *rx_parse_alt(struct RxParser *p);
+
+// Parses a concatenation up to \| \) or the end of the pattern
+static struct RxNode *rx_parse_cat(struct RxParser *p) {
+    struct RxNode *cat = rx_node_new(RN_CAT);
+    // last atom that can take a repetition, null at the start of the
+    // concatenation and after ^ where * is a plain character
+    struct RxNode **last = 0;
+
+    while(p->pos < p->len && !p->failed) {
+        char c = p->s[p->pos];
+        struct RxNode *atom = 0;
+
+        if(rx_peek_escape(p, '|') || rx_peek_escape(p, ')')) break;
+
+        if(c == '*' && last) {
+            p->pos++;
+            struct RxNode *rep = rx_node_new(RN_REPEAT);
+            rep->child = *last;
+            rep->min = 0;
+            rep->max = -1;
+            *last = rep;
+            continue;
+        }
+        if((rx_peek_escape(p, '+') || rx_peek_escape(p, '?')) && last) {
+            struct RxNode *rep = rx_node_new(RN_REPEAT);
+            rep->child = *last;
+            rep->min = p->s[p->pos+1] == '+';
+            rep->max = p->s[p->pos+1] == '+' ? -1 : 1;
+            p->pos += 2;
+            *last = rep;
+            continue;
+        }
+        if(rx_peek_escape(p, '{')) {
+            if(!last) {
+                p->failed = 1;
+                break;
+            }
+            p->pos += 2;
+            int min = 0;
+            int max = 0;
+            _Bool has_min = rx_parse_int(p, &min);
+            if(p->pos < p->len && p->s[p->pos] == ',') {
+                p->pos++;
+                if(!rx_parse_int(p, &max)) max = -1;
+            } else {
+                if(!has_min) p->failed = 1;
+                max = min;
+            }
+            if(!rx_peek_escape(p, '}') || (max != -1 && max < min)) p->failed = 1;
+            if(p->failed) break;
+            p->pos += 2;
+            struct RxNode *rep = rx_node_new(RN_REPEAT);
+            rep->child = *last;
+            rep->min = min;
+            rep->max = max;
+            *last = rep;
+            continue;
+        }
+
+        if(c == '^' && cat->children.len == 0) {
+            p->pos++;
+            atom = rx_node_new(RN_BOL);
+            vec_push(&cat->children, &atom);
+            last = 0;
+            continue;
+        }
+        if(c == '$' && rx_at_cat_end(p, p->pos + 1)) {
+            p->pos++;
+            atom = rx_node_new(RN_EOL);
+            vec_push(&cat->children, &atom);
+            last = 0;
+            continue;
+        }
+
+        if(c == '.') {
+            p->pos++;
+            atom = rx_node_new(RN_SET);
+            struct RxRange any = {0, RX_MAX_CODE_POINT};
+            vec_push(&atom->ranges, &any);
+        } else if(c == '[') {
+            atom = rx_parse_bracket(p);
+        } else if(rx_peek_escape(p, '(')) {
+            p->pos += 2;
+            atom = rx_parse_alt(p);
+            if(!rx_peek_escape(p, ')')) p->failed = 1;
+            else p->pos += 2;
+        } else if(c == '\\') {
+            if(p->pos + 1 >= p->len) {
+                p->failed = 1;
+                break;
+            }
+            char e = p->s[p->pos+1];
+            // only the escapes of special characters mean the character
+            // itself, the others are back references or GNU extensions
+            if(!strchr(".[]*^$\\", e)) {
+                p->failed = 1;
+                break;
+            }
+            p->pos += 2;
+            atom = rx_node_char((unsigned char)e);
+        } else {
+            atom = rx_node_char(rx_next_char(p));
+        }
+
+        vec_push(&cat->children, &atom);
+        last = VEC_GET(struct RxNode*, &cat->children, cat->children.len - 1);
+    }
+    return cat;
+}
+
+static struct RxNode *rx_parse_alt(struct RxParser *p) {
+    struct RxNode *alt = rx_node_new(RN_ALT);
+    for(;;) {
+        struct RxNode *cat = rx_parse_cat(p);
+        vec_push(&alt->children, &cat);
+        if(p->failed || !rx_peek_escape(p, '|')) break;
+        p->pos += 2;
+    }
+    return alt;
+}
+
+// ---- program ----
+
+enum RxOp {
+    // consumes a byte in [lo, hi] then goes to x
+    RX_BYTE,
+    // goes to both x and y
+    RX_SPLIT,
+    // goes to x at the start of the line
+    RX_BOL,
+    // goes to x at the end of the line
+    RX_EOL,
+    // x is the rule that matched
+    RX_MATCH,
+};
+
+struct RxInst {
+    uint8_t op;
+    uint8_t lo;
+    uint8_t hi;
+    uint32_t x;
+    uint32_t y;
+};
+
+struct RxProg {
+    // `Vec` of `RxInst`
+    Vec insts;
+    // entry of the match anchored at the current position
+    uint32_t start;
+    // entry of the match starting anywhere after the current position
+    uint32_t unanchored_start;
+};
+
+static uint32_t rx_emit(struct RxProg *prog, _Bool *failed, struct RxInst inst) {
+    if(prog->insts.len >= RX_MAX_INSTS) {
+        *failed = 1;
+        return 0;
+    }
+    vec_push(&prog->insts, &inst);
+    return prog->insts.len - 1;
+}
+
+// A UTF-8 encoded range of code points, one byte range per byte
+struct RxSeq {
+    uint8_t len;
+    uint8_t lo[4];
+    uint8_t hi[4];
+};
+
+// Splits [lo, hi] in ranges whose UTF-8 encodings only differ byte by byte
+static void rx_utf8_sequences(uint32_t lo, uint32_t hi, Vec *seqs) {
+    if(lo > hi) return;
+    // surrogates are not code points
+    if(lo <= 0xDFFF && hi >= 0xD800) {
+        if(lo < 0xD800) rx_utf8_sequences(lo, 0xD7FF, seqs);
+        if(hi > 0xDFFF) rx_utf8_sequences(0xE000, hi, seqs);
+        return;
+    }
+    // both ends need the same encoded length
+    static const uint32_t len_max[] = {0x7F, 0x7FF, 0xFFFF};
+    for(size_t i = 0; i < 3; i++) {
+        if(lo <= len_max[i] && hi > len_max[i]) {
+            rx_utf8_sequences(lo, len_max[i], seqs);
+            rx_utf8_sequences(len_max[i] + 1, hi, seqs);
+            return;
+        }
+    }
+    // the continuation bytes must cover their whole range except for the
+    // first byte that differs
+    for(int i = 1; i < 4; i++) {
+        uint32_t m = (1u << (6 * i)) - 1;
+        if((lo & ~m) != (hi & ~m)) {
+            if((lo & m) != 0) {
+                rx_utf8_sequences(lo, lo | m, seqs);
+                rx_utf8_sequences((lo | m) + 1, hi, seqs);
+                return;
+            }
+            if((hi & m) != m) {
+                rx_utf8_sequences(lo, (hi & ~m) - 1, seqs);
+                rx_utf8_sequences(hi & ~m, hi, seqs);
+                return;
+            }
+        }
+    }
+
+    struct RxSeq seq = {0};
+    char lo_bytes[4];
+    char hi_bytes[4];
+    seq.len = utf32_to_utf8(lo, lo_bytes, 4);
+    utf32_to_utf8(hi, hi_bytes, 4);
+    for(size_t i = 0; i < seq.len; i++) {
+        seq.lo[i] = lo_bytes[i];
+        seq.hi[i] = hi_bytes[i];
+    }
+    vec_push(seqs, &seq);
+}
+
+// Compiles `node` so that it continues to `next`
+// Returns the entry point of `node`
+static uint32_t rx_compile_node(struct RxProg *prog, _Bool *failed, struct RxNode *node, uint32_t next) {
+    if(*failed) return 0;
+    switch(node->ty) {
+        case RN_EMPTY:
+            return next;
+        case RN_BOL:
+            return rx_emit(prog, failed, (struct RxInst){.op = RX_BOL, .x = next});
+        case RN_EOL:
+            return rx_emit(prog, failed, (struct RxInst){.op = RX_EOL, .x = next});
+        case RN_SET: {
+            Vec seqs = VEC_NEW(struct RxSeq, 0);
+            for(size_t i = 0; i < node->ranges.len; i++) {
+                struct RxRange *r = vec_get(&node->ranges, i);
+                rx_utf8_sequences(r->lo, r->hi, &seqs);
+            }
+            // an empty set never matches
+            uint32_t entry = rx_emit(prog, failed, (struct RxInst){.op = RX_BYTE, .lo = 1, .hi = 0});
+            for(size_t i = 0; i < seqs.len; i++) {
+                struct RxSeq *seq = vec_get(&seqs, i);
+                uint32_t cur = next;
+                for(size_t b = seq->len; b > 0; b--) {
+                    cur = rx_emit(prog, failed, (struct RxInst){
+                            .op = RX_BYTE,
+                            .lo = seq->lo[b-1],
+                            .hi = seq->hi[b-1],
+                            .x = cur});
+                }
+                entry = i == 0 ? cur : rx_emit(prog, failed, (struct RxInst){.op = RX_SPLIT, .x = cur, .y = entry});
+            }
+            vec_cleanup(&seqs);
+            return entry;
+        }
+        case RN_CAT: {
+            for(size_t i = node->children.len; i > 0; i--) {
+                next = rx_compile_node(prog, failed, *VEC_GET(struct RxNode*, &node->children, i-1), next);
+            }
+            return next;
+        }
+        case RN_ALT: {
+            uint32_t entry = 0;
+            for(size_t i = 0; i < node->children.len; i++) {
+                uint32_t child = rx_compile_node(prog, failed, *VEC_GET(struct RxNode*, &node->children, i), next);
+                entry = i == 0 ? child : rx_emit(prog, failed, (struct RxInst){.op = RX_SPLIT, .x = child, .y = entry});
+            }
+            return entry;
+        }
+        case RN_REPEAT: {
+            uint32_t tail = next;
+            if(node->max == -1) {
+                // loop: split to the body or out, the body goes back to the split
+                uint32_t loop = rx_emit(prog, failed, (struct RxInst){.op = RX_SPLIT});
+                uint32_t body = rx_compile_node(prog, failed, node->child, loop);
+                if(*failed) return 0;
+                struct RxInst *inst = vec_get(&prog->insts, loop);
+                inst->x = body;
+                inst->y = next;
+                tail = loop;
+            } else {
+                for(int i = node->min; i < node->max; i++) {
+                    uint32_t body = rx_compile_node(prog, failed, node->child, tail);
+                    tail = rx_emit(prog, failed, (struct RxInst){.op = RX_SPLIT, .x = body, .y = tail});
+                }
+            }
+            for(int i = 0; i < node->min; i++) {
+                tail = rx_compile_node(prog, failed, node->child, tail);
+            }
+            return tail;
+        }
+    }
+    return next;
+}
+
+struct RxProg *rx_compile(const char *pattern) {
+    return rx_compile_rules(&pattern, 1);
+}
+
+struct RxProg *rx_compile_rules(const char *const *patterns, size_t count) {
+    if(!count || count > UINT16_MAX) return 0;
+
+    struct RxProg *prog = xcalloc(1, sizeof(struct RxProg));
+    prog->insts = VEC_NEW(struct RxInst, 0);
+    _Bool failed = 0;
+    for(size_t i = 0; i < count && !failed; i++) {
+        struct RxParser p = {
+            .s = patterns[i],
+            .len = strlen(patterns[i]),
+        };
+        if(!p.len) {
+            failed = 1;
+            break;
+        }
+
+        struct RxNode *root = rx_parse_alt(&p);
+        // an unmatched \) ends the parsing early
+        if(p.pos != p.len) p.failed = 1;
+        if(p.failed) {
+            rx_node_free(root);
+            failed = 1;
+            break;
+        }
+        // each rule ends on its own match so the DFA knows which one matched
+        uint32_t match = rx_emit(prog, &failed, (struct RxInst){.op = RX_MATCH, .x = i});
+        uint32_t start = rx_compile_node(prog, &failed, root, match);
+        prog->start = i == 0 ? start : rx_emit(prog, &failed, (struct RxInst){.op = RX_SPLIT, .x = prog->start, .y = start});
+        rx_node_free(root);
+    }
+    // unanchored: any number of bytes before the match
+    uint32_t loop = rx_emit(prog, &failed, (struct RxInst){.op = RX_SPLIT, .x = prog->start});
+    uint32_t any = rx_emit(prog, &failed, (struct RxInst){.op = RX_BYTE, .lo = 0, .hi = 0xFF, .x = loop});
+    if(!failed) ((struct RxInst*)vec_get(&prog->insts, loop))->y = any;
+    prog->unanchored_start = loop;
+
+    if(failed) {
+        rx_prog_free(prog);
+        return 0;
+    }
+    return prog;
+}
+
+void rx_prog_free(struct RxProg *prog) {
+    if(!prog) return;
+    vec_cleanup(&prog->insts);
+    xfree(prog);
+}
+
+// ---- lazy DFA ----
+
+#define RX_UNKNOWN -2
+#define RX_DEAD -1
+
+enum RxStateFlags {
+    RX_S_MATCH = 1,
+    // matches if the line ends here
+    RX_S_MATCH_EOL = 2,
+};
+
+struct RxState {
+    // sorted ids of the byte consuming, matching and end of line
+    // instructions reached by this state
+    uint32_t *insts;
+    size_t len;
+};
+
+struct Rx {
+    // null if the DFA was loaded by `rx_dfa_load`
+    const struct RxProg *prog;
+    // `Vec` of `RxState`
+    Vec states;
+    // transitions of the states, 256 per state, kept apart from the states
+    // so the matching loop only touches them and `flags`
+    int32_t *trans;
+    size_t trans_cap;
+    // set if `trans` points into the memory given to `rx_dfa_load`
+    _Bool loaded;
+    uint8_t flags[RX_MAX_STATES];
+    // first rule matching in the state, and matching if the line ends there
+    uint16_t rules[RX_MAX_STATES];
+    uint16_t rules_eol[RX_MAX_STATES];
+    // open addressing table of state ids keyed by their instructions
+    int32_t *table;
+    size_t table_cap;
+    // [unanchored][at the start of the line], RX_UNKNOWN until built
+    int32_t starts[2][2];
+    // bytes that can begin a match away from the start of the line, the
+    // positions starting with other bytes are skipped
+    _Bool first_bytes[256];
+    // scratch space for the closures
+    uint32_t *stack;
+    uint32_t *set;
+    size_t set_len;
+    uint32_t *marks;
+    uint32_t mark_gen;
+};
+
+static void rx_first_bytes(struct Rx *rx);
+
+static void rx_starts_reset(struct Rx *rx) {
+    for(size_t i = 0; i < 4; i++) rx->starts[i / 2][i % 2] = RX_UNKNOWN;
+}
+
+struct Rx *rx_new(const struct RxProg *prog) {
+    struct Rx *rx = xcalloc(1, sizeof(struct Rx));
+    size_t insts = prog->insts.len;
+    rx->prog = prog;
+    rx->states = VEC_NEW(struct RxState, 0);
+    rx->table_cap = RX_MAX_STATES * 2;
+    rx->table = xmalloc(rx->table_cap * sizeof(int32_t));
+    memset(rx->table, 0xff, rx->table_cap * sizeof(int32_t));
+    rx_starts_reset(rx);
+    // a split pushes both of its branches
+    rx->stack = xmalloc((insts * 2 + 1) * sizeof(uint32_t));
+    rx->set = xmalloc(insts * sizeof(uint32_t));
+    rx->marks = xcalloc(insts, sizeof(uint32_t));
+    rx_first_bytes(rx);
+    return rx;
+}
+
+static void rx_flush(struct Rx *rx) {
+    for(size_t i = 0; i < rx->states.len; i++) {
+        xfree(((struct RxState*)vec_get(&rx->states, i))->insts);
+    }
+    vec_clear(&rx->states);
+    memset(rx->table, 0xff, rx->table_cap * sizeof(int32_t));
+    rx_starts_reset(rx);
+}
+
+void rx_free(struct Rx *rx) {
+    if(!rx) return;
+    // a loaded DFA has no states to free
+    if(!rx->loaded) rx_flush(rx);
+    vec_cleanup(&rx->states);
+    xfree(rx->table);
+    if(!rx->loaded) xfree(rx->trans);
+    xfree(rx->stack);
+    xfree(rx->set);
+    xfree(rx->marks);
+    xfree(rx);
+}
+
+static void rx_marks_reset(struct Rx *rx) {
+    rx->mark_gen += 1;
+    if(!rx->mark_gen) {
+        memset(rx->marks, 0, rx->prog->insts.len * sizeof(uint32_t));
+        rx->mark_gen = 1;
+    }
+}
+
+// Adds the instructions reachable from `pc` without consuming a byte to the
+// set, the marks must be reset before a new set is built
+// Returns 1 if a match was reached
+static int rx_closure(struct Rx *rx, uint32_t pc, _Bool bol, _Bool eol) {
+    const struct RxInst *insts = rx->prog->insts.buf;
+    int match = 0;
+    size_t top = 0;
+    rx->stack[top++] = pc;
+    while(top) {
+        pc = rx->stack[--top];
+        if(rx->marks[pc] == rx->mark_gen) continue;
+        rx->marks[pc] = rx->mark_gen;
+        const struct RxInst *inst = &insts[pc];
+        switch(inst->op) {
+            case RX_BYTE:
+                rx->set[rx->set_len++] = pc;
+                break;
+            case RX_MATCH:
+                rx->set[rx->set_len++] = pc;
+                match = 1;
+                break;
+            case RX_SPLIT:
+                rx->stack[top++] = inst->y;
+                rx->stack[top++] = inst->x;
+                break;
+            case RX_BOL:
+                if(bol) rx->stack[top++] = inst->x;
+                break;
+            case RX_EOL:
+                if(eol) rx->stack[top++] = inst->x;
+                // kept to know if the state matches at the end of the line
+                else rx->set[rx->set_len++] = pc;
+                break;
+        }
+    }
+    return match;
+}
+
+static int rx_u32_cmp(const void *a, const void *b) {
+    uint32_t ua = *(const uint32_t*)a;
+    uint32_t ub = *(const uint32_t*)b;
+    return ua < ub ? -1 : ua > ub;
+}
+
+static size_t rx_set_hash(const uint32_t *set, size_t len) {
+    // FNV-1a
+    size_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= set[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Returns the id of the state made of the instructions in `rx->set`, the
+// DFA might get flushed to make room for it, invalidating all the other ids
+static int32_t rx_state_get(struct Rx *rx) {
+    if(!rx->set_len) return RX_DEAD;
+    qsort(rx->set, rx->set_len, sizeof(uint32_t), rx_u32_cmp);
+
+    size_t mask = rx->table_cap - 1;
+    size_t slot = rx_set_hash(rx->set, rx->set_len) & mask;
+    while(rx->table[slot] >= 0) {
+        struct RxState *state = vec_get(&rx->states, rx->table[slot]);
+        if(state->len == rx->set_len && !memcmp(state->insts, rx->set, rx->set_len * sizeof(uint32_t))) {
+            return rx->table[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if(rx->states.len >= RX_MAX_STATES) {
+        rx_flush(rx);
+        slot = rx_set_hash(rx->set, rx->set_len) & mask;
+    }
+
+    int32_t id = rx->states.len;
+    struct RxState state = {
+        .len = rx->set_len,
+        .insts = xmalloc(rx->set_len * sizeof(uint32_t)),
+    };
+    memcpy(state.insts, rx->set, rx->set_len * sizeof(uint32_t));
+    vec_push(&rx->states, &state);
+    if(rx->trans_cap < rx->states.len * 256) {
+        rx->trans_cap = rx->trans_cap ? rx->trans_cap * 2 : 16 * 256;
+        rx->trans = xrealloc(rx->trans, rx->trans_cap * sizeof(int32_t));
+    }
+    for(size_t i = 0; i < 256; i++) rx->trans[id * 256 + i] = RX_UNKNOWN;
+
+    const struct RxInst *insts = rx->prog->insts.buf;
+    uint8_t flags = 0;
+    uint32_t rule = UINT16_MAX;
+    for(size_t i = 0; i < state.len; i++) {
+        const struct RxInst *inst = &insts[state.insts[i]];
+        if(inst->op != RX_MATCH) continue;
+        flags = RX_S_MATCH | RX_S_MATCH_EOL;
+        if(inst->x < rule) rule = inst->x;
+    }
+    rx->rules[id] = rule;
+    // follow the end of line assertions to know if it matches there, the
+    // set is not needed anymore
+    rx_marks_reset(rx);
+    rx->set_len = 0;
+    for(size_t i = 0; i < state.len; i++) {
+        const struct RxInst *inst = &insts[state.insts[i]];
+        if(inst->op == RX_EOL && rx_closure(rx, inst->x, 0, 1)) flags |= RX_S_MATCH_EOL;
+    }
+    for(size_t i = 0; i < rx->set_len; i++) {
+        const struct RxInst *inst = &insts[rx->set[i]];
+        if(inst->op == RX_MATCH && inst->x < rule) rule = inst->x;
+    }
+    rx->rules_eol[id] = rule;
+    rx->flags[id] = flags;
+
+    while(rx->table[slot] >= 0) slot = (slot + 1) & mask;
+    rx->table[slot] = id;
+    return id;
+}
+
+static int32_t rx_start(struct Rx *rx, _Bool unanchored, _Bool bol) {
+    int32_t id = rx->starts[unanchored][bol];
+    if(id != RX_UNKNOWN) return id;
+    assert(!rx->loaded && "the DFA was saved without that start");
+    rx_marks_reset(rx);
+    rx->set_len = 0;
+    rx_closure(rx, unanchored ? rx->prog->unanchored_start : rx->prog->start, bol, 0);
+    size_t before = rx->states.len;
+    id = rx_state_get(rx);
+    // cache it unless the DFA got flushed, which clears the starts
+    if(rx->states.len >= before) rx->starts[unanchored][bol] = id;
+    return id;
+}
+
+static int32_t rx_next_slow(struct Rx *rx, int32_t id, uint8_t byte) {
+    assert(!rx->loaded && "a loaded DFA is complete");
+    struct RxState *state = vec_get(&rx->states, id);
+    const struct RxInst *insts = rx->prog->insts.buf;
+    rx_marks_reset(rx);
+    rx->set_len = 0;
+    for(size_t i = 0; i < state->len; i++) {
+        const struct RxInst *inst = &insts[state->insts[i]];
+        if(inst->op == RX_BYTE && inst->lo <= byte && byte <= inst->hi) {
+            rx_closure(rx, inst->x, 0, 0);
+        }
+    }
+    size_t before = rx->states.len;
+    int32_t next = rx_state_get(rx);
+    // `id` is gone if the DFA got flushed
+    if(rx->states.len >= before) rx->trans[id * 256 + byte] = next;
+    return next;
+}
+
+static inline int32_t rx_next(struct Rx *rx, int32_t id, uint8_t byte) {
+    int32_t next = rx->trans[id * 256 + byte];
+    if(next != RX_UNKNOWN) return next;
+    return rx_next_slow(rx, id, byte);
+}
+
+static void rx_first_bytes(struct Rx *rx) {
+    int32_t id = rx_start(rx, 0, 0);
+    // an empty match can begin anywhere
+    _Bool any = id >= 0 && (rx->flags[id] & RX_S_MATCH);
+    for(size_t b = 0; b < 256; b++) {
+        // the ids do not survive a flush
+        id = rx_start(rx, 0, 0);
+        rx->first_bytes[b] = any || (id >= 0 && rx_next(rx, id, b) != RX_DEAD);
+    }
+}
+
+// Returns the end of the first match to end at or after `pos`, -1 if none
+static ssize_t rx_earliest_end(struct Rx *rx, const char *s, size_t len, size_t pos) {
+    int32_t id = rx_start(rx, 1, pos == 0);
+    if((rx->flags[id] & RX_S_MATCH)) return pos;
+    for(size_t i = pos; i < len; i++) {
+        // nothing in progress, skip to the next byte that can begin a match,
+        // the others lead back to the same state
+        if(id == rx->starts[1][0]) {
+            while(i < len && !rx->first_bytes[(uint8_t)s[i]]) i++;
+            if(i == len) break;
+        }
+        id = rx_next(rx, id, s[i]);
+        // the unanchored loop never dies
+        assert(id >= 0);
+        if((rx->flags[id] & RX_S_MATCH)) return i + 1;
+    }
+    return (rx->flags[id] & RX_S_MATCH_EOL) ? (ssize_t)len : -1;
+}
+
+// Returns the end of the longest match starting at `start`, -1 if none
+// `rule` is set to the first rule matching that much, if not null
+static ssize_t rx_longest(struct Rx *rx, const char *s, size_t len, size_t start, size_t *rule) {
+    if(start != 0 && start != len && !rx->first_bytes[(uint8_t)s[start]]) return -1;
+    int32_t id = rx_start(rx, 0, start == 0);
+    if(id < 0) return -1;
+    ssize_t last = -1;
+    uint16_t last_rule = 0;
+    if((rx->flags[id] & RX_S_MATCH)) {
+        last = start;
+        last_rule = rx->rules[id];
+    }
+    for(size_t i = start; i < len; i++) {
+        id = rx_next(rx, id, s[i]);
+        if(id < 0) break;
+        if((rx->flags[id] & RX_S_MATCH)) {
+            last = i + 1;
+            last_rule = rx->rules[id];
+        }
+    }
+    if(id >= 0 && (rx->flags[id] & RX_S_MATCH_EOL)) {
+        last = len;
+        last_rule = rx->rules_eol[id];
+    }
+    if(rule) *rule = last_rule;
+    return last;
+}
+
+ssize_t rx_match_at(struct Rx *rx, const char *s, size_t len, size_t pos, size_t *rule) {
+    return rx_longest(rx, s, len, pos, rule);
+}
+
+// ---- saved DFA ----
+
+#define RX_DFA_MAGIC 0x41464478u
+
+// Laid out as is in the saved DFA, followed by the `flags` then `rules`
+// then `rules_eol` of the states, each padded to 4 bytes, then their
+// transitions
+struct RxDfaHeader {
+    uint32_t magic;
+    uint32_t states;
+    int32_t starts[2][2];
+    uint8_t first_bytes[256];
+};
+
+static size_t rx_align4(size_t n) {
+    return (n + 3) & ~(size_t)3;
+}
+
+// Returns the size of the saved DFA of `states` states
+static size_t rx_dfa_size(size_t states) {
+    return sizeof(struct RxDfaHeader)
+        + rx_align4(states)
+        + rx_align4(states * sizeof(uint16_t)) * 2
+        + states * 256 * sizeof(int32_t);
+}
+
+int rx_complete(struct Rx *rx) {
+    if(rx->loaded) return 0;
+    // the unanchored DFA is often much bigger and only `rx_find_all` needs
+    // it, it is left out
+    rx_start(rx, 0, 0);
+    rx_start(rx, 0, 1);
+    for(size_t id = 0; id < rx->states.len; id++) {
+        for(size_t b = 0; b < 256; b++) {
+            size_t before = rx->states.len;
+            rx_next(rx, id, b);
+            // flushed, too many states to keep them all
+            if(rx->states.len < before) return -1;
+        }
+    }
+    return 0;
+}
+
+void rx_dfa_save(const struct Rx *rx, Vec *out) {
+    size_t states = rx->states.len;
+    size_t size = rx_dfa_size(states);
+    vec_grow_to_fit(out, size);
+    uint8_t *p = (uint8_t*)out->buf + out->len;
+    memset(p, 0, size);
+    out->len += size;
+
+    struct RxDfaHeader header = {
+        .magic = RX_DFA_MAGIC,
+        .states = states,
+    };
+    memcpy(header.starts, rx->starts, sizeof(header.starts));
+    memcpy(header.first_bytes, rx->first_bytes, sizeof(header.first_bytes));
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, rx->flags, states);
+    p += rx_align4(states);
+    memcpy(p, rx->rules, states * sizeof(uint16_t));
+    p += rx_align4(states * sizeof(uint16_t));
+    memcpy(p, rx->rules_eol, states * sizeof(uint16_t));
+    p += rx_align4(states * sizeof(uint16_t));
+    memcpy(p, rx->trans, states * 256 * sizeof(int32_t));
+}
+
+struct Rx *rx_dfa_load(const void *data, size_t len, size_t rules_len, size_t *used) {
+    struct RxDfaHeader header;
+    if(len < sizeof(header) || ((uintptr_t)data & 3)) return 0;
+    memcpy(&header, data, sizeof(header));
+    if(header.magic != RX_DFA_MAGIC
+            || header.states > RX_MAX_STATES
+            || rx_dfa_size(header.states) > len) {
+        return 0;
+    }
+    size_t states = header.states;
+    const uint8_t *p = (const uint8_t*)data + sizeof(header);
+    const uint8_t *flags = p;
+    p += rx_align4(states);
+    const uint16_t *rules = (const uint16_t*)p;
+    p += rx_align4(states * sizeof(uint16_t));
+    const uint16_t *rules_eol = (const uint16_t*)p;
+    p += rx_align4(states * sizeof(uint16_t));
+    const int32_t *trans = (const int32_t*)p;
+
+    // a bad transition would send the matching loop out of the table, the
+    // anchored starts are always saved and a loaded DFA cannot build them
+    for(size_t i = 0; i < 4; i++) {
+        int32_t id = header.starts[i / 2][i % 2];
+        int32_t lowest = i < 2 ? RX_DEAD : RX_UNKNOWN;
+        if(id < lowest || id >= (int32_t)states) return 0;
+    }
+    for(size_t i = 0; i < states * 256; i++) {
+        if(trans[i] < RX_DEAD || trans[i] >= (int32_t)states) return 0;
+    }
+    // the rules of the matching states index the tables of the caller
+    for(size_t i = 0; i < states; i++) {
+        if((flags[i] & RX_S_MATCH) && rules[i] >= rules_len) return 0;
+        if((flags[i] & RX_S_MATCH_EOL) && rules_eol[i] >= rules_len) return 0;
+    }
+
+    struct Rx *rx = xcalloc(1, sizeof(struct Rx));
+    rx->states = VEC_NEW(struct RxState, 0);
+    rx->trans = (int32_t*)trans;
+    rx->loaded = 1;
+    memcpy(rx->flags, flags, states);
+    memcpy(rx->rules, rules, states * sizeof(uint16_t));
+    memcpy(rx->rules_eol, rules_eol, states * sizeof(uint16_t));
+    memcpy(rx->starts, header.starts, sizeof(rx->starts));
+    memcpy(rx->first_bytes, header.first_bytes, sizeof(rx->first_bytes));
+    if(used) *used = rx_dfa_size(states);
+    return rx;
+}
+
+// Returns the offset of the character after the one at `pos`
+static size_t rx_next_char_off(const char *s, size_t len, size_t pos) {
+    pos++;
+    while(pos < len && utf8_is_follow(s[pos])) pos++;
+    return pos;
+}
+
+size_t rx_find_all(struct Rx *rx, const char *s, size_t len, Vec *out) {
+    size_t found = 0;
+    // where the search resumes, in bytes and in characters
+    size_t pos = 0;
+    size_t pos_chars = 0;
+    // end of the previous match, an empty match cannot start there
+    ssize_t last_end = -1;
+
+    while(pos <= len) {
+        ssize_t end = rx_earliest_end(rx, s, len, pos);
+        if(end < 0) break;
+
+        // the leftmost match starts at or before the earliest end
+        size_t start = pos;
+        size_t start_chars = pos_chars;
+        ssize_t match_end = -1;
+        while(start <= (size_t)end) {
+            match_end = rx_longest(rx, s, len, start, 0);
+            if(match_end >= 0 && !(match_end == (ssize_t)start && (ssize_t)start == last_end)) break;
+            match_end = -1;
+            if(start == len) break;
+            start = rx_next_char_off(s, len, start);
+            start_chars++;
+        }
+
+        if(match_end < 0) {
+            // the earliest end came from a match that starts in the middle
+            // of a character (invalid UTF-8) or an empty match right after
+            // the previous one, retry past it
+            if((size_t)end >= len) break;
+            size_t next = rx_next_char_off(s, len, end);
+            pos_chars += utf8_count_chars(s + pos, next - pos);
+            pos = next;
+            continue;
+        }
+
+        struct RxMatch match = {
+            .col = start_chars,
+            .len = utf8_count_chars(s + start, match_end - start),
+        };
+        vec_push(out, &match);
+        found++;
+        last_end = match_end;
+
+        if(match_end == (ssize_t)start) {
+            if(start == len) break;
+            pos = rx_next_char_off(s, len, start);
+            pos_chars = start_chars + 1;
+        } else {
+            pos = match_end;
+            pos_chars = start_chars + match.len;
+        }
+    }
+    return found;
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+#include "xalloc.h"
+
+// Returns the matches of `pattern` in `s` formatted as "col:len,..."
+static char *rx_test_find(const char *pattern, const char *s) {
+    struct RxProg *prog = rx_compile(pattern);
+    if(!prog) return strdup("unsupported");
+    struct Rx *rx = rx_new(prog);
+    Vec matches = VEC_NEW(struct RxMatch, 0);
+    rx_find_all(rx, s, strlen(s), &matches);
+
+    char *out = xcalloc(256, 1);
+    size_t off = 0;
+    for(size_t i = 0; i < matches.len; i++) {
+        struct RxMatch *m = vec_get(&matches, i);
+        off += snprintf(out + off, 256 - off, "%s%zu:%zu", i ? "," : "", m->col, m->len);
+    }
+    vec_cleanup(&matches);
+    rx_free(rx);
+    rx_prog_free(prog);
+    return out;
+}
+
+#define RX_EXPECT(pattern, s, expected) do { \
+    char *found = rx_test_find(pattern, s); \
+    TEST_ASSERT(!strcmp(found, expected)); \
+    xfree(found); \
+} while(0)
+
+TESTS_START
+
+TEST_DEF(test_rx_basic)
+    RX_EXPECT("foo", "a foo b foo", "2:3,8:3");
+    RX_EXPECT("a*", "baaac", "0:0,1:3,5:0");
+    RX_EXPECT("ab*c", "ac abc abbbc", "0:2,3:3,7:5");
+    RX_EXPECT("a\\+", "baaac", "1:3");
+    RX_EXPECT("colou\\?r", "color colour", "0:5,6:6");
+    RX_EXPECT("a\\{2,3\\}", "aaaaaaa", "0:3,3:3");
+    RX_EXPECT("[0-9][0-9]*", "id 42 and 7", "3:2,10:1");
+    RX_EXPECT("[^ ]*", "ab cd", "0:2,3:2");
+    RX_EXPECT("cat\\|dog", "hotdog catalog", "3:3,7:3");
+    RX_EXPECT("\\(ab\\)*c", "ababc", "0:5");
+    RX_EXPECT("x*", "", "0:0");
+TEST_ENDDEF
+
+TEST_DEF(test_rx_anchors)
+    RX_EXPECT("^foo", "foo foo", "0:3");
+    RX_EXPECT("foo$", "foo foo", "4:3");
+    RX_EXPECT("^$", "", "0:0");
+    RX_EXPECT("a^b", "a^b", "0:3");
+    RX_EXPECT("a$b", "a$b", "0:3");
+    RX_EXPECT("*a", "*a", "0:2");
+    RX_EXPECT("\\(^a\\)", "aa", "0:1");
+TEST_ENDDEF
+
+TEST_DEF(test_rx_utf8)
+    // columns are in code points
+    RX_EXPECT("b", "\xc3\xa9\xc3\xa9" "b", "2:1");
+    RX_EXPECT(".", "\xc3\xa9\xe2\x82\xac", "0:1,1:1");
+    RX_EXPECT("[\xc3\xa0-\xc3\xbf]*", "\xc3\xa9t\xc3\xa9", "0:1,2:1");
+    RX_EXPECT("[^a]", "a\xf0\x9f\x98\x80", "1:1");
+TEST_ENDDEF
+
+TEST_DEF(test_rx_rules)
+    const char *rules[] = {"int\\|if", "[a-z][a-z0-9]*", "[0-9][0-9]*", "/\\*", "x$"};
+    struct RxProg *prog = rx_compile_rules(rules, 5);
+    TEST_ASSERT(prog);
+    struct Rx *rx = rx_new(prog);
+    const char *s = "int integer 42 /* x";
+    size_t len = strlen(s);
+    size_t rule = 9;
+    // the first rule wins between matches of the same length
+    TEST_ASSERT(rx_match_at(rx, s, len, 0, &rule) == 3 && rule == 0);
+    // the longest match wins
+    TEST_ASSERT(rx_match_at(rx, s, len, 4, &rule) == 11 && rule == 1);
+    TEST_ASSERT(rx_match_at(rx, s, len, 12, &rule) == 14 && rule == 2);
+    TEST_ASSERT(rx_match_at(rx, s, len, 11, &rule) == -1);
+    TEST_ASSERT(rx_match_at(rx, s, len, 15, &rule) == 17 && rule == 3);
+    TEST_ASSERT(rx_match_at(rx, s, len, 18, &rule) == 19 && rule == 1);
+    TEST_ASSERT(rx_match_at(rx, "x", 1, 0, &rule) == 1 && rule == 1);
+    rx_free(rx);
+    rx_prog_free(prog);
+
+    const char *bad[] = {"a", "\\("};
+    TEST_ASSERT(!rx_compile_rules(bad, 2));
+TEST_ENDDEF
+
+TEST_DEF(test_rx_dfa_save)
+    const char *rules[] = {"int\\|if", "[a-z][a-z0-9]*", "^#[a-z]*", "x$"};
+    struct RxProg *prog = rx_compile_rules(rules, 4);
+    struct Rx *rx = rx_new(prog);
+    TEST_ASSERT(rx_complete(rx) == 0);
+    Vec saved = VEC_NEW(uint8_t, 0);
+    rx_dfa_save(rx, &saved);
+    size_t used = 0;
+    struct Rx *loaded = rx_dfa_load(saved.buf, saved.len, 4, &used);
+    TEST_ASSERT(loaded && used == saved.len);
+
+    // the loaded DFA matches like the one it was saved from
+    const char *lines[] = {"#include int", "if x", "integer", "", "  #x"};
+    for(size_t l = 0; l < sizeof(lines) / sizeof(*lines); l++) {
+        size_t len = strlen(lines[l]);
+        for(size_t pos = 0; pos <= len; pos++) {
+            size_t rule = 0;
+            size_t loaded_rule = 0;
+            ssize_t end = rx_match_at(rx, lines[l], len, pos, &rule);
+            TEST_ASSERT(rx_match_at(loaded, lines[l], len, pos, &loaded_rule) == end);
+            if(end >= 0) TEST_ASSERT(rule == loaded_rule);
+        }
+    }
+    rx_free(loaded);
+
+    // a truncated or corrupted DFA is refused, so is one matching rules the
+    // caller does not have
+    TEST_ASSERT(!rx_dfa_load(saved.buf, saved.len - 4, 4, 0));
+    TEST_ASSERT(!rx_dfa_load(saved.buf, saved.len, 2, 0));
+    int32_t bad = 1 << 20;
+    memcpy((uint8_t*)saved.buf + saved.len - 4, &bad, sizeof(bad));
+    TEST_ASSERT(!rx_dfa_load(saved.buf, saved.len, 4, 0));
+    vec_cleanup(&saved);
+    rx_free(rx);
+    rx_prog_free(prog);
+TEST_ENDDEF
+
+TEST_DEF(test_rx_unsupported)
+    RX_EXPECT("\\(a\\)\\1", "aa", "unsupported");
+    RX_EXPECT("[[:alpha:]]", "a", "unsupported");
+    RX_EXPECT("\\w", "a", "unsupported");
+    RX_EXPECT("[a", "a", "unsupported");
+    RX_EXPECT("a\\)", "a", "unsupported");
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
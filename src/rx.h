@@ -0,0 +1,77 @@
+#ifndef RX_H
+#define RX_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "str.h"
+
+// Regex engine for basic regular expressions (the syntax `regcomp` uses
+// without REG_EXTENDED, including the GNU \+ \? and \| operators).
+//
+// The pattern is compiled to an automaton over UTF-8 bytes, which is turned
+// into a DFA lazily while matching, so a line is matched in a single pass no
+// matter how many alternatives the pattern has. Matches are leftmost-longest
+// like POSIX and their offsets are in code points.
+//
+// Back references, named character classes (`[:alpha:]`), equivalence
+// classes, collating symbols and the GNU escapes (\w, \b, \<...) are not
+// supported, `rx_compile` fails on them and the caller falls back to regexec.
+
+// A compiled pattern, read only so it can be shared between threads
+struct RxProg;
+
+// Matches a `RxProg`, it owns the DFA built while matching so it must not be
+// shared between threads
+struct Rx;
+
+struct RxMatch {
+    // in code points
+    size_t col;
+    size_t len;
+};
+
+// Returns null if the pattern is invalid or not supported
+struct RxProg *rx_compile(const char *pattern);
+
+// Compiles the patterns as the rules of a lexer, see `rx_match_at`
+// Returns null if one of them is invalid or not supported
+struct RxProg *rx_compile_rules(const char *const *patterns, size_t count);
+
+void rx_prog_free(struct RxProg *prog);
+
+struct Rx *rx_new(const struct RxProg *prog);
+
+void rx_free(struct Rx *rx);
+
+// Pushes every match of `s` to `out` (a `Vec` of `RxMatch`), matches do not
+// overlap, an empty match is never found right after a match
+// Returns the number of matches found
+size_t rx_find_all(struct Rx *rx, const char *s, size_t len, Vec *out);
+
+// Matches the rules at the byte offset `pos` of `s`, the longest match wins
+// and the first rule wins between matches of the same length
+// Returns the byte offset of the end of the match and sets `rule`, -1 if no
+// rule matches there
+ssize_t rx_match_at(struct Rx *rx, const char *s, size_t len, size_t pos, size_t *rule);
+
+// Builds every state of the DFA reachable from the start of a match at a
+// given position (what `rx_match_at` uses) and from the states already
+// built, so it can be saved
+// Returns:
+//  0 on success
+//  -1 if the DFA has too many states, it stays lazy
+int rx_complete(struct Rx *rx);
+
+// Appends the DFA of `rx` to `out` (a `Vec` of bytes), `rx_complete` must
+// have succeeded
+void rx_dfa_save(const struct Rx *rx, Vec *out);
+
+// Returns a matcher using the DFA saved by `rx_dfa_save` at `data` without
+// copying its transitions, `data` must be aligned to 4 bytes and stay
+// mapped until the matcher is freed, `used` is set to the size of the DFA
+// The matcher can only be used with `rx_match_at`, unless it was saved
+// after a `rx_find_all`
+// Returns null if `data` does not hold a valid DFA of `rules` rules
+struct Rx *rx_dfa_load(const void *data, size_t len, size_t rules, size_t *used);
+
+#endif
@@ -0,0 +1,99 @@
+#include "search.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int search_is_literal(const char *pattern) {
+    if(!*pattern) return 0;
+    // `+?(){}|` only have a meaning when escaped in a basic regex
+    return !strpbrk(pattern, ".[]*^$\\");
+}
+
+// Finds `needle` by looking for its first byte with memchr
+static ssize_t search_literal_scalar(
+        const char *haystack,
+        size_t haystack_len,
+        const char *needle,
+        size_t needle_len) {
+
+    const char *cur = haystack;
+    const char *end = haystack + haystack_len - needle_len + 1;
+    while(cur < end) {
+        cur = memchr(cur, needle[0], end - cur);
+        if(!cur) return -1;
+        if(!memcmp(cur + 1, needle + 1, needle_len - 1)) return cur - haystack;
+        cur++;
+    }
+    return -1;
+}
+
+ssize_t search_literal(
+        const char *haystack,
+        size_t haystack_len,
+        const char *needle,
+        size_t needle_len) {
+
+    if(!needle_len) return 0;
+    if(needle_len > haystack_len) return -1;
+
+    size_t off = 0;
+#ifdef __SSE2__
+    // compare 16 candidate positions at a time against the first and the
+    // last byte of the needle, only the positions where both match get
+    // compared in full
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    for(; off + needle_len - 1 + 16 <= haystack_len; off += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(haystack + off));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(haystack + off + needle_len - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+                    _mm_cmpeq_epi8(block_first, first),
+                    _mm_cmpeq_epi8(block_last, last)));
+        while(mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if(!memcmp(haystack + off + bit + 1, needle + 1, needle_len - 1)) {
+                return off + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    ssize_t ret = search_literal_scalar(haystack + off, haystack_len - off, needle, needle_len);
+    return ret < 0 ? -1 : ret + (ssize_t)off;
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+
+TESTS_START
+
+TEST_DEF(test_search_is_literal)
+    TEST_ASSERT(search_is_literal("hello world"));
+    TEST_ASSERT(search_is_literal("a+b?(c)"));
+    TEST_ASSERT(!search_is_literal(""));
+    TEST_ASSERT(!search_is_literal("a.b"));
+    TEST_ASSERT(!search_is_literal("^a"));
+    TEST_ASSERT(!search_is_literal("a\\(b\\)"));
+TEST_ENDDEF
+
+TEST_DEF(test_search_literal)
+    const char *text = "the quick brown fox jumps over the lazy dog, the end";
+    size_t len = strlen(text);
+    TEST_ASSERT(search_literal(text, len, "the", 3) == 0);
+    TEST_ASSERT(search_literal(text, len, "lazy", 4) == 35);
+    TEST_ASSERT(search_literal(text, len, "end", 3) == 49);
+    TEST_ASSERT(search_literal(text, len, "d", 1) == 40);
+    TEST_ASSERT(search_literal(text, len, "cat", 3) == -1);
+    TEST_ASSERT(search_literal(text, 3, "the quick", 9) == -1);
+    // a match straddling the vector and the scalar part
+    TEST_ASSERT(search_literal(text, len, "dog, the end", 12) == 40);
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef SEARCH_H
+#define SEARCH_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Returns 1 if `pattern` has no special character of a basic regex, it then
+// only matches itself and can be searched with `search_literal`
+int search_is_literal(const char *pattern);
+
+// Finds the first occurrence of `needle` in `haystack`
+// Returns the byte offset of the occurrence or -1 if there is none
+ssize_t search_literal(
+        const char *haystack,
+        size_t haystack_len,
+        const char *needle,
+        size_t needle_len);
+
+#endif
@@ -102,6 +102,42 @@ void vec_remove(Vec *v, size_t idx) {
     return;
 }
 
+// Removes `count` elements starting at `idx` with a single move of the tail
+void vec_remove_range(Vec *v, size_t idx, size_t count) {
+    assert(v->cap != SIZE_MAX && "vec is readonly");
+    assert(idx <= v->len && count <= v->len - idx && "index out of range");
+    if(count == 0) return;
+
+    if(v->free_fn) {
+        for(size_t i = idx; i < idx + count; i++) {
+            v->free_fn(vec_get(v, i));
+        }
+    }
+
+    memmove(
+            v->buf + idx * v->type_size,
+            v->buf + (idx + count) * v->type_size,
+            (v->len - (idx + count)) * v->type_size);
+    v->len -= count;
+    return;
+}
+
+// Inserts `count` elements at `idx` with a single move of the tail
+int vec_insert_range(Vec *v, size_t idx, const void *data, size_t count) {
+    assert(v->cap != SIZE_MAX && "vec is readonly");
+    if(idx > v->len) return -EINVAL;
+    if(count == 0) return 0;
+
+    vec_grow_to_fit(v, count);
+    memmove(
+            v->buf + (idx + count) * v->type_size,
+            v->buf + idx * v->type_size,
+            (v->len - idx) * v->type_size);
+    memcpy(v->buf + idx * v->type_size, data, count * v->type_size);
+    v->len += count;
+    return 0;
+}
+
 int vec_insert(Vec *v, size_t idx, void *data) {
     assert(v->cap != SIZE_MAX && "vec is readonly");
     if(idx > v->len) return -EINVAL;
@@ -472,6 +508,35 @@ TEST_DEF(test_str_len)
 TEST_ENDDEF
 */
 
+TEST_DEF(test_vec_remove_range)
+    Vec v = VEC_NEW(int, 0);
+    int data[] = {1, 2, 3, 4, 5, 6};
+    vec_extend(&v, data, 6);
+    vec_remove_range(&v, 1, 3);
+    int expected[] = {1, 5, 6};
+    TEST_ASSERT(v.len == 3);
+    TEST_ASSERT(!memcmp(v.buf, expected, sizeof(expected)));
+    vec_remove_range(&v, 1, 2);
+    TEST_ASSERT(v.len == 1);
+    TEST_ASSERT(*VEC_GET(int, &v, 0) == 1);
+    vec_cleanup(&v);
+TEST_ENDDEF
+
+TEST_DEF(test_vec_insert_range)
+    Vec v = VEC_NEW(int, 0);
+    int data[] = {1, 5, 6};
+    vec_extend(&v, data, 3);
+    int inserted[] = {2, 3, 4};
+    TEST_ASSERT(!vec_insert_range(&v, 1, inserted, 3));
+    int expected[] = {1, 2, 3, 4, 5, 6};
+    TEST_ASSERT(v.len == 6);
+    TEST_ASSERT(!memcmp(v.buf, expected, sizeof(expected)));
+    TEST_ASSERT(!vec_insert_range(&v, 6, data, 1));
+    TEST_ASSERT(*VEC_GET(int, &v, 6) == 1);
+    TEST_ASSERT(vec_insert_range(&v, 8, data, 1));
+    vec_cleanup(&v);
+TEST_ENDDEF
+
 TEST_DEF(test_str_len_tail)
     Str s = str_from_cstr("é");
     TEST_ASSERT(str_len(&s) == 1);
@@ -13,6 +13,9 @@ typedef struct {
 
 void vec_extend(Vec *v, const void *data, size_t size);
 
+// makes sure `count` more elements can be pushed without reallocating
+void vec_grow_to_fit(Vec *v, size_t count);
+
 void vec_cleanup(Vec *v);
 
 #define VEC_NEW(type, teardown_fn) (Vec) { \
@@ -34,8 +37,12 @@ void vec_push(Vec *v, void *data);
 
 int vec_insert(Vec *v, size_t idx, void *data);
 
+int vec_insert_range(Vec *v, size_t idx, const void *data, size_t count);
+
 void vec_remove(Vec *v, size_t idx);
 
+void vec_remove_range(Vec *v, size_t idx, size_t count);
+
 #define VEC_GET(type, v, idx) (type*)vec_get(v, idx)
 
 typedef struct {
@@ -1,11 +1,868 @@
-#include "vt.h"
+#include "syntax.h"
+#include "buffer.h"
 #include "highlight.h"
-#include <regex.h>
+#include "line.h"
+#include "pool.h"
+#include "rx.h"
+#include "utf.h"
+#include "vt.h"
+#include "xalloc.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SYNTAX_LEN(a) (sizeof(a) / sizeof(*(a)))
+
+// lines lexed from a guessed state above the lines drawn far from the
+// highlighted ones, and the most lines an edit lexes after the ones it
+// changed
+#define SYNTAX_SYNC_LINES 1000
+// time `syntax_continue` lexes for
+#define SYNTAX_SLICE_NS 8000000
+// lines lexed between two looks at the clock
+#define SYNTAX_SLICE_LINES 256
+// lines lexed by a task of a parallel pass, `syntax_continue` lexes that
+// many lines per worker at once when there are enough left
+#define SYNTAX_TASK_LINES 2048
+
+// ---- C ----
+
+enum {
+    C_NORMAL = 0,
+    C_COMMENT,
+    C_STRING,
+    // a string continued on the next line by a trailing backslash
+    C_STRING_CONT,
+};
+
+static const struct SyntaxRule C_NORMAL_RULES[] = {
+    {"/\\*", SYNTAX_COMMENT, C_COMMENT},
+    {"//.*", SYNTAX_COMMENT, SYNTAX_STAY},
+    {"\"", SYNTAX_STRING, C_STRING},
+    {"'\\([^'\\\\]\\|\\\\.\\)*'", SYNTAX_STRING, SYNTAX_STAY},
+    {"^[ \t]*#[ \t]*[a-z]*", SYNTAX_PREPROC, SYNTAX_STAY},
+    {
+        "auto\\|break\\|case\\|const\\|continue\\|default\\|do\\|else\\|enum\\|extern"
+        "\\|for\\|goto\\|if\\|inline\\|register\\|restrict\\|return\\|sizeof\\|static"
+        "\\|struct\\|switch\\|typedef\\|union\\|volatile\\|while\\|_Alignas\\|_Alignof"
+        "\\|_Atomic\\|_Generic\\|_Noreturn\\|_Static_assert\\|_Thread_local"
+        "\\|true\\|false\\|NULL",
+        SYNTAX_KEYWORD,
+        SYNTAX_STAY,
+    },
+    {
+        "void\\|char\\|short\\|int\\|long\\|float\\|double\\|signed\\|unsigned"
+        "\\|_Bool\\|bool\\|[A-Za-z_][A-Za-z0-9_]*_t",
+        SYNTAX_TYPE,
+        SYNTAX_STAY,
+    },
+    // keeps the keywords from matching in the middle of a name
+    {"[A-Za-z_][A-Za-z0-9_]*", 0, SYNTAX_STAY},
+    {"[0-9][0-9A-Za-z_.]*\\|\\.[0-9][0-9A-Za-z_]*", SYNTAX_NUMBER, SYNTAX_STAY},
+};
+
+static const struct SyntaxRule C_COMMENT_RULES[] = {
+    {"\\*/", SYNTAX_COMMENT, C_NORMAL},
+};
+
+static const struct SyntaxRule C_STRING_RULES[] = {
+    {"\\\\.", SYNTAX_STRING, SYNTAX_STAY},
+    {"\\\\$", SYNTAX_STRING, C_STRING_CONT},
+    {"\"", SYNTAX_STRING, C_NORMAL},
+};
+
+static const struct SyntaxRule C_STRING_CONT_RULES[] = {
+    {"\\\\.", SYNTAX_STRING, C_STRING},
+    {"\\\\$", SYNTAX_STRING, SYNTAX_STAY},
+    {"\"", SYNTAX_STRING, C_NORMAL},
+    {"[^\"\\\\][^\"\\\\]*", SYNTAX_STRING, C_STRING},
+};
+
+static const struct SyntaxState C_STATES[] = {
+    [C_NORMAL] = {0, C_NORMAL_RULES, SYNTAX_LEN(C_NORMAL_RULES), SYNTAX_STAY},
+    [C_COMMENT] = {SYNTAX_COMMENT, C_COMMENT_RULES, SYNTAX_LEN(C_COMMENT_RULES), SYNTAX_STAY},
+    // an unterminated string ends with its line
+    [C_STRING] = {SYNTAX_STRING, C_STRING_RULES, SYNTAX_LEN(C_STRING_RULES), C_NORMAL},
+    [C_STRING_CONT] = {SYNTAX_STRING, C_STRING_CONT_RULES, SYNTAX_LEN(C_STRING_CONT_RULES), SYNTAX_STAY},
+};
+
+static const char *const C_EXTENSIONS[] = {"c", "h", 0};
+
+static struct Syntax SYNTAXES[] = {
+    {
+        .name = "c",
+        .extensions = C_EXTENSIONS,
+        .states = C_STATES,
+        .states_len = SYNTAX_LEN(C_STATES),
+        .indent = {.open = "{([", .close = "})]", .flush = "#"},
+    },
+};
 
-struct SyntaxGroup {
-    regex_t re;
+void syntax_init(void) {
+    struct {
+        char *name;
+        Style style;
+    } styles[] = {
+        {SYNTAX_KEYWORD, style_fg(style_new(), colour_vt(VT_MAG))},
+        {SYNTAX_TYPE, style_fg(style_new(), colour_vt(VT_GRN))},
+        {SYNTAX_COMMENT, style_fg(style_new(), colour_vt(VT_GRA))},
+        {SYNTAX_STRING, style_fg(style_new(), colour_vt(VT_YEL))},
+        {SYNTAX_NUMBER, style_fg(style_new(), colour_vt(VT_CYA))},
+        {SYNTAX_PREPROC, style_fg(style_new(), colour_vt(VT_BLU))},
+    };
+    for(size_t i = 0; i < SYNTAX_LEN(styles); i++) {
+        style_register(styles[i].name, strlen(styles[i].name), styles[i].style);
+    }
 }
 
-struct Syntax {
+struct Syntax *syntax_for_path(const char *path) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    const char *ext = strrchr(name, '.');
+    if(!ext) return 0;
+    ext += 1;
 
+    for(size_t i = 0; i < SYNTAX_LEN(SYNTAXES); i++) {
+        for(const char *const *e = SYNTAXES[i].extensions; *e; e++) {
+            if(!strcmp(*e, ext)) return &SYNTAXES[i];
+        }
+    }
+    return 0;
 }
+
+static uint16_t syntax_style_id(const char *name) {
+    if(!name) return STYLE_ID_NONE;
+    int id = style_find_id((char*)name);
+    return id < 0 ? STYLE_ID_NONE : id;
+}
+
+// ---- cache ----
+
+// The DFAs of the states of a syntax are built once and saved to
+// `$XDG_CACHE_HOME/cedit/<name>-<hash>.dfa`, the hash of the rules of the
+// syntax, later runs map the file instead of compiling them again
+
+#define SYNTAX_CACHE_MAGIC "ceditdfa"
+// bumped when the layout of the file or of the DFAs changes
+#define SYNTAX_CACHE_VERSION 1
+
+// Followed by the DFAs of the states
+struct SyntaxCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t states;
+    uint64_t hash;
+};
+
+static uint64_t syntax_hash_bytes(uint64_t hash, const void *data, size_t len) {
+    // FNV-1a
+    const unsigned char *s = data;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= s[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Returns the hash of what the DFAs are built from
+static uint64_t syntax_hash(const struct Syntax *syn) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = syntax_hash_bytes(hash, syn->name, strlen(syn->name) + 1);
+    for(size_t i = 0; i < syn->states_len; i++) {
+        const struct SyntaxState *state = &syn->states[i];
+        hash = syntax_hash_bytes(hash, &state->rules_len, sizeof(state->rules_len));
+        for(size_t r = 0; r < state->rules_len; r++) {
+            const char *pattern = state->rules[r].pattern;
+            hash = syntax_hash_bytes(hash, pattern, strlen(pattern) + 1);
+        }
+    }
+    return hash;
+}
+
+// Writes the path of the cache file of the syntax to `path`, creates its
+// directory if `create` is set
+// Returns -1 if there is no cache directory
+static int syntax_cache_path(const struct Syntax *syn, uint64_t hash, char *path, size_t size, _Bool create) {
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int len = 0;
+    if(cache && *cache) {
+        len = snprintf(path, size, "%s/cedit", cache);
+    } else if(home && *home) {
+        len = snprintf(path, size, "%s/.cache", home);
+        if(len > 0 && (size_t)len < size && create) mkdir(path, 0700);
+        len = snprintf(path, size, "%s/.cache/cedit", home);
+    } else {
+        return -1;
+    }
+    if(len < 0 || (size_t)len >= size) return -1;
+    if(create && mkdir(path, 0700) && errno != EEXIST) return -1;
+    size_t dir_len = len;
+    len = snprintf(path + dir_len, size - dir_len, "/%s-%016llx.dfa", syn->name, (unsigned long long)hash);
+    return len < 0 || (size_t)len >= size - dir_len ? -1 : 0;
+}
+
+// Maps the DFAs of the syntax from its cache file
+// Returns -1 if there is no valid one
+static int syntax_cache_load(struct Syntax *syn, uint64_t hash) {
+    char path[4096];
+    if(syntax_cache_path(syn, hash, path, sizeof(path), 0)) return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return -1;
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(struct SyntaxCacheHeader)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return -1;
+
+    struct SyntaxCacheHeader header;
+    memcpy(&header, map, sizeof(header));
+    if(memcmp(header.magic, SYNTAX_CACHE_MAGIC, sizeof(header.magic))
+            || header.version != SYNTAX_CACHE_VERSION
+            || header.states != syn->states_len
+            || header.hash != hash) {
+        munmap(map, size);
+        return -1;
+    }
+
+    size_t off = sizeof(header);
+    for(size_t i = 0; i < syn->states_len; i++) {
+        size_t used = 0;
+        syn->rx[i] = rx_dfa_load((char*)map + off, size - off, syn->states[i].rules_len, &used);
+        if(!syn->rx[i]) {
+            for(size_t j = 0; j < i; j++) {
+                rx_free(syn->rx[j]);
+                syn->rx[j] = 0;
+            }
+            munmap(map, size);
+            return -1;
+        }
+        off += used;
+    }
+    syn->cache = map;
+    syn->cache_len = size;
+    return 0;
+}
+
+// Removes the cache files of the syntax other than the one at `path`, they
+// were compiled from older rules
+static void syntax_cache_prune(const struct Syntax *syn, const char *path) {
+    const char *file = strrchr(path, '/');
+    int dir_len = file - path;
+    file++;
+    char dir_path[4096];
+    snprintf(dir_path, sizeof(dir_path), "%.*s", dir_len, path);
+    DIR *dir = opendir(dir_path);
+    if(!dir) return;
+    // `<name>-<16 hex digits>.dfa`
+    size_t name_len = strlen(syn->name);
+    size_t len = name_len + 1 + 16 + 4;
+    struct dirent *entry;
+    while((entry = readdir(dir))) {
+        const char *d = entry->d_name;
+        if(strlen(d) != len || !strcmp(d, file)) continue;
+        if(strncmp(d, syn->name, name_len) || d[name_len] != '-') continue;
+        if(strspn(d + name_len + 1, "0123456789abcdef") != 16) continue;
+        if(strcmp(d + len - 4, ".dfa")) continue;
+        char stale[4096 + 256];
+        snprintf(stale, sizeof(stale), "%s/%s", dir_path, d);
+        unlink(stale);
+    }
+    closedir(dir);
+}
+
+// Builds the whole DFAs of the syntax and saves them, nothing is saved if
+// one is too big
+static void syntax_cache_store(struct Syntax *syn, uint64_t hash) {
+    char path[4096];
+    char tmp[4096 + 32];
+    if(syntax_cache_path(syn, hash, path, sizeof(path), 1)) return;
+    for(size_t i = 0; i < syn->states_len; i++) {
+        if(rx_complete(syn->rx[i])) return;
+    }
+
+    struct SyntaxCacheHeader header = {
+        .version = SYNTAX_CACHE_VERSION,
+        .states = syn->states_len,
+        .hash = hash,
+    };
+    memcpy(header.magic, SYNTAX_CACHE_MAGIC, sizeof(header.magic));
+    Vec out = VEC_NEW(uint8_t, 0);
+    vec_extend(&out, &header, sizeof(header));
+    for(size_t i = 0; i < syn->states_len; i++) {
+        rx_dfa_save(syn->rx[i], &out);
+    }
+
+    // written aside then moved so another instance never maps half of it
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd >= 0) {
+        size_t written = 0;
+        while(written < out.len) {
+            ssize_t n = write(fd, (char*)out.buf + written, out.len - written);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+            written += n;
+        }
+        if(close(fd) || written != out.len || rename(tmp, path)) {
+            unlink(tmp);
+        } else {
+            syntax_cache_prune(syn, path);
+        }
+    }
+    vec_cleanup(&out);
+}
+
+int syntax_compile(struct Syntax *syn) {
+    if(syn->failed) return -1;
+    if(syn->rx) return 0;
+
+    syn->rx = xcalloc(syn->states_len, sizeof(struct Rx*));
+    syn->state_styles = xcalloc(syn->states_len, sizeof(uint16_t));
+    syn->rule_styles = xcalloc(syn->states_len, sizeof(uint16_t*));
+    for(size_t i = 0; i < syn->states_len; i++) {
+        const struct SyntaxState *state = &syn->states[i];
+        syn->state_styles[i] = syntax_style_id(state->style);
+        syn->rule_styles[i] = xcalloc(state->rules_len, sizeof(uint16_t));
+        for(size_t r = 0; r < state->rules_len; r++) {
+            syn->rule_styles[i][r] = syntax_style_id(state->rules[r].style);
+        }
+    }
+
+    uint64_t hash = syntax_hash(syn);
+    if(!syntax_cache_load(syn, hash)) return 0;
+
+    syn->progs = xcalloc(syn->states_len, sizeof(struct RxProg*));
+    for(size_t i = 0; i < syn->states_len; i++) {
+        const struct SyntaxState *state = &syn->states[i];
+        const char **patterns = xcalloc(state->rules_len, sizeof(char*));
+        for(size_t r = 0; r < state->rules_len; r++) {
+            patterns[r] = state->rules[r].pattern;
+        }
+        syn->progs[i] = rx_compile_rules(patterns, state->rules_len);
+        xfree(patterns);
+        if(!syn->progs[i]) {
+            syn->failed = 1;
+            return -1;
+        }
+        syn->rx[i] = rx_new(syn->progs[i]);
+    }
+    syntax_cache_store(syn, hash);
+    return 0;
+}
+
+static void syntax_free(struct Syntax *syn) {
+    if(!syn->rx) return;
+    // the first worker uses `rx`, and all of them do if it is mapped
+    for(size_t i = syn->states_len; syn->progs && i < syn->workers_len * syn->states_len; i++) {
+        rx_free(syn->worker_rx[i]);
+    }
+    xfree(syn->worker_rx);
+    syn->worker_rx = 0;
+    syn->workers_len = 0;
+    for(size_t i = 0; i < syn->states_len; i++) {
+        rx_free(syn->rx[i]);
+        if(syn->progs) rx_prog_free(syn->progs[i]);
+        xfree(syn->rule_styles[i]);
+    }
+    if(syn->cache) munmap(syn->cache, syn->cache_len);
+    xfree(syn->progs);
+    xfree(syn->rx);
+    xfree(syn->state_styles);
+    xfree(syn->rule_styles);
+    syn->progs = 0;
+    syn->rx = 0;
+    syn->cache = 0;
+    syn->cache_len = 0;
+    syn->state_styles = 0;
+    syn->rule_styles = 0;
+}
+
+void syntax_teardown(void) {
+    for(size_t i = 0; i < SYNTAX_LEN(SYNTAXES); i++) {
+        syntax_free(&SYNTAXES[i]);
+    }
+}
+
+// Lexes the line starting in `state`, sets the spans of its styled tokens
+// Returns the state at the start of the next line
+static uint8_t syntax_line(struct Syntax *syn, struct Rx *const *rx, struct Line *line, uint8_t state) {
+    const char *s = str_as_cstr(&line->text);
+    size_t len = str_cstr_len(&line->text);
+    _Bool ascii = !line->text.char_pos.len;
+
+    vec_clear(&line->spans);
+    // a zeroed line has no element type
+    line->spans.type_size = sizeof(struct StyleSpan);
+
+    size_t pos = 0;
+    // `pos` in characters
+    size_t col = 0;
+    while(pos < len) {
+        size_t rule = 0;
+        ssize_t end = rx_match_at(rx[state], s, len, pos, &rule);
+        uint16_t id;
+        size_t chars;
+        if(end <= (ssize_t)pos) {
+            // no token here, the character takes the style of the state
+            id = syn->state_styles[state];
+            chars = 1;
+            end = pos + 1;
+            while((size_t)end < len && utf8_is_follow(s[end])) end++;
+        } else {
+            id = syn->rule_styles[state][rule];
+            chars = ascii ? (size_t)end - pos : utf8_count_chars(s + pos, end - pos);
+            int next = syn->states[state].rules[rule].next;
+            if(next != SYNTAX_STAY) state = next;
+        }
+        if(id != STYLE_ID_NONE) line_span_push(line, col, chars, id);
+        pos = end;
+        col += chars;
+    }
+
+    int eol = syn->states[state].eol;
+    return eol == SYNTAX_STAY ? state : eol;
+}
+
+// state at the start of line `idx`, the line before it must be highlighted
+static uint8_t syntax_state_before(struct Buffer *buff, size_t idx) {
+    if(!idx) return 0;
+    return (VEC_GET(struct Line, &buff->lines, idx - 1))->syntax_state;
+}
+
+// Lexes the lines [start, end) starting in `state` with the matchers `rx`
+// Returns the state at the start of line `end`
+static uint8_t syntax_lines_rx(
+        struct Syntax *syn,
+        struct Rx *const *rx,
+        struct Buffer *buff,
+        size_t start,
+        size_t end,
+        uint8_t state) {
+    for(size_t i = start; i < end; i++) {
+        struct Line *l = VEC_GET(struct Line, &buff->lines, i);
+        state = l->syntax_state = syntax_line(syn, rx, l, state);
+    }
+    return state;
+}
+
+static uint8_t syntax_lines(struct Syntax *syn, struct Buffer *buff, size_t start, size_t end, uint8_t state) {
+    return syntax_lines_rx(syn, syn->rx, buff, start, end, state);
+}
+
+// Returns the matchers of the states for each worker of the pool, the lazy
+// DFAs cannot be shared between threads, the mapped ones can
+static struct Rx **syntax_worker_rx(struct Syntax *syn) {
+    size_t workers = pool_size();
+    if(syn->workers_len == workers) return syn->worker_rx;
+    assert(!syn->workers_len && "the pool does not change size");
+
+    syn->worker_rx = xcalloc(workers * syn->states_len, sizeof(struct Rx*));
+    for(size_t w = 0; w < workers; w++) {
+        for(size_t i = 0; i < syn->states_len; i++) {
+            struct Rx **rx = &syn->worker_rx[w * syn->states_len + i];
+            *rx = w && syn->progs ? rx_new(syn->progs[i]) : syn->rx[i];
+        }
+    }
+    syn->workers_len = workers;
+    return syn->worker_rx;
+}
+
+struct SyntaxBatch {
+    struct Syntax *syn;
+    struct Rx **worker_rx;
+    struct Buffer *buff;
+    size_t start;
+    size_t end;
+    // state at the start of the first line
+    uint8_t state;
+};
+
+static void syntax_task(void *data, size_t idx, size_t worker) {
+    struct SyntaxBatch *batch = data;
+    struct Syntax *syn = batch->syn;
+    size_t start = batch->start + idx * SYNTAX_TASK_LINES;
+    size_t end = batch->end - start > SYNTAX_TASK_LINES ? start + SYNTAX_TASK_LINES : batch->end;
+    // the lines after the first task are lexed from a guess
+    uint8_t state = idx ? 0 : batch->state;
+    syntax_lines_rx(syn, &batch->worker_rx[worker * syn->states_len], batch->buff, start, end, state);
+}
+
+// Lexes the lines [start, end) starting in `state` like `syntax_lines`,
+// spread over the pool
+// Every task lexes its own lines and does not need a lock, the ones after
+// the first assume their first line starts in the start state, they are then
+// fixed in order until their end state is the one the guess led to
+static uint8_t syntax_lines_parallel(struct Syntax *syn, struct Buffer *buff, size_t start, size_t end, uint8_t state) {
+    struct SyntaxBatch batch = {
+        .syn = syn,
+        .worker_rx = syntax_worker_rx(syn),
+        .buff = buff,
+        .start = start,
+        .end = end,
+        .state = state,
+    };
+    size_t tasks = (end - start + SYNTAX_TASK_LINES - 1) / SYNTAX_TASK_LINES;
+    pool_run(syntax_task, &batch, tasks);
+
+    for(size_t t = 1; t < tasks; t++) {
+        size_t task_start = start + t * SYNTAX_TASK_LINES;
+        size_t task_end = end - task_start > SYNTAX_TASK_LINES ? task_start + SYNTAX_TASK_LINES : end;
+        state = syntax_state_before(buff, task_start);
+        if(state == 0) continue;
+        for(size_t i = task_start; i < task_end; i++) {
+            struct Line *l = VEC_GET(struct Line, &buff->lines, i);
+            uint8_t next = syntax_line(syn, syn->rx, l, state);
+            if(next == l->syntax_state) break;
+            state = l->syntax_state = next;
+        }
+    }
+    return syntax_state_before(buff, end);
+}
+
+static uint64_t syntax_monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the highlighted lines of a buffer that is not compiled or got shorter
+static struct Syntax *syntax_prepare(struct Buffer *buff) {
+    struct Syntax *syn = buff->syntax;
+    if(!syn || syntax_compile(syn)) return 0;
+    if(buff->syntax_valid > buff->lines.len) buff->syntax_valid = buff->lines.len;
+    return syn;
+}
+
+void syntax_highlight(struct Buffer *buff, size_t start, size_t end) {
+    struct Syntax *syn = syntax_prepare(buff);
+    if(!syn) return;
+    if(end > buff->lines.len) end = buff->lines.len;
+    size_t valid = buff->syntax_valid;
+    if(end <= valid) return;
+
+    if(start <= valid + SYNTAX_SYNC_LINES) {
+        syntax_lines(syn, buff, valid, end, syntax_state_before(buff, valid));
+        buff->syntax_valid = end;
+        return;
+    }
+    // too far from the last highlighted line, lex them from the start state
+    // a few lines above, `syntax_continue` fixes them if the guess was wrong
+    syntax_lines(syn, buff, start - SYNTAX_SYNC_LINES, end, 0);
+}
+
+int syntax_continue(struct Buffer *buff) {
+    struct Syntax *syn = syntax_prepare(buff);
+    if(!syn || buff->syntax_valid == buff->lines.len) return 0;
+
+    size_t len = buff->lines.len;
+    uint8_t state = syntax_state_before(buff, buff->syntax_valid);
+    uint64_t deadline = syntax_monotonic_ns() + SYNTAX_SLICE_NS;
+    size_t batch = pool_size() * SYNTAX_TASK_LINES;
+    do {
+        size_t start = buff->syntax_valid;
+        size_t end;
+        // the lines are only published once the whole batch is lexed
+        if(pool_size() > 1 && len - start >= 2 * SYNTAX_TASK_LINES) {
+            end = len - start > batch ? start + batch : len;
+            state = syntax_lines_parallel(syn, buff, start, end, state);
+        } else {
+            end = len - start > SYNTAX_SLICE_LINES ? start + SYNTAX_SLICE_LINES : len;
+            state = syntax_lines(syn, buff, start, end, state);
+        }
+        buff->syntax_valid = end;
+    } while(buff->syntax_valid < len && syntax_monotonic_ns() < deadline);
+    return 1;
+}
+
+void syntax_update(struct Buffer *buff, size_t start, size_t removed, size_t added) {
+    struct Syntax *syn = syntax_prepare(buff);
+    if(!syn) return;
+    // the lines after the highlighted ones are lexed once they are drawn
+    if(start >= buff->syntax_valid) return;
+
+    size_t valid = start + removed < buff->syntax_valid
+        ? buff->syntax_valid - removed + added
+        : start + added;
+    if(valid > buff->lines.len) valid = buff->lines.len;
+    buff->syntax_valid = valid;
+
+    uint8_t state = syntax_state_before(buff, start);
+    for(size_t i = start; i < valid; i++) {
+        // an edit changing the state of every line after it (opening a
+        // comment) leaves the rest to `syntax_continue`
+        if(i >= start + added + SYNTAX_SYNC_LINES) {
+            buff->syntax_valid = i;
+            break;
+        }
+        struct Line *l = VEC_GET(struct Line, &buff->lines, i);
+        uint8_t end = syntax_line(syn, syn->rx, l, state);
+        // the lines after it start in the same state as before the edit
+        if(i >= start + added && end == l->syntax_state) break;
+        state = l->syntax_state = end;
+    }
+}
+
+#ifdef TESTING
+
+#include "tests.h"
+
+static int syntax_test_id(struct Buffer *buff, size_t line, size_t col) {
+    return line_style_at(buffer_line_get(buff, line), col);
+}
+
+TESTS_START
+
+TEST_DEF(test_syntax_lex)
+    syntax_init();
+    TEST_ASSERT(syntax_for_path("a/b.h") && !syntax_for_path("a.c/b") && !syntax_for_path("Makefile"));
+
+    const char *lines[] = {
+        "#include <stdio.h>",
+        "int integer = 42; // note",
+        "char *s = \"a\\\"b\"; /* open",
+        "still comment */ return 'x';",
+        "\"unterminated",
+        "sizeof_t \"cont\\",
+        "inued\" if",
+    };
+    struct Buffer buff = buffer_test_new(lines, 7, "src/test.c");
+    TEST_ASSERT(!syntax_compile(buff.syntax));
+    syntax_highlight(&buff, 0, buff.lines.len);
+    TEST_ASSERT(buff.syntax_valid == 7);
+
+    int keyword = style_find_id(SYNTAX_KEYWORD);
+    int type = style_find_id(SYNTAX_TYPE);
+    int comment = style_find_id(SYNTAX_COMMENT);
+    int string = style_find_id(SYNTAX_STRING);
+    int number = style_find_id(SYNTAX_NUMBER);
+    int preproc = style_find_id(SYNTAX_PREPROC);
+
+    TEST_ASSERT(syntax_test_id(&buff, 0, 0) == preproc);
+    TEST_ASSERT(syntax_test_id(&buff, 0, 9) == STYLE_ID_NONE);
+    TEST_ASSERT(syntax_test_id(&buff, 1, 0) == type);
+    // a keyword in a name is not one
+    TEST_ASSERT(syntax_test_id(&buff, 1, 4) == STYLE_ID_NONE);
+    TEST_ASSERT(syntax_test_id(&buff, 1, 14) == number);
+    TEST_ASSERT(syntax_test_id(&buff, 1, 18) == comment);
+    TEST_ASSERT(syntax_test_id(&buff, 2, 12) == string);
+    TEST_ASSERT(syntax_test_id(&buff, 2, 16) == STYLE_ID_NONE);
+    TEST_ASSERT(syntax_test_id(&buff, 2, 20) == comment);
+    TEST_ASSERT(buffer_line_get(&buff, 2)->syntax_state == C_COMMENT);
+    TEST_ASSERT(syntax_test_id(&buff, 3, 0) == comment);
+    TEST_ASSERT(syntax_test_id(&buff, 3, 17) == keyword);
+    TEST_ASSERT(syntax_test_id(&buff, 3, 24) == string);
+    TEST_ASSERT(buffer_line_get(&buff, 3)->syntax_state == C_NORMAL);
+    // a string only continues on the next line after a backslash
+    TEST_ASSERT(buffer_line_get(&buff, 4)->syntax_state == C_NORMAL);
+    TEST_ASSERT(syntax_test_id(&buff, 5, 0) == type);
+    TEST_ASSERT(buffer_line_get(&buff, 5)->syntax_state == C_STRING_CONT);
+    TEST_ASSERT(syntax_test_id(&buff, 6, 0) == string);
+    TEST_ASSERT(syntax_test_id(&buff, 6, 5) == string);
+    TEST_ASSERT(syntax_test_id(&buff, 6, 7) == keyword);
+
+    vec_cleanup(&buff.lines);
+    syntax_teardown();
+    style_entry_table_free();
+TEST_ENDDEF
+
+TEST_DEF(test_syntax_update)
+    const char *lines[] = {
+        "int a;",
+        "int b;",
+        "int c;",
+        "int d;",
+        "int e;",
+    };
+    syntax_init();
+    struct Buffer buff = buffer_test_new(lines, 5, "src/test.c");
+    syntax_highlight(&buff, 0, 3);
+    TEST_ASSERT(buff.syntax_valid == 3);
+
+    // opening a comment lexes the lines after it until the end of the
+    // highlighted ones, drawn or not
+    line_insert_at(buffer_line_get(&buff, 0), 0, "/* ", 3);
+    syntax_update(&buff, 0, 1, 1);
+    TEST_ASSERT(buffer_line_get(&buff, 2)->syntax_state == C_COMMENT);
+    TEST_ASSERT(buff.syntax_valid == 3);
+    syntax_highlight(&buff, 0, 5);
+    TEST_ASSERT(buffer_line_get(&buff, 4)->syntax_state == C_COMMENT);
+
+    // an edit that keeps the end state of its line stops there
+    vec_clear(&buffer_line_get(&buff, 3)->spans);
+    line_insert_at(buffer_line_get(&buff, 1), 0, "x", 1);
+    syntax_update(&buff, 1, 1, 1);
+    TEST_ASSERT(buffer_line_get(&buff, 2)->spans.len);
+    TEST_ASSERT(!buffer_line_get(&buff, 3)->spans.len);
+
+    // closing it lexes the lines again until the state converges
+    struct Line closing = line_from_cstr("*/");
+    buffer_line_insert(&buff, 2, closing);
+    syntax_update(&buff, 2, 0, 1);
+    TEST_ASSERT(buff.syntax_valid == 6);
+    TEST_ASSERT(buffer_line_get(&buff, 2)->syntax_state == C_NORMAL);
+    TEST_ASSERT(buffer_line_get(&buff, 5)->syntax_state == C_NORMAL);
+    TEST_ASSERT(buffer_line_get(&buff, 3)->spans.len);
+
+    // removing the lines after the highlighted ones does not lex anything
+    buff.syntax_valid = 2;
+    buffer_lines_remove(&buff, 4, 2);
+    syntax_update(&buff, 4, 2, 0);
+    TEST_ASSERT(buff.syntax_valid == 2);
+
+    vec_cleanup(&buff.lines);
+    syntax_teardown();
+    style_entry_table_free();
+TEST_ENDDEF
+
+TEST_DEF(test_syntax_background)
+    syntax_init();
+    struct Buffer buff = buffer_test_new(0, 0, "src/test.c");
+    struct Line open = line_from_cstr("/*");
+    vec_push(&buff.lines, &open);
+    for(size_t i = 0; i < 3 * SYNTAX_SYNC_LINES; i++) {
+        struct Line l = line_from_cstr("int x;");
+        vec_push(&buff.lines, &l);
+    }
+    size_t last = buff.lines.len - 1;
+    int type = style_find_id(SYNTAX_TYPE);
+    int comment = style_find_id(SYNTAX_COMMENT);
+
+    // the lines drawn far from the top are lexed from a guess right away
+    syntax_highlight(&buff, last - 10, last + 1);
+    TEST_ASSERT(buff.syntax_valid == 0);
+    TEST_ASSERT(syntax_test_id(&buff, last, 0) == type);
+    // and fixed once the lines above them are
+    while(syntax_continue(&buff));
+    TEST_ASSERT(buff.syntax_valid == buff.lines.len);
+    TEST_ASSERT(syntax_test_id(&buff, last, 0) == comment);
+
+    // closing the comment only lexes a bounded number of lines
+    line_insert_at(buffer_line_get(&buff, 0), 2, "*/", 2);
+    syntax_update(&buff, 0, 1, 1);
+    TEST_ASSERT(buff.syntax_valid == SYNTAX_SYNC_LINES + 1);
+    TEST_ASSERT(syntax_test_id(&buff, SYNTAX_SYNC_LINES, 0) == type);
+    // the lines near them are drawn right
+    syntax_highlight(&buff, 2 * SYNTAX_SYNC_LINES, 2 * SYNTAX_SYNC_LINES + 10);
+    TEST_ASSERT(buff.syntax_valid == 2 * SYNTAX_SYNC_LINES + 10);
+    TEST_ASSERT(syntax_test_id(&buff, 2 * SYNTAX_SYNC_LINES + 9, 0) == type);
+    TEST_ASSERT(syntax_continue(&buff));
+    TEST_ASSERT(syntax_test_id(&buff, last, 0) == type);
+    TEST_ASSERT(!syntax_continue(&buff));
+
+    vec_cleanup(&buff.lines);
+    syntax_teardown();
+    style_entry_table_free();
+TEST_ENDDEF
+
+TEST_DEF(test_syntax_parallel)
+    syntax_init();
+    struct Buffer seq = buffer_test_new(0, 0, "src/test.c");
+    struct Buffer par = buffer_test_new(0, 0, "src/test.c");
+    size_t len = 4 * SYNTAX_TASK_LINES + 10;
+    for(size_t i = 0; i < len; i++) {
+        const char *text = "int x = 1; // x";
+        // a comment over the end of the first task, and one over the whole
+        // third task
+        if(i == SYNTAX_TASK_LINES - 2 || i == 2 * SYNTAX_TASK_LINES - 1) text = "char c; /* open";
+        if(i == SYNTAX_TASK_LINES + 3 || i == 3 * SYNTAX_TASK_LINES + 5) text = "close */ long l;";
+        struct Line l = line_from_cstr((char*)text);
+        vec_push(&seq.lines, &l);
+        l = line_from_cstr((char*)text);
+        vec_push(&par.lines, &l);
+    }
+    TEST_ASSERT(!syntax_compile(seq.syntax));
+
+    syntax_lines(seq.syntax, &seq, 0, len, 0);
+    TEST_ASSERT(syntax_lines_parallel(par.syntax, &par, 0, len, 0) == C_NORMAL);
+    _Bool same = 1;
+    for(size_t i = 0; i < len; i++) {
+        struct Line *a = buffer_line_get(&seq, i);
+        struct Line *b = buffer_line_get(&par, i);
+        if(a->syntax_state != b->syntax_state
+                || a->spans.len != b->spans.len
+                || memcmp(a->spans.buf, b->spans.buf, a->spans.len * sizeof(struct StyleSpan))) {
+            same = 0;
+        }
+    }
+    TEST_ASSERT(same);
+    TEST_ASSERT(buffer_line_get(&par, 3 * SYNTAX_TASK_LINES)->syntax_state == C_COMMENT);
+
+    vec_cleanup(&seq.lines);
+    vec_cleanup(&par.lines);
+    syntax_teardown();
+    style_entry_table_free();
+    pool_shutdown();
+TEST_ENDDEF
+
+TEST_DEF(test_syntax_cache)
+    syntax_init();
+    const char *lines[] = {
+        "#define X 1",
+        "int x = 0x1f; /* c",
+        "*/ return \"s\";",
+    };
+    struct Buffer buff = buffer_test_new(lines, 3, "src/test.c");
+    struct Syntax *syn = buff.syntax;
+    char path[4096];
+    TEST_ASSERT(!syntax_cache_path(syn, syntax_hash(syn), path, sizeof(path), 1));
+    unlink(path);
+    // the file of older rules is removed when the new one is written
+    char stale[4096];
+    TEST_ASSERT(!syntax_cache_path(syn, syntax_hash(syn) ^ 1, stale, sizeof(stale), 1));
+    close(open(stale, O_WRONLY | O_CREAT, 0600));
+
+    // compiled and saved the first time
+    TEST_ASSERT(!syntax_compile(syn));
+    TEST_ASSERT(syn->progs && !syn->cache);
+    TEST_ASSERT(!access(path, R_OK));
+    TEST_ASSERT(access(stale, F_OK));
+    syntax_highlight(&buff, 0, buff.lines.len);
+    Vec compiled[3];
+    for(size_t i = 0; i < 3; i++) {
+        Vec *spans = &buffer_line_get(&buff, i)->spans;
+        compiled[i] = VEC_NEW(struct StyleSpan, 0);
+        vec_extend(&compiled[i], spans->buf, spans->len);
+    }
+    syntax_teardown();
+
+    // then mapped, and it lexes the same
+    buff.syntax_valid = 0;
+    TEST_ASSERT(!syntax_compile(syn));
+    TEST_ASSERT(!syn->progs && syn->cache);
+    syntax_highlight(&buff, 0, buff.lines.len);
+    for(size_t i = 0; i < 3; i++) {
+        Vec *spans = &buffer_line_get(&buff, i)->spans;
+        TEST_ASSERT(spans->len == compiled[i].len);
+        TEST_ASSERT(!memcmp(spans->buf, compiled[i].buf, spans->len * sizeof(struct StyleSpan)));
+        vec_cleanup(&compiled[i]);
+    }
+    syntax_teardown();
+
+    // a damaged file is compiled again
+    TEST_ASSERT(!truncate(path, sizeof(struct SyntaxCacheHeader) + 16));
+    TEST_ASSERT(!syntax_compile(syn));
+    TEST_ASSERT(syn->progs && !syn->cache);
+    syntax_teardown();
+
+    unlink(path);
+    vec_cleanup(&buff.lines);
+    style_entry_table_free();
+TEST_ENDDEF
+
+TESTS_END
+
+#endif
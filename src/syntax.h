@@ -0,0 +1,111 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYNTAX_KEYWORD "syntax_keyword"
+#define SYNTAX_TYPE "syntax_type"
+#define SYNTAX_COMMENT "syntax_comment"
+#define SYNTAX_STRING "syntax_string"
+#define SYNTAX_NUMBER "syntax_number"
+#define SYNTAX_PREPROC "syntax_preproc"
+
+// the lexer stays in its state
+#define SYNTAX_STAY -1
+
+struct Buffer;
+
+// A language is lexed line by line by a small state machine, each state has
+// its own token rules. The state at the end of every line is kept with the
+// line, an edit only lexes the lines after it until their end state is the
+// same as before.
+
+// A token rule of a lexer state, the longest match wins and the first rule
+// wins between matches of the same length
+struct SyntaxRule {
+    // basic regex, it must be supported by the built-in engine (see rx.h)
+    const char *pattern;
+    // style of the token, null to leave it unstyled
+    const char *style;
+    // state after the token, or SYNTAX_STAY
+    int next;
+};
+
+struct SyntaxState {
+    // style of the text no rule matches, null to leave it unstyled
+    const char *style;
+    const struct SyntaxRule *rules;
+    size_t rules_len;
+    // state at the start of the next line, or SYNTAX_STAY
+    int eol;
+};
+
+// How the lines of a language are indented, see indent.h
+struct SyntaxIndent {
+    // brackets indenting the lines after them, and the ones closing them
+    const char *open;
+    const char *close;
+    // lines starting with one of them are flush with the margin (ie: the
+    // preprocessor lines of C)
+    const char *flush;
+};
+
+struct Syntax {
+    const char *name;
+    // null terminated list of the file extensions of the language
+    const char *const *extensions;
+    // the lexer starts in the first state
+    const struct SyntaxState *states;
+    size_t states_len;
+    struct SyntaxIndent indent;
+    // set by `syntax_compile`, one per state, `progs` is null if the DFAs
+    // were mapped from the cache
+    struct RxProg **progs;
+    struct Rx **rx;
+    // the mapped cache file
+    void *cache;
+    size_t cache_len;
+    // matchers of the states for each worker of the pool, see `pool.h`
+    struct Rx **worker_rx;
+    size_t workers_len;
+    // style ids of the states and of their rules, `STYLE_ID_NONE` if unstyled
+    uint16_t *state_styles;
+    uint16_t **rule_styles;
+    // set if one of the rules could not be compiled, nothing is highlighted
+    _Bool failed;
+};
+
+// Registers the default styles of the tokens
+void syntax_init(void);
+
+// Returns the syntax of the file at `path`, null if there is none
+struct Syntax *syntax_for_path(const char *path);
+
+// Compiles the rules of the syntax if they are not already, or maps them
+// from the cache
+// Returns:
+//  0 on success
+//  -1 if one of the rules is invalid
+int syntax_compile(struct Syntax *syn);
+
+// Highlights the lines [start, end) before they are drawn, the highlighted
+// lines are extended to them if they are close enough, otherwise they are
+// lexed from a guess a few lines above them
+void syntax_highlight(struct Buffer *buff, size_t start, size_t end);
+
+// Highlights the lines after the highlighted ones for a slice of time,
+// called from the event loop
+// Returns 1 if lines were lexed
+int syntax_continue(struct Buffer *buff);
+
+// Highlights the lines [start, start+added) that replaced the lines
+// [start, start+removed) and the ones after them until their end state is
+// the same as before the edit, the lines far after them are left to
+// `syntax_continue`
+void syntax_update(struct Buffer *buff, size_t start, size_t removed, size_t added);
+
+// Frees the compiled rules of the syntaxes
+void syntax_teardown(void);
+
+#endif
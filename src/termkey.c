@@ -11,6 +11,14 @@
 #include <assert.h>
 
 #include "utf.h"
+#include "journal.h"
+
+// reads from the terminal, every byte read is mirrored in the journal
+static ssize_t term_read(int fd, void *buf, size_t len) {
+    ssize_t ret = read(fd, buf, len);
+    if(ret > 0) journal_input(buf, ret);
+    return ret;
+}
 
 // Attempts to read an unsigned int from fd
 // this reads one char past the end of the number
@@ -25,7 +33,7 @@
 static int readuc(int fd, unsigned char *restrict i) {
     int ret = 0;
     unsigned char c = 0;
-    while((ret = read(fd, &c, 1)) > 0 && isdigit(c)) {
+    while((ret = term_read(fd, &c, 1)) > 0 && isdigit(c)) {
         // check for overflow
         if(*i > UCHAR_MAX / 10) return -2;
         *i *= 10;
@@ -41,7 +49,7 @@ static int read_utf8(int fd, char (*out)[4], int count) {
     int ret;
     char c;
     for(int i = 1; i < count; i++) {
-        ret = read(fd, &c, 1);
+        ret = term_read(fd, &c, 1);
         assert(c != 0 && "null byte in stream");
         if(ret == -1) return -1;
         // missing a byte
@@ -57,7 +65,7 @@ int readkey(int fd, struct KeyEvent *restrict e) {
     unsigned char c = 0;
     int ret = 0;
 
-    ret = read(fd, &c, 1);
+    ret = term_read(fd, &c, 1);
     if(ret == -1) return -1;
     if(ret == 0) return 0;
 
@@ -76,7 +84,7 @@ int readkey(int fd, struct KeyEvent *restrict e) {
     }
 
     // read second char
-    ret = read(fd, &c, 1);
+    ret = term_read(fd, &c, 1);
     if(ret == -1) return -1;
 
     // there was only one char
@@ -153,7 +161,7 @@ int readkey(int fd, struct KeyEvent *restrict e) {
 
     // read third char
     c = 0;
-    ret = read(fd, &c, 1);
+    ret = term_read(fd, &c, 1);
     if(ret == -1) return -1;
 
     if(!ret) {
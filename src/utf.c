@@ -39,6 +39,14 @@ int utf8_byte_count(utf8 c) {
     return 1;
 }
 
+size_t utf8_count_chars(const utf8 *s, size_t len) {
+    size_t count = 0;
+    for(size_t i = 0; i < len; i++) {
+        count += !utf8_is_follow(s[i]);
+    }
+    return count;
+}
+
 size_t utf8_find_start(const utf8 *s, size_t len, size_t idx) {
     if(idx >= len) return -1;
     while(idx > 0) {
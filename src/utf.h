@@ -24,6 +24,9 @@ int utf32_len_utf8(utf32 c);
 //  Assumes that the UTF-8 sequence is valid
 size_t utf8_find_start(const utf8 *s, size_t len, size_t idx);
 
+// Returns the number of characters in the first `len` bytes of `s`
+size_t utf8_count_chars(const utf8 *s, size_t len);
+
 int utf8_to_utf32(const utf8 *s, size_t len, utf32 *out);
 
 int utf32_to_utf8(utf32 c, utf8 *buff, size_t size);
@@ -333,7 +333,15 @@ ssize_t take_cols_rev(const Str *restrict line, size_t *nb_cols, int tab_width)
 
 size_t render_width(Str *s, size_t len) {
     size_t width = 0;
-    for(size_t i = 0; i < len; i++) {
+    size_t i = 0;
+    // a string without a character table is ASCII, the printable characters
+    // are one column wide
+    if(!s->char_pos.len) {
+        const char *bytes = str_as_cstr(s);
+        while(i < len && bytes[i] >= ' ' && bytes[i] < 0x7f) i++;
+        width = i;
+    }
+    for(; i < len; i++) {
         utf32 c = 0;
         assert(!str_get_char(s, i, &c));
 